@@ -1,13 +1,27 @@
+#include "pandas_mask_compare.h"
+#include "pandas_mask_expr.h"
+#include "pandas_mask_fill.h"
 #include "pandas_mask_impl.h"
+#include "pandas_mask_kleene.h"
+#include "pandas_mask_parallel.h"
+#include "pandas_mask_reduce.h"
 
+#include <cstdint>
+#include <cstring>
 #include <functional>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
 
 #include <nanoarrow/nanoarrow.h>
 #include <nanobind/make_iterator.h>
 #include <nanobind/nanobind.h>
 #include <nanobind/ndarray.h>
+#include <nanobind/stl/filesystem.h>
+#include <nanobind/stl/optional.h>
 #include <nanobind/stl/string.h>
 #include <nanobind/stl/vector.h>
 
@@ -15,6 +29,159 @@ namespace nb = nanobind;
 using namespace nb::literals;
 
 using np_arr_type = nb::ndarray<nb::numpy, bool, nb::shape<-1>>;
+using np_uint8_arr_type = nb::ndarray<nb::numpy, uint8_t, nb::shape<-1>>;
+using np_int64_arr_type = nb::ndarray<nb::numpy, int64_t, nb::shape<-1>>;
+
+/// Allocates an uninitialized 1D array through NumPy, so that the array
+/// owns its memory and no capsule is needed to free it
+template <typename T>
+auto EmptyNdArray(ssize_t nelems, const char *dtype) -> T {
+  const auto np = nb::module_::import_("numpy");
+  return nb::cast<T>(np.attr("empty")(nelems, "dtype"_a = dtype), false);
+}
+
+/// Runs func with the GIL released, so other Python threads keep running
+/// during a long kernel. func must only touch C++ state that no Python
+/// thread can replace meanwhile, e.g. a copy of a mask's impl, which shares
+/// the buffer but detaches before any write. The one exception is the impl
+/// an in-place or out= operation writes, which is detached beforehand; as
+/// with NumPy's out=, other threads must leave that mask alone meanwhile
+template <typename F> auto WithoutGil(F &&func) {
+  nb::gil_scoped_release release;
+  return func();
+}
+
+/// Runs a file operation, raising OSError, or the subclass matching its
+/// errno such as FileNotFoundError, if it fails
+template <typename F>
+auto WithOSError(const std::filesystem::path &path, F &&func) {
+  try {
+    return func();
+  } catch (const std::system_error &e) {
+    const auto condition = e.code().default_error_condition();
+    PyErr_SetObject(PyExc_OSError,
+                    nb::make_tuple(condition.value(), condition.message(),
+                                   path.string())
+                        .ptr());
+    throw nb::python_error();
+  }
+}
+
+/// Packs a NumPy bool array without holding the GIL
+auto PackNdArray(const np_arr_type &bools) -> PandasMaskArrayImpl {
+  const auto *values = reinterpret_cast<const uint8_t *>(bools.data());
+  const auto length = static_cast<int64_t>(bools.shape(0));
+  return WithoutGil(
+      [&] { return PandasMaskArrayImpl::Pack(values, length); });
+}
+
+/// Calls func(data, length) with values as a 1D contiguous array of the
+/// first of Ts that matches its dtype
+template <typename T, typename... Ts, typename F>
+auto WithNumbers(nb::handle values, F &&func) -> nb::object {
+  nb::ndarray<nb::numpy, const T, nb::shape<-1>, nb::c_contig> array;
+  if (nb::try_cast(values, array, false)) {
+    return func(array.data(), static_cast<int64_t>(array.shape(0)));
+  }
+  if constexpr (sizeof...(Ts) > 0) {
+    return WithNumbers<Ts...>(values, std::forward<F>(func));
+  } else {
+    throw nb::type_error(
+        "values must be a contiguous 1D array of integers or floats");
+  }
+}
+
+/// WithNumbers over every NumPy integer and float dtype
+template <typename F>
+auto WithAnyNumbers(nb::handle values, F &&func) -> nb::object {
+  return WithNumbers<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                     uint32_t, uint64_t, float, double>(
+      values, std::forward<F>(func));
+}
+
+/// A scalar to write to values of type T, which it must fit in
+template <typename T> auto CastScalar(nb::handle scalar) -> T {
+  T value;
+  if (!nb::try_cast(scalar, value)) {
+    throw nb::type_error("scalar does not fit the dtype of values");
+  }
+  return value;
+}
+
+/// A Python or NumPy number to compare values with, of whatever type. Anything
+/// supporting __index__ is an integer, kept exact unless it exceeds 64 bits
+auto ComparisonScalar(nb::handle scalar) -> pandas_mask::compare::Scalar {
+  if (PyIndex_Check(scalar.ptr())) {
+    const auto index = nb::steal(PyNumber_Index(scalar.ptr()));
+    if (!index.is_valid()) {
+      throw nb::python_error();
+    }
+    int64_t value;
+    if (nb::try_cast(index, value, false)) {
+      return value;
+    }
+    uint64_t unsigned_value;
+    if (nb::try_cast(index, unsigned_value, false)) {
+      return unsigned_value;
+    }
+  }
+  double value;
+  if (!nb::try_cast(scalar, value)) {
+    throw nb::type_error("scalar must be a real number");
+  }
+  return value;
+}
+
+/// out as a writable contiguous 1D array of length values of type T
+template <typename T>
+auto OutputArray(nb::handle out, int64_t length)
+    -> nb::ndarray<nb::numpy, T, nb::shape<-1>, nb::c_contig> {
+  nb::ndarray<nb::numpy, T, nb::shape<-1>, nb::c_contig> array;
+  if (!nb::try_cast(out, array, false) ||
+      static_cast<int64_t>(array.shape(0)) != length) {
+    throw nb::type_error("out must be a writable contiguous 1D array of the "
+                         "same dtype and length as values");
+  }
+  return array;
+}
+
+/// Whether the length values at a and b share some but not all of their
+/// memory. The fill kernels may write to one of their inputs, but only when
+/// it is exactly the output
+template <typename T>
+auto PartlyOverlaps(const T *a, const T *b, int64_t length) -> bool {
+  const auto lhs = reinterpret_cast<uintptr_t>(a);
+  const auto rhs = reinterpret_cast<uintptr_t>(b);
+  const auto nbytes = static_cast<uintptr_t>(length) * sizeof(T);
+  return length > 0 && lhs != rhs && lhs < rhs + nbytes && rhs < lhs + nbytes;
+}
+
+/// Either the symbol or the name of a comparison operator, e.g. ">" or "gt"
+auto ParseComparison(const std::string &op)
+    -> pandas_mask::compare::Comparison {
+  using pandas_mask::compare::Comparison;
+  static const std::pair<const char *, Comparison> kOps[] = {
+      {"<", Comparison::Less},
+      {"lt", Comparison::Less},
+      {"<=", Comparison::LessEqual},
+      {"le", Comparison::LessEqual},
+      {"==", Comparison::Equal},
+      {"eq", Comparison::Equal},
+      {"!=", Comparison::NotEqual},
+      {"ne", Comparison::NotEqual},
+      {">", Comparison::Greater},
+      {"gt", Comparison::Greater},
+      {">=", Comparison::GreaterEqual},
+      {"ge", Comparison::GreaterEqual},
+  };
+  for (const auto &[name, comparison] : kOps) {
+    if (op == name) {
+      return comparison;
+    }
+  }
+  throw nb::value_error(
+      "op must be one of '<', '<=', '==', '!=', '>', '>=' or their names");
+}
 
 class PandasMaskArray {
 public:
@@ -26,16 +193,18 @@ public:
   explicit PandasMaskArray(PandasMaskArrayImpl &&bmi)
       : pImpl_(std::make_unique<PandasMaskArrayImpl>(std::move(bmi))) {}
 
-  explicit PandasMaskArray(np_arr_type np_array) {
-    pImpl_ = std::make_unique<PandasMaskArrayImpl>(PandasMaskArrayImpl());
-    const auto vw = np_array.view();
-    const auto nelems = vw.shape(0);
+  explicit PandasMaskArray(np_arr_type np_array)
+      : pImpl_(std::make_unique<PandasMaskArrayImpl>(PackNdArray(np_array))) {}
 
-    ArrowBitmapInit(pImpl_->bitmap_.get());
-    NANOARROW_THROW_NOT_OK(ArrowBitmapReserve(pImpl_->bitmap_.get(), nelems));
-    ArrowBitmapAppendInt8Unsafe(
-        pImpl_->bitmap_.get(),
-        reinterpret_cast<const int8_t *>(np_array.data()), nelems);
+  /// compress=None compresses the mask only if that makes it much smaller
+  PandasMaskArray(np_arr_type np_array, std::optional<bool> compress)
+      : PandasMaskArray(np_array) {
+    if (compress.value_or(true)) {
+      auto &impl = *pImpl_;
+      impl = WithoutGil([&] {
+        return compress ? impl.Compress() : impl.CompressIfSmaller();
+      });
+    }
   }
 
   explicit PandasMaskArray(nanoarrow::UniqueBitmap &&bitmap)
@@ -61,46 +230,27 @@ public:
       return nb::inst_take_ownership(py_type, pma);
     }
 
-    // Boolean ndarray
+    // Boolean ndarray or another mask, packed so the selected bits can be
+    // extracted a word at a time
     np_arr_type bools;
-    if (nb::try_cast(indexer_obj, bools, false)) {
-      if (static_cast<ssize_t>(bools.size()) != pImpl_->Length()) {
-        throw nb::value_error(
-            "Boolean array indexer must be same size as PandasMask");
-      }
-
-      const auto vw = bools.view();
-      nanoarrow::UniqueBitmap new_bitmap;
-      ArrowBitmapInit(new_bitmap.get());
-      ArrowBitmapReserve(new_bitmap.get(), bools.size());
-
-      for (ssize_t idx = 0; idx < static_cast<ssize_t>(vw.shape(0)); ++idx) {
-        if (vw(idx)) {
-          const auto is_set = pImpl_->GetItem(idx);
-          ArrowBitmapAppendUnsafe(new_bitmap.get(), is_set, 1);
+    if (nb::try_cast(indexer_obj, bools, false) ||
+        nb::isinstance<PandasMaskArray>(indexer_obj)) {
+      return WithOther(indexer_obj, [&](const PandasMaskArrayImpl &selector) {
+        if (selector.Length() != pImpl_->Length()) {
+          throw nb::value_error(
+              "Boolean array indexer must be same size as PandasMask");
         }
-      }
 
-      auto *pma = new PandasMaskArray(std::move(new_bitmap));
-      nb::handle py_type = nb::type<PandasMaskArray>();
-      return nb::inst_take_ownership(py_type, pma);
+        auto *pma = new PandasMaskArray(pImpl_->Filter(selector));
+        nb::handle py_type = nb::type<PandasMaskArray>();
+        return nb::inst_take_ownership(py_type, pma);
+      });
     }
 
     // Indexing ndarray
     nb::ndarray<const ssize_t, nb::ndim<1>> indices;
     if (nb::try_cast(indexer_obj, indices, false)) {
-      const auto vw = indices.view();
-      nanoarrow::UniqueBitmap new_bitmap;
-      ArrowBitmapInit(new_bitmap.get());
-      ArrowBitmapReserve(new_bitmap.get(), indices.size());
-
-      for (ssize_t idx = 0; idx < static_cast<ssize_t>(vw.shape(0)); ++idx) {
-        const auto pos = vw(idx);
-        const auto is_set = pImpl_->GetItem(pos);
-        ArrowBitmapAppend(new_bitmap.get(), is_set, 1);
-      }
-
-      auto *pma = new PandasMaskArray(std::move(new_bitmap));
+      auto *pma = new PandasMaskArray(Take(indices, false, false));
       nb::handle py_type = nb::type<PandasMaskArray>();
       return nb::inst_take_ownership(py_type, pma);
     }
@@ -111,6 +261,13 @@ public:
       const auto converted_slice = slice_obj.compute(pImpl_->Length());
       auto [start, stop, step, length] = converted_slice;
 
+      // contiguous slices are O(1) views onto our buffer
+      if (step == 1) {
+        auto *pma = new PandasMaskArray(pImpl_->Slice(start, length));
+        nb::handle py_type = nb::type<PandasMaskArray>();
+        return nb::inst_take_ownership(py_type, pma);
+      }
+
       nanoarrow::UniqueBitmap new_bitmap;
       ArrowBitmapInit(new_bitmap.get());
       ArrowBitmapReserve(new_bitmap.get(), length);
@@ -129,6 +286,46 @@ public:
     throw nb::type_error("Invalid data type for GetItem");
   }
 
+  /// Take over an integer ndarray, copying it only if it is not contiguous
+  auto Take(const nb::ndarray<const ssize_t, nb::ndim<1>> &indices,
+            bool allow_fill, bool fill_value) const -> PandasMaskArrayImpl {
+    static_assert(sizeof(ssize_t) == sizeof(int64_t));
+    const auto n = static_cast<int64_t>(indices.shape(0));
+    if (indices.stride(0) == 1) {
+      return pImpl_->Take(reinterpret_cast<const int64_t *>(indices.data()), n,
+                          allow_fill, fill_value);
+    }
+
+    const auto vw = indices.view();
+    std::vector<int64_t> contiguous(n);
+    for (int64_t idx = 0; idx < n; ++idx) {
+      contiguous[idx] = vw(idx);
+    }
+    return pImpl_->Take(contiguous.data(), n, allow_fill, fill_value);
+  }
+
+  /// pandas' take: indices may be an integer ndarray or a list of integers
+  auto Take1D(nb::object indices_obj, bool allow_fill,
+              nb::object fill_value_obj) const -> PandasMaskArray {
+    const bool fill_value =
+        !fill_value_obj.is_none() && nb::cast<bool>(fill_value_obj);
+
+    nb::ndarray<const ssize_t, nb::ndim<1>> indices;
+    if (nb::try_cast(indices_obj, indices, false)) {
+      return PandasMaskArray(Take(indices, allow_fill, fill_value));
+    }
+
+    std::vector<ssize_t> values;
+    if (nb::try_cast(indices_obj, values, false)) {
+      return PandasMaskArray(
+          pImpl_->Take(reinterpret_cast<const int64_t *>(values.data()),
+                       static_cast<int64_t>(values.size()), allow_fill,
+                       fill_value));
+    }
+
+    throw nb::type_error("take requires an integer ndarray or list");
+  }
+
   auto SetItem(nb::object indexer_obj, nb::object value_obj) {
     // scalar indexer
     ssize_t i;
@@ -147,32 +344,36 @@ public:
       const auto converted_slice = slice_obj.compute(pImpl_->Length());
       auto [start, stop, step, length] = converted_slice;
 
-      // assign scalar
+      // assign scalar; step 1 slices become a word-level range fill
       bool value;
       if (nb::try_cast(value_obj, value)) {
-        // optimization for an empty slice with a scalar value assignment
-        if ((start == 0) && (stop == pImpl_->Length()) && (step == 1)) {
-          ArrowBitsSetTo(pImpl_->bitmap_->buffer.data, 0, stop, value);
-          return;
-        } else {
-          for (size_t i = 0; i < length; ++i) {
-            if (value) {
-              ArrowBitSet(pImpl_->bitmap_->buffer.data, start);
-            } else {
-              ArrowBitClear(pImpl_->bitmap_->buffer.data, start);
-            }
-            start += step;
-          }
-          return;
-        }
+        pImpl_->SetStrided(start, step, length, value);
+        return;
       }
 
-      // empty slice with another mask
-      if (nb::isinstance<PandasMaskArray>(value_obj)) {
+      // full slice with another mask; the buffer is shared until either
+      // side is written to
+      if ((start == 0) && (length == pImpl_->Length()) && (step == 1) &&
+          nb::isinstance<PandasMaskArray>(value_obj)) {
         const auto other = nb::cast<PandasMaskArray &>(value_obj);
         pImpl_ = std::make_unique<PandasMaskArrayImpl>(other.pImpl_->Copy());
         return;
       }
+
+      // another mask or bool ndarray, blitted in word by word when step is 1
+      np_arr_type bools;
+      if (nb::try_cast(value_obj, bools, false) ||
+          nb::isinstance<PandasMaskArray>(value_obj)) {
+        return WithOther(value_obj, [&](const PandasMaskArrayImpl &values) {
+          if (values.Length() != static_cast<ssize_t>(length)) {
+            std::stringstream ss;
+            ss << "could not assign " << values.Length()
+               << " values to a slice of length " << length;
+            throw nb::value_error(ss.str().c_str());
+          }
+          pImpl_->SetStrided(start, step, values);
+        });
+      }
     }
 
     // Indexing ndarray with boolean scalar assignment
@@ -190,49 +391,54 @@ public:
             throw std::out_of_range(ss.str());
           }
 
-          if (value) {
-            ArrowBitSet(pImpl_->bitmap_->buffer.data, assign_idx);
-          } else {
-            ArrowBitClear(pImpl_->bitmap_->buffer.data, assign_idx);
-          }
+          pImpl_->SetItem(assign_idx, value);
         }
         return;
       }
     }
 
-    // Boolean ndarray
+    // Boolean ndarray or another mask
     np_arr_type bools;
-    if (nb::try_cast(indexer_obj, bools, false)) {
-      // can use a fast path if the size of the indexer matches our bitmask
-      const auto vw = bools.view();
-
-      // TODO: nanoarrow has ArrowBitsUnpackInt8 but not Pack equivalent,
-      // leaving some performance on the table
-      // if (pImpl_->Length() == static_cast<ssize_t>(vw.shape(0))) {
-      //  bool value;
-      //  if (nb::try_cast(value_obj, value)) {
-      // }
-      if (pImpl_->Length() != static_cast<ssize_t>(vw.shape(0))) {
-        throw nb::value_error(
-            "__setitem__ requires indexer must be same length as bitmask");
-      }
+    if (nb::try_cast(indexer_obj, bools, false) ||
+        nb::isinstance<PandasMaskArray>(indexer_obj)) {
+      return WithOther(indexer_obj, [&](const PandasMaskArrayImpl &selector) {
+        if (pImpl_->Length() != selector.Length()) {
+          throw nb::value_error(
+              "__setitem__ requires indexer must be same length as bitmask");
+        }
 
-      bool value;
-      if (nb::try_cast(value_obj, value)) {
-        for (ssize_t idx = 0; idx < static_cast<ssize_t>(vw.shape(0)); ++idx) {
-          const auto should_change = vw(idx);
-          if (!should_change) {
-            continue;
+        // a scalar becomes a word-level or / and-not
+        bool value;
+        if (nb::try_cast(value_obj, value)) {
+          if (value) {
+            pImpl_->BinaryOpInPlace(selector, std::bit_or<>());
           } else {
-            if (value) {
-              ArrowBitSet(pImpl_->bitmap_->buffer.data, idx);
+            pImpl_->BinaryOpInPlace(selector, BitAndNot());
+          }
+          return;
+        }
+
+        // NumPy accepts either a full-length array, in which case only the
+        // selected elements are read, or one value per selected element
+        np_arr_type value_bools;
+        if (nb::try_cast(value_obj, value_bools, false) ||
+            nb::isinstance<PandasMaskArray>(value_obj)) {
+          return WithOther(value_obj, [&](const PandasMaskArrayImpl &values) {
+            if (values.Length() == selector.Length()) {
+              pImpl_->Blend(selector, values);
+            } else if (values.Length() == selector.Sum()) {
+              pImpl_->Scatter(selector, values);
             } else {
-              ArrowBitClear(pImpl_->bitmap_->buffer.data, idx);
+              throw nb::value_error("boolean index assignment requires as "
+                                    "many values as selected elements or "
+                                    "the full length of the bitmask");
             }
-          }
+          });
         }
-        return;
-      }
+
+        throw nb::type_error("Combination of indexer and value not "
+                             "implemented by pandas_mask");
+      });
     }
 
     // TODO: there are probably many more __setitem__ operations needed to
@@ -243,56 +449,436 @@ public:
         "Combination of indexer and value not implemented by pandas_mask");
   }
 
-  template <typename OP> auto BinOp(nb::object other) const {
+  /// Calls func with the impl of other, which may be another mask or a NumPy
+  /// bool array. Masks are passed through without copying
+  template <typename F> static auto WithOther(nb::handle other, F &&func) {
     np_arr_type bools;
 
     // ndarray
     if (nb::try_cast(other, bools, false)) {
-      PandasMaskArray other_pma{bools};
-      return PandasMaskArray(pImpl_->BinaryOp(*other_pma.pImpl_.get(), OP()));
+      const auto other_impl = PackNdArray(bools);
+      return func(other_impl);
     }
 
-    if (nb::inst_check(other)) {
+    if (nb::isinstance<PandasMaskArray>(other)) {
       const auto other_pma = nb::inst_ptr<PandasMaskArray>(other);
-      return PandasMaskArray(pImpl_->BinaryOp(*other_pma->pImpl_.get(), OP()));
+      return func(*other_pma->pImpl_.get());
     }
 
     throw nb::type_error("Invalid other argument");
   }
 
+  /// What a write to target reads of source without the GIL: a copy, which
+  /// no other thread can replace, or nothing when source is target itself,
+  /// as sharing its buffer would make the write copy it
+  static auto ReadCopy(const PandasMaskArrayImpl &source,
+                       const PandasMaskArrayImpl &target)
+      -> std::optional<PandasMaskArrayImpl> {
+    if (&source == &target) {
+      return std::nullopt;
+    }
+    return source.Copy();
+  }
+
+  template <typename OP> auto BinOp(nb::object other) const {
+    return WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      const auto lhs = pImpl_->Copy();
+      const auto rhs = other_impl.Copy();
+      return PandasMaskArray(
+          WithoutGil([&] { return lhs.BinaryOp(rhs, OP()); }));
+    });
+  }
+
+  /// BinOp writing into a preallocated mask when out is given
+  template <typename OP>
+  auto BinOpOut(nb::object other, nb::object out) const -> nb::object {
+    if (out.is_none()) {
+      return nb::cast(BinOp<OP>(other));
+    }
+
+    auto &target = *nb::cast<PandasMaskArray &>(out).pImpl_;
+    WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      target.Detach();
+      const auto lhs = ReadCopy(*pImpl_, target);
+      const auto rhs = ReadCopy(other_impl, target);
+      WithoutGil([&] {
+        (lhs ? *lhs : target).BinaryOpInto(rhs ? *rhs : target, OP(), target);
+      });
+    });
+    return out;
+  }
+
+  template <typename OP> auto InPlaceBinOp(nb::object other) {
+    WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      auto &target = *pImpl_;
+      // two compressed masks merge their runs into a new mask rather than
+      // writing a bitmap, which replaces this one once the GIL is held
+      if (target.IsCompressed() && other_impl.IsCompressed()) {
+        const auto lhs = target.Copy();
+        const auto rhs = other_impl.Copy();
+        target = WithoutGil([&] { return lhs.BinaryOp(rhs, OP()); });
+        return;
+      }
+
+      target.Detach();
+      const auto rhs = ReadCopy(other_impl, target);
+      WithoutGil([&] { target.BinaryOpInPlace(rhs ? *rhs : target, OP()); });
+    });
+  }
+
+  /// Reductions over op(this, other) that never allocate the combined mask
+  template <typename OP> auto CountOp(nb::object other) const -> ssize_t {
+    return WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      return pImpl_->BinaryCount(other_impl, OP());
+    });
+  }
+
+  template <typename OP> auto AnyOp(nb::object other) const -> bool {
+    return WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      return pImpl_->BinaryAny(other_impl, OP());
+    });
+  }
+
+  template <typename OP> auto AllOp(nb::object other) const -> bool {
+    return WithOther(other, [&](const PandasMaskArrayImpl &other_impl) {
+      return pImpl_->BinaryAll(other_impl, OP());
+    });
+  }
+
+  auto Invert(nb::object out) const -> nb::object {
+    if (out.is_none()) {
+      const auto impl = pImpl_->Copy();
+      return nb::cast(
+          PandasMaskArray(WithoutGil([&] { return impl.Invert(); })));
+    }
+
+    auto &target = *nb::cast<PandasMaskArray &>(out).pImpl_;
+    target.Detach();
+    const auto source = ReadCopy(*pImpl_, target);
+    WithoutGil([&] { (source ? *source : target).InvertInto(target); });
+    return out;
+  }
+
   auto Bytes() const {
-    auto py_bytearray = PyByteArray_FromStringAndSize(
-        reinterpret_cast<const char *>(pImpl_->bitmap_->buffer.data),
-        pImpl_->bitmap_->buffer.size_bytes);
-    auto bytearray = nb::steal(py_bytearray);
-    auto py_bytes = PyBytes_FromObject(bytearray.ptr());
-    return nb::steal(py_bytes);
+    // the mask may start part way into its buffer, so shift its bits into a
+    // zeroed bytes object rather than copying the buffer verbatim
+    const auto nbytes = pImpl_->NBytes();
+    auto py_bytes = nb::steal(PyBytes_FromStringAndSize(nullptr, nbytes));
+    if (!py_bytes.is_valid()) {
+      throw nb::python_error();
+    }
+    auto *data = reinterpret_cast<uint8_t *>(PyBytes_AS_STRING(py_bytes.ptr()));
+    memset(data, 0, nbytes);
+    pImpl_->CopyInto(data, 0);
+    return py_bytes;
   }
 
-  auto NdArray(nb::object, bool) const noexcept -> np_arr_type {
+  /// What a Py_buffer exported by GetBuffer owns
+  struct BufferView {
+    PandasMaskArrayImpl impl;
+    Py_ssize_t shape;
+    Py_ssize_t stride;
+  };
+
+  /// Buffer protocol over the packed bytes, so memoryview(mask) and
+  /// np.frombuffer(mask) need no copy. A mask starting part way into a byte,
+  /// or with stray padding bits, is repacked once first. Views are
+  /// read-only and hold their own reference to the buffer, so a later write
+  /// to the mask detaches from them rather than changing what they see
+  static auto GetBuffer(PyObject *self, Py_buffer *view, int flags) noexcept
+      -> int {
+    view->obj = nullptr;
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE) {
+      PyErr_SetString(PyExc_BufferError,
+                      "PandasMaskArray does not export writable buffers");
+      return -1;
+    }
+
+    // an empty buffer still needs a valid pointer
+    static const uint8_t kEmpty = 0;
+
+    try {
+      auto &bma = *nb::inst_ptr<PandasMaskArray>(self);
+      if (!bma.pImpl_->IsPacked()) {
+        *bma.pImpl_ = bma.pImpl_->Packed();
+      }
+
+      auto *exported =
+          new BufferView{bma.pImpl_->Copy(), bma.pImpl_->NBytes(), 1};
+      const auto &impl = exported->impl;
+      view->buf = const_cast<uint8_t *>(
+          impl.Length() > 0 ? &impl.Data()[impl.Offset() / 8] : &kEmpty);
+      Py_INCREF(self);
+      view->obj = self;
+      view->len = exported->shape;
+      view->readonly = 1;
+      view->itemsize = 1;
+      view->format = (flags & PyBUF_FORMAT) ? const_cast<char *>("B") : nullptr;
+      view->ndim = 1;
+      view->shape = &exported->shape;
+      view->strides = &exported->stride;
+      view->suboffsets = nullptr;
+      view->internal = exported;
+      return 0;
+    } catch (const std::bad_alloc &) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  static auto ReleaseBuffer(PyObject *, Py_buffer *view) noexcept -> void {
+    delete static_cast<BufferView *>(view->internal);
+  }
+
+  auto NdArray(nb::object, bool) const -> np_arr_type {
     // TODO: right now we just ignore args and kwargs, but maybe we shouldn't?
-    const auto nelems = pImpl_->Length();
-    bool *data = new bool[nelems];
-    ArrowBitsUnpackInt8(pImpl_->bitmap_->buffer.data, 0, nelems,
-                        reinterpret_cast<int8_t *>(data));
-    nb::capsule owner(data, [](void *p) noexcept { delete[] (bool *)p; });
+    auto result = EmptyNdArray<np_arr_type>(pImpl_->Length(), "bool");
+    auto *dst = reinterpret_cast<uint8_t *>(result.data());
+    const auto impl = pImpl_->Copy();
+    WithoutGil([&] { impl.UnpackInto(dst, 0, impl.Length()); });
+    return result;
+  }
 
-    size_t shape[1] = {static_cast<size_t>(nelems)};
-    return np_arr_type(data, 1, shape, owner);
+  /// Positions of the set elements, sized by a popcount pass so the indices
+  /// are written straight into the NumPy array
+  auto FlatNonZero() const -> np_int64_arr_type {
+    auto result = EmptyNdArray<np_int64_arr_type>(pImpl_->Sum(), "int64");
+    pImpl_->NonZero(result.data());
+    return result;
   }
 
   auto Shape() const noexcept { return nb::make_tuple(pImpl_->Length()); }
 
-  auto View(const std::string &dtype) const -> np_arr_type {
-    if (dtype == std::string("uint8")) {
-      const size_t nbits = pImpl_->bitmap_->size_bits;
-      bool *data = new bool[nbits];
-      ArrowBitsUnpackInt8(pImpl_->bitmap_->buffer.data, 0, nbits,
-                          reinterpret_cast<int8_t *>(data));
-      nb::capsule owner(data, [](void *p) noexcept { delete[] (bool *)p; });
+  /// reduce(data, mask) over a NumPy column whose missing rows are the set
+  /// elements of this mask, as None if the result is missing
+  template <typename F>
+  auto MaskedReduce(nb::handle values, F &&reduce) const -> nb::object {
+    return WithAnyNumbers(values, [&](const auto *data, int64_t length) {
+      if (length != pImpl_->Length()) {
+        throw nb::value_error("values must be the same length as the mask");
+      }
+      const auto impl = pImpl_->Copy();
+      const auto result = WithoutGil([&] { return reduce(data, impl); });
+      return result ? nb::cast(*result) : nb::object(nb::none());
+    });
+  }
+
+  /// Writes a NumPy column the length of this mask through a fill kernel
+  /// into out, or into a new array like values when out is None, which must
+  /// be values itself or not overlap it. make(data, out) casts any other
+  /// arguments while holding the GIL and returns the kernel to run without
+  /// it, as kernel(mask, out)
+  template <typename F>
+  auto FillColumn(nb::handle values, nb::handle out, F &&make) const
+      -> nb::object {
+    return WithAnyNumbers(values, [&](const auto *data, int64_t length) {
+      using T = std::remove_cv_t<std::remove_pointer_t<decltype(data)>>;
+      if (length != pImpl_->Length()) {
+        throw nb::value_error("values must be the same length as the mask");
+      }
+      nb::object result =
+          out.is_none()
+              ? nb::module_::import_("numpy").attr("empty_like")(values)
+              : nb::borrow(out);
+      T *dst = OutputArray<T>(result, length).data();
+      if (PartlyOverlaps<T>(data, dst, length)) {
+        throw nb::value_error("out must be values itself or not overlap it");
+      }
+      auto kernel = make(data, dst);
+      const auto impl = pImpl_->Copy();
+      WithoutGil([&] { kernel(impl, dst); });
+      return result;
+    });
+  }
+
+  /// numpy.where(mask, values, other), with other a column of the same dtype
+  /// and length or a scalar. A strided column is copied to a contiguous one
+  /// first, and out may be other itself but must not otherwise overlap it
+  auto Where(nb::handle values, nb::handle other, nb::handle out) const
+      -> nb::object {
+    return FillColumn(values, out, [&](const auto *data, const auto *target) {
+      using T = std::remove_cv_t<std::remove_pointer_t<decltype(data)>>;
+      nb::ndarray<nb::ro> array;
+      nb::object contiguous;
+      const T *column = nullptr;
+      T scalar{};
+      if (nb::try_cast(other, array, false) && array.ndim() > 0) {
+        if (array.ndim() != 1 || array.dtype() != nb::dtype<T>()) {
+          throw nb::type_error("other must be a scalar or a 1D array of the "
+                               "same dtype as values");
+        }
+        contiguous =
+            nb::module_::import_("numpy").attr("ascontiguousarray")(other);
+        const auto others = nb::cast<
+            nb::ndarray<nb::numpy, const T, nb::shape<-1>, nb::c_contig>>(
+            contiguous, false);
+        if (static_cast<int64_t>(others.shape(0)) != pImpl_->Length()) {
+          throw nb::value_error("other must be the same length as the mask");
+        }
+        column = others.data();
+        if (PartlyOverlaps<T>(column, target, pImpl_->Length())) {
+          throw nb::value_error("out must be other itself or not overlap it");
+        }
+      } else {
+        scalar = CastScalar<T>(other);
+      }
+      // holds any copy of other until the kernel has run
+      return [=, contiguous = std::move(contiguous)](
+                 const PandasMaskArrayImpl &mask, T *dst) {
+        if (column != nullptr) {
+          pandas_mask::fill::Where(mask, data, column, dst);
+        } else {
+          pandas_mask::fill::Where(mask, data, scalar, dst);
+        }
+      };
+    });
+  }
 
-      size_t shape[1] = {static_cast<size_t>(nbits)};
-      return np_arr_type(data, 1, shape, owner);
+  /// numpy.putmask(values, mask, fill), writing to values itself unless out
+  /// is given, e.g. to fill the missing rows of a column
+  auto PutMask(nb::handle values, nb::handle fill, nb::handle out) const
+      -> nb::object {
+    const nb::handle target = out.is_none() ? values : out;
+    return FillColumn(values, target, [&](const auto *data, const auto *) {
+      using T = std::remove_cv_t<std::remove_pointer_t<decltype(data)>>;
+      const auto value = CastScalar<T>(fill);
+      return [=](const PandasMaskArrayImpl &mask, T *dst) {
+        pandas_mask::fill::PutMask(mask, data, value, dst);
+      };
+    });
+  }
+
+  /// Arrow PyCapsule interface. The array references this mask's buffer;
+  /// requested_schema is ignored as a mask has only one representation
+  auto ArrowCArray(nb::object) const -> nb::tuple {
+    auto schema = std::make_unique<ArrowSchema>();
+    PandasMaskArrayImpl::ExportArrowSchema(schema.get());
+    auto array = std::make_unique<ArrowArray>();
+    pImpl_->ExportArrow(array.get());
+
+    // consumers move the structs out and leave release null; anything not
+    // consumed is released with its capsule
+    nb::capsule schema_capsule(schema.release(), "arrow_schema",
+                               [](void *ptr) noexcept {
+                                 auto *schema = static_cast<ArrowSchema *>(ptr);
+                                 if (schema->release != nullptr) {
+                                   schema->release(schema);
+                                 }
+                                 delete schema;
+                               });
+    nb::capsule array_capsule(array.release(), "arrow_array",
+                              [](void *ptr) noexcept {
+                                auto *array = static_cast<ArrowArray *>(ptr);
+                                if (array->release != nullptr) {
+                                  array->release(array);
+                                }
+                                delete array;
+                              });
+    return nb::make_tuple(schema_capsule, array_capsule);
+  }
+
+  /// Opens a mask written by to_file without reading it. mode "r" maps the
+  /// file read-only and copies it the first time the mask is written; "c"
+  /// maps it copy-on-write, so writes go to private pages and never reach
+  /// the file, as with numpy.memmap
+  static auto FromFile(const std::filesystem::path &path,
+                       const std::string &mode) -> PandasMaskArray {
+    if (mode != "r" && mode != "c") {
+      throw nb::value_error("mode must be 'r' or 'c'");
+    }
+    return PandasMaskArray(WithOSError(path, [&] {
+      return WithoutGil(
+          [&] { return PandasMaskArrayImpl::FromFile(path, mode == "c"); });
+    }));
+  }
+
+  /// Factories packing a test of each value of a NumPy column straight into
+  /// bits, compressed when that is much smaller as the constructor does
+  template <typename F> static auto FromColumn(nb::handle values, F &&make) {
+    return WithAnyNumbers(values, [&](const auto *data, int64_t length) {
+      using T = std::remove_cv_t<std::remove_pointer_t<decltype(data)>>;
+      auto test = make(T{});
+      return nb::cast(PandasMaskArray(WithoutGil(
+          [&] { return test(data, length).CompressIfSmaller(); })));
+    });
+  }
+
+  static auto IsNan(nb::handle values) -> nb::object {
+    return FromColumn(values, [](auto) {
+      return [](const auto *data, int64_t length) {
+        return pandas_mask::compare::IsNan(data, length);
+      };
+    });
+  }
+
+  static auto FromCompare(nb::handle values, const std::string &op,
+                          nb::handle scalar) -> nb::object {
+    const auto comparison = ParseComparison(op);
+    const auto value = ComparisonScalar(scalar);
+    return FromColumn(values, [&](auto) {
+      return [=](const auto *data, int64_t length) {
+        return pandas_mask::compare::Compare(data, length, comparison, value);
+      };
+    });
+  }
+
+  static auto IsInRange(nb::handle values, nb::handle lo, nb::handle hi)
+      -> nb::object {
+    const auto low = ComparisonScalar(lo);
+    const auto high = ComparisonScalar(hi);
+    return FromColumn(values, [&](auto) {
+      return [=](const auto *data, int64_t length) {
+        return pandas_mask::compare::InRange(data, length, low, high);
+      };
+    });
+  }
+
+  auto ToFile(const std::filesystem::path &path) const -> void {
+    const auto impl = pImpl_->Copy();
+    WithOSError(path, [&] { WithoutGil([&] { impl.ToFile(path); }); });
+  }
+
+  /// Adopts the values of a boolean Arrow array, or the validity bitmap of
+  /// any Arrow array, from an object implementing __arrow_c_array__. The
+  /// validity bitmap is adopted as it is, set where a value is present, so
+  /// it is the inverse of a pandas mask, which the masked reductions and
+  /// putmask expect set where a value is missing; ~ turns one into the other
+  static auto FromArrow(nb::object obj, bool validity) -> PandasMaskArray {
+    if (!nb::hasattr(obj, "__arrow_c_array__")) {
+      throw nb::type_error("expected an object implementing __arrow_c_array__");
+    }
+    const auto capsules = nb::cast<nb::tuple>(obj.attr("__arrow_c_array__")());
+    auto *schema = static_cast<ArrowSchema *>(
+        PyCapsule_GetPointer(capsules[0].ptr(), "arrow_schema"));
+    auto *array = static_cast<ArrowArray *>(
+        PyCapsule_GetPointer(capsules[1].ptr(), "arrow_array"));
+    if (schema == nullptr || array == nullptr) {
+      throw nb::python_error();
+    }
+
+    const std::string format = schema->format;
+    if (!validity) {
+      if (format != "b") {
+        throw nb::type_error("expected an Arrow boolean array; pass "
+                             "validity=True to adopt its null mask instead");
+      }
+      if (PandasMaskArrayImpl::ArrowNullCount(*array) != 0) {
+        throw nb::value_error("boolean array with nulls cannot be a mask");
+      }
+    } else if (format == "n" || format.starts_with("+u") ||
+               format.starts_with("+r")) {
+      throw nb::type_error("Arrow array has no validity bitmap");
+    }
+
+    return PandasMaskArray(
+        PandasMaskArrayImpl::ImportArrow(array, validity ? 0 : 1));
+  }
+
+  auto View(const std::string &dtype) const -> np_uint8_arr_type {
+    if (dtype == std::string("uint8")) {
+      auto result = EmptyNdArray<np_uint8_arr_type>(pImpl_->Length(), "uint8");
+      pImpl_->UnpackInto(result.data(), 0, pImpl_->Length());
+      return result;
     }
 
     std::stringstream ss{};
@@ -301,9 +887,158 @@ public:
   }
 };
 
+/// Expression over masks built by PandasMaskArray.lazy(). Operators only
+/// record the operation; the expression is computed in a single pass when it
+/// is evaluated or reduced
+class PandasMaskExpr {
+public:
+  PandasMaskExprImpl impl_;
+
+  explicit PandasMaskExpr(PandasMaskExprImpl &&impl) : impl_(std::move(impl)) {}
+
+  /// Other operands may be expressions, masks or NumPy bool arrays
+  static auto AsExprImpl(nb::handle other) -> PandasMaskExprImpl {
+    if (nb::isinstance<PandasMaskExpr>(other)) {
+      return nb::inst_ptr<PandasMaskExpr>(other)->impl_;
+    }
+
+    return PandasMaskArray::WithOther(
+        other, [](const PandasMaskArrayImpl &other_impl) {
+          return PandasMaskExprImpl(other_impl);
+        });
+  }
+
+  template <typename OP> auto BinOp(nb::object other) const {
+    return PandasMaskExpr(impl_.BinaryOp(AsExprImpl(other), OP()));
+  }
+
+  template <typename OP> auto RBinOp(nb::object other) const {
+    return PandasMaskExpr(AsExprImpl(other).BinaryOp(impl_, OP()));
+  }
+
+  auto NdArray(nb::object dtype, bool copy) const -> np_arr_type {
+    return PandasMaskArray(impl_.Evaluate()).NdArray(dtype, copy);
+  }
+};
+
+/// Mask operators with a lazy operand build an expression rather than
+/// evaluating it
+template <typename OP>
+auto MaskBinOp(const PandasMaskArray &bma, nb::object other) -> nb::object {
+  if (nb::isinstance<PandasMaskExpr>(other)) {
+    const auto &other_impl = nb::inst_ptr<PandasMaskExpr>(other)->impl_;
+    return nb::cast(PandasMaskExpr(
+        PandasMaskExprImpl(*bma.pImpl_).BinaryOp(other_impl, OP())));
+  }
+
+  return nb::cast(bma.BinOp<OP>(other));
+}
+
+/// A nullable boolean column, as pandas' BooleanArray, with Kleene logic
+class KleeneBoolean {
+public:
+  KleeneBooleanImpl impl_;
+
+  explicit KleeneBoolean(KleeneBooleanImpl &&impl) : impl_(std::move(impl)) {}
+
+  /// values and validity may each be a mask or a NumPy bool array; validity
+  /// is set where the value is known
+  KleeneBoolean(nb::handle values, nb::handle validity)
+      : impl_(PandasMaskArray::WithOther(
+            values, [&](const PandasMaskArrayImpl &values_impl) {
+              return PandasMaskArray::WithOther(
+                  validity, [&](const PandasMaskArrayImpl &validity_impl) {
+                    return KleeneBooleanImpl(values_impl, validity_impl);
+                  });
+            })) {}
+
+  template <auto OP> auto BinOp(const KleeneBoolean &other) const {
+    const auto lhs = impl_;
+    const auto rhs = other.impl_;
+    return KleeneBoolean(WithoutGil([&] { return (lhs.*OP)(rhs); }));
+  }
+};
+
+/// Version of the state written by PandasMaskArray.__reduce_ex__
+constexpr int kPickleVersion = 1;
+
+/// Rebuilds a pickled mask from its packed bytes, which may arrive as bytes
+/// or as an out-of-band pickle protocol 5 buffer
+auto Unpickle(int version, int64_t length, nb::handle data) -> PandasMaskArray {
+  if (version != kPickleVersion) {
+    throw nb::value_error("unsupported PandasMaskArray pickle version");
+  }
+
+  Py_buffer view;
+  if (PyObject_GetBuffer(data.ptr(), &view, PyBUF_SIMPLE) != 0) {
+    throw nb::python_error();
+  }
+  std::unique_ptr<Py_buffer, decltype(&PyBuffer_Release)> release(
+      &view, &PyBuffer_Release);
+  if (length < 0 || view.len != _ArrowBytesForBits(length)) {
+    throw nb::value_error("pickled PandasMaskArray has the wrong size");
+  }
+
+  const auto *bytes = static_cast<const uint8_t *>(view.buf);
+  return PandasMaskArray(WithoutGil(
+      [&] { return PandasMaskArrayImpl::FromPacked(bytes, length); }));
+}
+
+/// pandas_mask.concatenate: joins masks or NumPy bool arrays into one mask,
+/// copying each input once. Masks are read in place; only arrays are packed
+auto Concatenate(nb::sequence inputs) -> PandasMaskArray {
+  const size_t n = nb::len(inputs);
+  std::vector<const PandasMaskArrayImpl *> masks;
+  masks.reserve(n);
+  // reserved up front so the pointers into it stay valid
+  std::vector<PandasMaskArrayImpl> packed;
+  packed.reserve(n);
+
+  for (const auto input : inputs) {
+    if (nb::isinstance<PandasMaskArray>(input)) {
+      masks.push_back(nb::inst_ptr<PandasMaskArray>(input)->pImpl_.get());
+      continue;
+    }
+
+    np_arr_type bools;
+    if (!nb::try_cast(input, bools, false)) {
+      throw nb::type_error(
+          "concatenate requires a sequence of masks or bool arrays");
+    }
+    packed.push_back(PandasMaskArrayImpl::Pack(
+        reinterpret_cast<const uint8_t *>(bools.data()), bools.shape(0)));
+    masks.push_back(&packed.back());
+  }
+
+  return PandasMaskArray(PandasMaskArrayImpl::Concatenate(masks));
+}
+
 NB_MODULE(pandas_mask, m) {
-  nb::class_<PandasMaskArray>(m, "PandasMaskArray")
-      .def(nb::init<np_arr_type>())
+  // kernels are chosen via CPUID once, as the module is imported
+  m.attr("simd_isa") = pandas_mask::kernels::IsaName(
+      pandas_mask::kernels::ActiveKernels().isa);
+
+  m.def("concatenate", &Concatenate, "masks"_a);
+
+  // operations on masks of at least the threshold, in bytes, are split
+  // across a thread pool
+  m.def("get_num_threads", &pandas_mask::parallel::NumThreads);
+  m.def("set_num_threads", &pandas_mask::parallel::SetNumThreads, "n"_a);
+  m.def("get_parallel_threshold", &pandas_mask::parallel::Threshold);
+  m.def("set_parallel_threshold", &pandas_mask::parallel::SetThreshold,
+        "nbytes"_a);
+
+  m.def("_unpickle", &Unpickle);
+
+  static PyType_Slot slots[] = {
+      {Py_bf_getbuffer, reinterpret_cast<void *>(&PandasMaskArray::GetBuffer)},
+      {Py_bf_releasebuffer,
+       reinterpret_cast<void *>(&PandasMaskArray::ReleaseBuffer)},
+      {0, nullptr}};
+
+  nb::class_<PandasMaskArray>(m, "PandasMaskArray", nb::type_slots(slots))
+      .def(nb::init<np_arr_type, std::optional<bool>>(), "values"_a,
+           "compress"_a = nb::none())
       .def(nb::init<PandasMaskArray>())
       .def("__len__",
            [](const PandasMaskArray &bma) noexcept {
@@ -312,35 +1047,94 @@ NB_MODULE(pandas_mask, m) {
       .def("__setitem__", &PandasMaskArray::SetItem)
       .def("__getitem__", &PandasMaskArray::GetItem)
       .def("__invert__",
-           [](const PandasMaskArray &bma) noexcept {
-             return PandasMaskArray(bma.pImpl_->Invert());
+           [](const PandasMaskArray &bma) { return bma.Invert(nb::none()); })
+      .def("__and__", &MaskBinOp<std::bit_and<>>)
+      .def("__or__", &MaskBinOp<std::bit_or<>>)
+      .def("__xor__", &MaskBinOp<std::bit_xor<>>)
+      // in-place operators write into this mask's buffer rather than
+      // allocating a new one, unless the buffer is shared with a copy
+      .def("__iand__",
+           [](PandasMaskArray &bma, nb::object other) {
+             bma.InPlaceBinOp<std::bit_and<>>(other);
+             return nb::find(bma);
            })
-      .def("__and__", &PandasMaskArray::BinOp<std::bit_and<>>)
-      .def("__or__", &PandasMaskArray::BinOp<std::bit_or<>>)
-      .def("__xor__", &PandasMaskArray::BinOp<std::bit_xor<>>)
-      .def("__getstate__",
-           [](const PandasMaskArray &bma) {
-             return bma.NdArray(nb::none(), false);
+      .def("__ior__",
+           [](PandasMaskArray &bma, nb::object other) {
+             bma.InPlaceBinOp<std::bit_or<>>(other);
+             return nb::find(bma);
+           })
+      .def("__ixor__",
+           [](PandasMaskArray &bma, nb::object other) {
+             bma.InPlaceBinOp<std::bit_xor<>>(other);
+             return nb::find(bma);
            })
+      .def("bitwise_and", &PandasMaskArray::BinOpOut<std::bit_and<>>,
+           "other"_a, "out"_a = nb::none())
+      .def("bitwise_or", &PandasMaskArray::BinOpOut<std::bit_or<>>, "other"_a,
+           "out"_a = nb::none())
+      .def("bitwise_xor", &PandasMaskArray::BinOpOut<std::bit_xor<>>,
+           "other"_a, "out"_a = nb::none())
+      .def("invert", &PandasMaskArray::Invert, "out"_a = nb::none())
+      // the packed bytes are pickled, out of band from protocol 5, rather
+      // than a bool array eight times the size
+      .def("__reduce_ex__",
+           [](nb::handle self, int protocol) {
+             const auto &bma = nb::cast<const PandasMaskArray &>(self);
+             const auto data =
+                 protocol >= 5
+                     ? nb::module_::import_("pickle").attr("PickleBuffer")(self)
+                     : nb::object(bma.Bytes());
+             return nb::make_tuple(
+                 nb::module_::import_("pandas_mask").attr("_unpickle"),
+                 nb::make_tuple(kPickleVersion, bma.pImpl_->Length(), data));
+           })
+      // state written by versions that pickled a bool ndarray
       .def("__setstate__",
            [](PandasMaskArray &bma, const np_arr_type &state) {
              new (&bma) PandasMaskArray(state);
            })
-      .def("__iter__",
-           [](const PandasMaskArray &bma) {
-             return nb::make_iterator(nb::type<PandasMaskArray>(),
-                                      "value_iterator", bma.pImpl_->begin(),
-                                      bma.pImpl_->end());
-           })
-      //.def("concatenate",
+      .def(
+          "__iter__",
+          [](const PandasMaskArray &bma) {
+            // the iterators hold their own copy of the mask, so need not
+            // keep bma alive
+            return nb::make_iterator(nb::type<PandasMaskArray>(),
+                                     "value_iterator", bma.pImpl_->begin(),
+                                     bma.pImpl_->end());
+          })
+      // positions of the set elements only
+      .def(
+          "iter_set",
+          [](const PandasMaskArray &bma) {
+            const auto set_bits = bma.pImpl_->SetBits();
+            return nb::make_iterator(nb::type<PandasMaskArray>(),
+                                     "set_bit_iterator", set_bits.begin(),
+                                     set_bits.end());
+          })
       .def_prop_ro("size",
                    [](const PandasMaskArray &bma) noexcept {
                      return bma.pImpl_->Size();
                    })
       .def_prop_ro("nbytes",
                    [](const PandasMaskArray &bma) noexcept {
-                     return bma.pImpl_->NBytes();
+                     return bma.pImpl_->StorageBytes();
+                   })
+      .def_prop_ro("is_compressed",
+                   [](const PandasMaskArray &bma) noexcept {
+                     return bma.pImpl_->IsCompressed();
                    })
+      .def("compress",
+           [](const PandasMaskArray &bma) {
+             const auto impl = bma.pImpl_->Copy();
+             return PandasMaskArray(
+                 WithoutGil([&] { return impl.Compress(); }));
+           })
+      .def("decompress",
+           [](const PandasMaskArray &bma) {
+             const auto impl = bma.pImpl_->Copy();
+             return PandasMaskArray(
+                 WithoutGil([&] { return impl.Decompress(); }));
+           })
       .def_prop_ro("bytes", &PandasMaskArray::Bytes)
       .def_prop_ro("shape", &PandasMaskArray::Shape)
       .def_prop_ro("dtype",
@@ -350,19 +1144,221 @@ NB_MODULE(pandas_mask, m) {
       .def(
           "all",
           [](const PandasMaskArray &bma) noexcept { return bma.pImpl_->All(); })
+      // counted on a copy without the GIL, then cached on this mask unless
+      // it was written to meanwhile
+      .def("sum",
+           [](PandasMaskArray &bma) {
+             const auto impl = bma.pImpl_->Copy();
+             const auto count = WithoutGil([&] { return impl.Sum(); });
+             bma.pImpl_->ShareCaches(impl);
+             return count;
+           })
+      .def("build_rank_index",
+           [](PandasMaskArray &bma) {
+             auto impl = bma.pImpl_->Copy();
+             WithoutGil([&] { impl.BuildRankIndex(); });
+             bma.pImpl_->ShareCaches(impl);
+           })
+      .def("rank",
+           [](const PandasMaskArray &bma, int64_t i) {
+             return bma.pImpl_->Rank(i);
+           })
+      .def("select",
+           [](const PandasMaskArray &bma, int64_t k) {
+             return bma.pImpl_->Select(k);
+           })
+      // reductions of a column whose missing rows are set in this mask
+      .def(
+          "masked_sum",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Sum(data, mask, skipna);
+            });
+          },
+          "values"_a, "skipna"_a = true)
+      .def(
+          "masked_prod",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Prod(data, mask, skipna);
+            });
+          },
+          "values"_a, "skipna"_a = true)
+      .def(
+          "masked_min",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Min(data, mask, skipna);
+            });
+          },
+          "values"_a, "skipna"_a = true)
+      .def(
+          "masked_max",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Max(data, mask, skipna);
+            });
+          },
+          "values"_a, "skipna"_a = true)
       .def(
-          "sum",
-          [](const PandasMaskArray &bma) noexcept { return bma.pImpl_->Sum(); })
-      //.def("take_1d", &PandasMaskArray::Take1D)
+          "masked_mean",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Mean(data, mask, skipna);
+            });
+          },
+          "values"_a, "skipna"_a = true)
+      .def(
+          "masked_var",
+          [](const PandasMaskArray &bma, nb::handle values, bool skipna,
+             int64_t ddof) {
+            return bma.MaskedReduce(values, [&](const auto *data,
+                                                const auto &mask) {
+              return pandas_mask::reduce::Var(data, mask, skipna, ddof);
+            });
+          },
+          "values"_a, "skipna"_a = true, "ddof"_a = 1)
+      // numpy.where and numpy.putmask with this mask as the condition
+      .def("where", &PandasMaskArray::Where, "values"_a, "other"_a,
+           "out"_a = nb::none())
+      .def("putmask", &PandasMaskArray::PutMask, "values"_a, "fill"_a,
+           "out"_a = nb::none())
+      .def("count_and", &PandasMaskArray::CountOp<std::bit_and<>>, "other"_a)
+      .def("count_and_not", &PandasMaskArray::CountOp<BitAndNot>, "other"_a)
+      .def("count_or", &PandasMaskArray::CountOp<std::bit_or<>>, "other"_a)
+      .def("count_xor", &PandasMaskArray::CountOp<std::bit_xor<>>, "other"_a)
+      .def("any_and", &PandasMaskArray::AnyOp<std::bit_and<>>, "other"_a)
+      .def("any_and_not", &PandasMaskArray::AnyOp<BitAndNot>, "other"_a)
+      .def("any_xor", &PandasMaskArray::AnyOp<std::bit_xor<>>, "other"_a)
+      .def("all_or", &PandasMaskArray::AllOp<std::bit_or<>>, "other"_a)
+      .def("all_xor", &PandasMaskArray::AllOp<std::bit_xor<>>, "other"_a)
+      .def("take", &PandasMaskArray::Take1D, "indices"_a,
+           "allow_fill"_a = false, "fill_value"_a = nb::none())
+      .def("take_1d", &PandasMaskArray::Take1D, "indices"_a,
+           "allow_fill"_a = false, "fill_value"_a = nb::none())
       .def("copy",
-           [](const PandasMaskArray &bma) noexcept {
+           [](const PandasMaskArray &bma) {
              return PandasMaskArray(bma.pImpl_->Copy());
            })
+      .def("__arrow_c_array__", &PandasMaskArray::ArrowCArray,
+           "requested_schema"_a = nb::none())
+      // with validity, set marks a present value, as in Arrow
+      .def_static("from_arrow", &PandasMaskArray::FromArrow, "array"_a,
+                  "validity"_a = false)
+      .def_static("from_file", &PandasMaskArray::FromFile, "path"_a,
+                  "mode"_a = "r")
+      .def("to_file", &PandasMaskArray::ToFile, "path"_a)
+      .def_static("isnan", &PandasMaskArray::IsNan, "values"_a)
+      .def_static("from_compare", &PandasMaskArray::FromCompare, "values"_a,
+                  "op"_a, "scalar"_a)
+      // lo <= values <= hi, as pandas' Series.between
+      .def_static("isin_range", &PandasMaskArray::IsInRange, "values"_a,
+                  "lo"_a, "hi"_a)
+      .def("shares_memory",
+           [](const PandasMaskArray &bma, const PandasMaskArray &other) {
+             return bma.pImpl_->SharesBuffer(*other.pImpl_);
+           })
       .def("__array__", &PandasMaskArray::NdArray, "dtype"_a = nb::none(),
            "copy"_a = false)
       .def("view", &PandasMaskArray::View, nb::arg("dtype"))
       .def("argmin",
            [](const PandasMaskArray &bma) { return bma.pImpl_->ArgMin(); })
       .def("argmax",
-           [](const PandasMaskArray &bma) { return bma.pImpl_->ArgMax(); });
+           [](const PandasMaskArray &bma) { return bma.pImpl_->ArgMax(); })
+      .def("nonzero",
+           [](const PandasMaskArray &bma) {
+             return nb::make_tuple(bma.FlatNonZero());
+           })
+      .def("flatnonzero", &PandasMaskArray::FlatNonZero)
+      // -1 when nothing matches, like str.find
+      .def(
+          "find_first",
+          [](const PandasMaskArray &bma, bool value, int64_t start) {
+            return bma.pImpl_->FindFirst(value, start);
+          },
+          "value"_a = true, "start"_a = 0)
+      .def(
+          "find_last",
+          [](const PandasMaskArray &bma, bool value,
+             std::optional<int64_t> end) {
+            return end ? bma.pImpl_->FindLast(value, *end)
+                       : bma.pImpl_->FindLast(value);
+          },
+          "value"_a = true, "end"_a = nb::none())
+      .def("lazy", [](const PandasMaskArray &bma) {
+        return PandasMaskExpr(PandasMaskExprImpl(*bma.pImpl_));
+      });
+
+  nb::class_<PandasMaskExpr>(m, "PandasMaskExpr")
+      .def("__len__",
+           [](const PandasMaskExpr &expr) noexcept {
+             return expr.impl_.Length();
+           })
+      .def("__invert__",
+           [](const PandasMaskExpr &expr) {
+             return PandasMaskExpr(expr.impl_.Invert());
+           })
+      .def("__and__", &PandasMaskExpr::BinOp<std::bit_and<>>)
+      .def("__or__", &PandasMaskExpr::BinOp<std::bit_or<>>)
+      .def("__xor__", &PandasMaskExpr::BinOp<std::bit_xor<>>)
+      .def("__rand__", &PandasMaskExpr::RBinOp<std::bit_and<>>)
+      .def("__ror__", &PandasMaskExpr::RBinOp<std::bit_or<>>)
+      .def("__rxor__", &PandasMaskExpr::RBinOp<std::bit_xor<>>)
+      .def_prop_ro("shape",
+                   [](const PandasMaskExpr &expr) {
+                     return nb::make_tuple(expr.impl_.Length());
+                   })
+      .def("evaluate",
+           [](const PandasMaskExpr &expr) {
+             return PandasMaskArray(expr.impl_.Evaluate());
+           })
+      .def("any", [](const PandasMaskExpr &expr) { return expr.impl_.Any(); })
+      .def("all", [](const PandasMaskExpr &expr) { return expr.impl_.All(); })
+      .def("sum", [](const PandasMaskExpr &expr) { return expr.impl_.Sum(); })
+      .def("__array__", &PandasMaskExpr::NdArray, "dtype"_a = nb::none(),
+           "copy"_a = false);
+
+  nb::class_<KleeneBoolean>(m, "KleeneBoolean")
+      .def(nb::init<nb::handle, nb::handle>(), "values"_a, "validity"_a)
+      .def("__len__",
+           [](const KleeneBoolean &kb) noexcept { return kb.impl_.Length(); })
+      // True, False or None for a missing element
+      .def("__getitem__",
+           [](const KleeneBoolean &kb, ssize_t index) {
+             return kb.impl_.GetItem(index);
+           })
+      .def("__invert__",
+           [](const KleeneBoolean &kb) {
+             const auto impl = kb.impl_;
+             return KleeneBoolean(WithoutGil([&] { return impl.Invert(); }));
+           })
+      .def("__and__", &KleeneBoolean::BinOp<&KleeneBooleanImpl::And>)
+      .def("__or__", &KleeneBoolean::BinOp<&KleeneBooleanImpl::Or>)
+      .def("__xor__", &KleeneBoolean::BinOp<&KleeneBooleanImpl::Xor>)
+      .def_prop_ro("values",
+                   [](const KleeneBoolean &kb) {
+                     return PandasMaskArray(kb.impl_.Values().Copy());
+                   })
+      .def_prop_ro("validity",
+                   [](const KleeneBoolean &kb) {
+                     return PandasMaskArray(kb.impl_.Validity().Copy());
+                   })
+      // None when the result is missing, as with pandas' skipna=False
+      .def(
+          "any",
+          [](const KleeneBoolean &kb, bool skipna) {
+            return kb.impl_.Any(skipna);
+          },
+          "skipna"_a = true)
+      .def(
+          "all",
+          [](const KleeneBoolean &kb, bool skipna) {
+            return kb.impl_.All(skipna);
+          },
+          "skipna"_a = true);
 }
@@ -0,0 +1,224 @@
+/// Throughput benchmarks for the bitmap kernels, reported in GB/s of bytes
+/// written. Run with `meson test --benchmark -C builddir -v`
+#include "pandas_mask_compare.h"
+#include "pandas_mask_expr.h"
+#include "pandas_mask_fill.h"
+#include "pandas_mask_kleene.h"
+#include "pandas_mask_impl.h"
+#include "pandas_mask_parallel.h"
+#include "pandas_mask_reduce.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr int64_t kNumBits = 64 * 1024 * 1024;
+constexpr int kRepeats = 20;
+
+template <typename F> auto Measure(const char *name, int64_t nbytes, F &&func) {
+  func(); // warm up caches and page in the output
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRepeats; i++) {
+    func();
+  }
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const double gbps =
+      static_cast<double>(nbytes) * kRepeats / elapsed.count() / 1e9;
+  std::printf("%-40s %8.2f GB/s\n", name, gbps);
+}
+
+auto RandomMask(int64_t nbits, unsigned seed = 42, double density = 0.5)
+    -> PandasMaskArrayImpl {
+  std::mt19937 rng(seed);
+  std::bernoulli_distribution dist(density);
+  std::vector<uint8_t> values(nbits);
+  for (auto &value : values) {
+    value = dist(rng);
+  }
+  return PandasMaskArrayImpl::Pack(values.data(), nbits);
+}
+
+} // namespace
+
+auto main() -> int {
+  std::printf("kernels: %s\n", pandas_mask::kernels::IsaName(
+                                   pandas_mask::kernels::ActiveKernels().isa));
+
+  const auto bma = RandomMask(kNumBits);
+  std::vector<uint8_t> out(kNumBits);
+
+  Measure("unpack ArrowBitsUnpackInt8", kNumBits, [&] {
+    ArrowBitsUnpackInt8(bma.Data(), 0, kNumBits,
+                        reinterpret_cast<int8_t *>(out.data()));
+  });
+  Measure("unpack UnpackInto", kNumBits,
+          [&] { bma.UnpackInto(out.data(), 0, kNumBits); });
+  Measure("unpack UnpackInto (offset 3)", kNumBits - 3,
+          [&] { bma.UnpackInto(out.data(), 3, kNumBits - 3); });
+
+  // (a & b) | ~c, reported against the bytes of the three inputs
+  const auto other = RandomMask(kNumBits, 43);
+  const auto third = RandomMask(kNumBits, 44);
+  const int64_t expr_bytes = 3 * kNumBits / 8;
+  Measure("expr eager BinaryOp", expr_bytes, [&] {
+    bma.BinaryOp(other, std::bit_and<>())
+        .BinaryOp(third.Invert(), std::bit_or<>());
+  });
+  const auto expr = PandasMaskExprImpl(bma)
+                        .BinaryOp(PandasMaskExprImpl(other), std::bit_and<>())
+                        .BinaryOp(PandasMaskExprImpl(third).Invert(),
+                                  std::bit_or<>());
+  Measure("expr lazy Evaluate", expr_bytes, [&] { expr.Evaluate(); });
+  Measure("expr eager Sum", expr_bytes, [&] {
+    bma.BinaryOp(other, std::bit_and<>())
+        .BinaryOp(third.Invert(), std::bit_or<>())
+        .Sum();
+  });
+  Measure("expr lazy Sum", expr_bytes, [&] { expr.Sum(); });
+
+
+  // reported against the bytes of indices written
+  for (const double density : {0.001, 0.1, 0.9}) {
+    const auto mask = RandomMask(kNumBits, 45, density);
+    std::vector<int64_t> indices(mask.Sum());
+    char name[64];
+    std::snprintf(name, sizeof(name), "nonzero NonZero (density %.3f)",
+                  density);
+    Measure(name, indices.size() * sizeof(int64_t),
+            [&] { mask.NonZero(indices.data()); });
+  }
+
+  // reported against the bytes of the values being filtered
+  for (const double density : {0.01, 0.5, 0.99}) {
+    const auto selector = RandomMask(kNumBits, 46, density);
+    char name[64];
+    std::snprintf(name, sizeof(name), "filter Filter (density %.2f)", density);
+    Measure(name, kNumBits / 8, [&] { bma.Filter(selector); });
+  }
+
+  // assignment into a mask, reported against the bytes written
+  auto target = bma.Copy();
+  Measure("setitem SetSlice (offset 3)", (kNumBits - 8) / 8,
+          [&] { target.SetSlice(3, other.Slice(0, kNumBits - 8)); });
+  Measure("setitem SetStrided (step 1)", kNumBits / 8,
+          [&] { target.SetStrided(0, 1, kNumBits, true); });
+  Measure("setitem Blend", kNumBits / 8,
+          [&] { target.Blend(third, other); });
+
+  // the pool against a single thread
+  const int nthreads = pandas_mask::parallel::NumThreads();
+  for (const int n : {1, nthreads}) {
+    pandas_mask::parallel::SetNumThreads(n);
+    char name[64];
+    std::snprintf(name, sizeof(name), "parallel BinaryOp (%d threads)", n);
+    Measure(name, kNumBits / 8,
+            [&] { bma.BinaryOp(other, std::bit_and<>()); });
+    std::snprintf(name, sizeof(name), "parallel UnpackInto (%d threads)", n);
+    Measure(name, kNumBits,
+            [&] { bma.UnpackInto(out.data(), 0, kNumBits); });
+  }
+
+  // many small chunks, as pd.concat produces; half start mid-byte
+  std::vector<PandasMaskArrayImpl> chunks;
+  std::vector<const PandasMaskArrayImpl *> chunk_ptrs;
+  for (int64_t start = 0; start + 4100 <= kNumBits; start += 4100) {
+    chunks.push_back(bma.Slice(start, 4100));
+  }
+  for (const auto &chunk : chunks) {
+    chunk_ptrs.push_back(&chunk);
+  }
+  Measure("concatenate Concatenate (4100 bits)", kNumBits / 8,
+          [&] { PandasMaskArrayImpl::Concatenate(chunk_ptrs); });
+
+  auto indexed = bma.Copy();
+  Measure("rank BuildRankIndex", kNumBits / 8,
+          [&] { indexed.BuildRankIndex(); });
+
+  // a float64 column with missing rows, reported against the bytes of values
+  const int64_t nvalues = kNumBits / 8;
+  const std::vector<double> column(nvalues, 1.5);
+  for (const double density : {0.0, 0.1}) {
+    const auto missing = RandomMask(nvalues, 49, density);
+    char name[64];
+    std::snprintf(name, sizeof(name), "reduce Sum float64 (%.0f%% missing)",
+                  density * 100);
+    Measure(name, nvalues * sizeof(double), [&] {
+      pandas_mask::reduce::Sum(column.data(), missing, true);
+    });
+  }
+
+  // straight to bits, against comparing into bytes and packing those
+  Measure("compare Compare float64", nvalues * sizeof(double), [&] {
+    pandas_mask::compare::Compare(column.data(), nvalues,
+                                  pandas_mask::compare::Comparison::Greater,
+                                  1.0);
+  });
+  std::vector<uint8_t> bools(nvalues);
+  Measure("compare bytes then Pack", nvalues * sizeof(double), [&] {
+    for (int64_t i = 0; i < nvalues; i++) {
+      bools[i] = column[i] > 1.0;
+    }
+    PandasMaskArrayImpl::Pack(bools.data(), nvalues);
+  });
+
+  // filling missing rows, against the unpacked mask NumPy would need
+  std::vector<double> filled(nvalues);
+  for (const double density : {0.001, 0.5}) {
+    const auto missing = RandomMask(nvalues, 50, density);
+    char name[64];
+    std::snprintf(name, sizeof(name),
+                  "fill PutMask float64 (%.1f%% missing)", density * 100);
+    Measure(name, nvalues * sizeof(double), [&] {
+      pandas_mask::fill::PutMask(missing, column.data(), 0.0, filled.data());
+    });
+    std::snprintf(name, sizeof(name),
+                  "fill unpack then select (%.1f%% missing)", density * 100);
+    Measure(name, nvalues * sizeof(double), [&] {
+      missing.UnpackInto(bools.data(), 0, nvalues);
+      for (int64_t i = 0; i < nvalues; i++) {
+        filled[i] = bools[i] != 0 ? 0.0 : column[i];
+      }
+    });
+  }
+
+  // one pass, against the five masks of emulating Kleene & with plain ones
+  const KleeneBooleanImpl lhs(bma, RandomMask(kNumBits, 51, 0.9));
+  const KleeneBooleanImpl rhs(other, RandomMask(kNumBits, 52, 0.9));
+  Measure("kleene And", kNumBits / 8, [&] { lhs.And(rhs); });
+  Measure("kleene And from BinaryOp", kNumBits / 8, [&] {
+    const auto &a = lhs.Values();
+    const auto &b = rhs.Values();
+    const auto a_false = lhs.Validity().BinaryOp(a, BitAndNot());
+    const auto b_false = rhs.Validity().BinaryOp(b, BitAndNot());
+    const auto known = lhs.Validity()
+                           .BinaryOp(rhs.Validity(), std::bit_and<>())
+                           .BinaryOp(a_false, std::bit_or<>())
+                           .BinaryOp(b_false, std::bit_or<>());
+    a.BinaryOp(b, std::bit_and<>()).BinaryOp(known, std::bit_and<>());
+  });
+
+  // almost all false, as the null mask of a clean column; reported against
+  // the bytes of the bitmap either way
+  const auto sparse = RandomMask(kNumBits, 47, 0.0001);
+  const auto sparse_other = RandomMask(kNumBits, 48, 0.0001);
+  const auto compressed = sparse.Compress();
+  const auto compressed_other = sparse_other.Compress();
+  Measure("compressed Compress", kNumBits / 8, [&] { sparse.Compress(); });
+  // Sum() is cached, so each iteration counts a fresh copy of a mask that
+  // is never summed itself
+  Measure("compressed Sum (bitmap)", kNumBits / 8,
+          [&] { sparse.Copy().Sum(); });
+  Measure("compressed Sum (runs)", kNumBits / 8,
+          [&] { compressed.Copy().Sum(); });
+  Measure("compressed BinaryOp (bitmap)", kNumBits / 8,
+          [&] { sparse.BinaryOp(sparse_other, std::bit_or<>()); });
+  Measure("compressed BinaryOp (runs)", kNumBits / 8, [&] {
+    compressed.BinaryOp(compressed_other, std::bit_or<>());
+  });
+
+  return 0;
+}
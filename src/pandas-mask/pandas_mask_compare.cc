@@ -0,0 +1,357 @@
+/// Masks built straight from comparisons on a column of numbers, without
+/// first materializing a byte per value
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_compare.h"
+#include "nanoarrow.h"
+#include "pandas_mask_parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#if (defined(__x86_64__) || defined(_M_X64)) &&                               \
+    (defined(__GNUC__) || defined(__clang__))
+#define PANDAS_MASK_COMPARE_SSE2 1
+#include <emmintrin.h>
+#else
+#define PANDAS_MASK_COMPARE_SSE2 0
+#endif
+
+// Everything PackRange calls is forced inline, so that a copy of it built for
+// a target ISA compiles all of its loop for that ISA
+#if defined(__GNUC__) || defined(__clang__)
+#define PANDAS_MASK_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define PANDAS_MASK_ALWAYS_INLINE inline
+#endif
+
+namespace pandas_mask::compare {
+
+namespace {
+
+#if PANDAS_MASK_COMPARE_SSE2
+/// 16 bytes of T. SSE2 is part of the x86-64 baseline, so the compiler turns
+/// the built-in comparison operators on these into the right instructions for
+/// every T, each lane of the result being all ones where it holds
+template <typename T> using Vec __attribute__((vector_size(16))) = T;
+
+/// pred applied to the 16 values from values, as one byte per value that is
+/// all ones where it holds. Wider lanes are narrowed with saturating packs,
+/// which keep all ones and zeros as they are
+template <typename T, typename Pred>
+PANDAS_MASK_ALWAYS_INLINE auto CompareBytes(const T *values, Pred pred) noexcept
+    -> __m128i {
+  const auto compare = [&](int j) {
+    Vec<T> v;
+    memcpy(&v, &values[j * sizeof(v) / sizeof(T)], sizeof(v));
+    const auto lanes = pred(v);
+    __m128i result;
+    memcpy(&result, &lanes, sizeof(result));
+    return result;
+  };
+  if constexpr (sizeof(T) == 1) {
+    return compare(0);
+  } else if constexpr (sizeof(T) == 2) {
+    return _mm_packs_epi16(compare(0), compare(1));
+  } else if constexpr (sizeof(T) == 4) {
+    return _mm_packs_epi16(_mm_packs_epi32(compare(0), compare(1)),
+                           _mm_packs_epi32(compare(2), compare(3)));
+  } else {
+    // both halves of a 64-bit lane are the same, so keep the low ones
+    const auto narrow = [&](int j) {
+      return _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(compare(j)),
+                                             _mm_castsi128_ps(compare(j + 1)),
+                                             _MM_SHUFFLE(2, 0, 2, 0)));
+    };
+    return _mm_packs_epi16(_mm_packs_epi32(narrow(0), narrow(2)),
+                           _mm_packs_epi32(narrow(4), narrow(6)));
+  }
+}
+#endif
+
+/// Bit j is pred(values[j]) for the 64 values from values. Where SSE2 is
+/// available pred is applied to whole registers, and each 16 values take one
+/// movemask
+template <typename T, typename Pred>
+PANDAS_MASK_ALWAYS_INLINE auto PredicateWord(const T *values,
+                                             Pred pred) noexcept -> uint64_t {
+  uint64_t word = 0;
+#if PANDAS_MASK_COMPARE_SSE2
+  for (int j = 0; j < 64; j += 16) {
+    const auto bits = _mm_movemask_epi8(CompareBytes(&values[j], pred));
+    word |= static_cast<uint64_t>(static_cast<uint16_t>(bits)) << j;
+  }
+#else
+  for (int j = 0; j < 64; j++) {
+    word |= static_cast<uint64_t>(pred(values[j])) << j;
+  }
+#endif
+  return word;
+}
+
+auto AllocateBitmap(int64_t length) -> nanoarrow::UniqueBitmap {
+  nanoarrow::UniqueBitmap bitmap;
+  ArrowBitmapInit(bitmap.get());
+  NANOARROW_THROW_NOT_OK(ArrowBitmapReserve(bitmap.get(), length));
+  bitmap->size_bits = length;
+  bitmap->buffer.size_bytes = _ArrowBytesForBits(length);
+  return bitmap;
+}
+
+/// Writes pred(values[i]) for i in [first, last) to bit i of out, a word at a
+/// time. first is a multiple of 8, and the padding bits after last are zeroed.
+/// Everything is passed by value, so the stores to out cannot alias it and
+/// the loop keeps it all in registers
+template <typename T, typename Pred>
+PANDAS_MASK_ALWAYS_INLINE auto PackRange(const T *values, int64_t first,
+                                         int64_t last, Pred pred, uint8_t *out)
+    noexcept -> void {
+  int64_t i = first;
+  for (; i + 64 <= last; i += 64) {
+    const uint64_t word = PredicateWord(&values[i], pred);
+    memcpy(&out[i / 8], &word, sizeof(word));
+  }
+
+  if (i < last) {
+    uint64_t word = 0;
+    for (int64_t j = 0; i + j < last; j++) {
+      word |= static_cast<uint64_t>(pred(values[i + j])) << j;
+    }
+    memcpy(&out[i / 8], &word, _ArrowBytesForBits(last - i));
+  }
+}
+
+#if PANDAS_MASK_COMPARE_SSE2
+/// PackRange built for AVX2, whose 128-bit forms add the 64-bit integer
+/// compare SSE2 lacks. Registers stay 16 bytes wide, so pred, built for the
+/// baseline, takes them the same way in either
+template <typename T, typename Pred>
+__attribute__((target("avx2"))) auto
+PackRangeAvx2(const T *values, int64_t first, int64_t last, Pred pred,
+              uint8_t *out) noexcept -> void {
+  PackRange(values, first, last, pred, out);
+}
+#endif
+
+/// Packs pred(values[i]) into a new mask, with no byte per value in between.
+/// pred takes either a single T or a Vec<T>
+template <typename T, typename Pred>
+auto PackPredicate(const T *values, int64_t length, Pred pred)
+    -> PandasMaskArrayImpl {
+  auto bitmap = AllocateBitmap(length);
+  uint8_t *out = bitmap->buffer.data;
+#if PANDAS_MASK_COMPARE_SSE2
+  const bool avx2 = pandas_mask::kernels::ActiveKernels().isa >=
+                    pandas_mask::kernels::Isa::AVX2;
+#endif
+  pandas_mask::parallel::ForEachChunk(
+      out, _ArrowBytesForBits(length), [&](int64_t begin, int64_t end) {
+        const int64_t last = std::min(end * 8, length);
+#if PANDAS_MASK_COMPARE_SSE2
+        if (avx2) {
+          PackRangeAvx2(values, begin * 8, last, pred, out);
+          return;
+        }
+#endif
+        PackRange(values, begin * 8, last, pred, out);
+      });
+
+  return PandasMaskArrayImpl(std::move(bitmap));
+}
+
+/// A mask of length elements that are all value
+auto Filled(int64_t length, bool value) -> PandasMaskArrayImpl {
+  auto bitmap = AllocateBitmap(length);
+  if (length > 0) {
+    memset(bitmap->buffer.data, value ? 0xFF : 0, bitmap->buffer.size_bytes);
+    if (length % 8 != 0) {
+      bitmap->buffer.data[length / 8] &=
+          static_cast<uint8_t>((1U << (length % 8)) - 1);
+    }
+  }
+  return PandasMaskArrayImpl(std::move(bitmap));
+}
+
+/// A comparison of every value of type T with a scalar of another type, as
+/// either its result for all of them or the T to compare each with instead
+template <typename T> struct Rewritten {
+  std::optional<bool> result;
+  T scalar;
+};
+
+/// Where a whole number falls against the range of integer type T
+enum class Range { Below, Within, Above };
+
+template <typename T, typename S> auto Locate(S scalar) noexcept -> Range {
+  using Limits = std::numeric_limits<T>;
+  if constexpr (std::is_integral_v<S>) {
+    if (std::cmp_less(scalar, Limits::min())) {
+      return Range::Below;
+    }
+    if (std::cmp_greater(scalar, Limits::max())) {
+      return Range::Above;
+    }
+  } else {
+    // min is zero or -2^digits and max + 1 is 2^digits, all exact doubles
+    if (scalar < static_cast<S>(Limits::min())) {
+      return Range::Below;
+    }
+    if (scalar >= std::ldexp(S{1}, Limits::digits)) {
+      return Range::Above;
+    }
+  }
+  return Range::Within;
+}
+
+template <typename T, typename S>
+auto Rewrite(Comparison op, S scalar) noexcept -> Rewritten<T> {
+  if constexpr (std::is_floating_point_v<T>) {
+    // the scalar becomes a T, as in NumPy, but a double too large for a
+    // float, whose conversion is undefined, becomes an infinity
+    if constexpr (std::is_floating_point_v<S> && sizeof(S) > sizeof(T)) {
+      if (std::abs(scalar) > std::numeric_limits<T>::max()) {
+        return {std::nullopt, static_cast<T>(std::copysign(
+                                  std::numeric_limits<S>::infinity(), scalar))};
+      }
+    }
+    return {std::nullopt, static_cast<T>(scalar)};
+  } else {
+    S whole = scalar;
+    if constexpr (std::is_floating_point_v<S>) {
+      if (std::isnan(scalar)) {
+        return {op == Comparison::NotEqual, T{}};
+      }
+      // for an integer x, x < s is x < ceil(s) and x <= s is x <= floor(s)
+      switch (op) {
+      case Comparison::Less:
+      case Comparison::GreaterEqual:
+        whole = std::ceil(scalar);
+        break;
+      case Comparison::LessEqual:
+      case Comparison::Greater:
+        whole = std::floor(scalar);
+        break;
+      case Comparison::Equal:
+      case Comparison::NotEqual:
+        if (std::floor(scalar) != scalar) {
+          return {op == Comparison::NotEqual, T{}};
+        }
+        break;
+      }
+    }
+
+    switch (Locate<T>(whole)) {
+    case Range::Below:
+      return {op == Comparison::Greater || op == Comparison::GreaterEqual ||
+                  op == Comparison::NotEqual,
+              T{}};
+    case Range::Above:
+      return {op == Comparison::Less || op == Comparison::LessEqual ||
+                  op == Comparison::NotEqual,
+              T{}};
+    case Range::Within:
+      break;
+    }
+    return {std::nullopt, static_cast<T>(whole)};
+  }
+}
+
+template <typename T>
+auto Rewrite(Comparison op, const Scalar &scalar) noexcept -> Rewritten<T> {
+  return std::visit([&](auto value) { return Rewrite<T>(op, value); },
+                    scalar);
+}
+
+} // namespace
+
+template <typename T>
+auto Compare(const T *values, int64_t length, Comparison op, T scalar)
+    -> PandasMaskArrayImpl {
+  // one loop per operator, so the comparison is not chosen per value
+  switch (op) {
+  case Comparison::Less:
+    return PackPredicate(values, length, [=](auto v) { return v < scalar; });
+  case Comparison::LessEqual:
+    return PackPredicate(values, length, [=](auto v) { return v <= scalar; });
+  case Comparison::Equal:
+    return PackPredicate(values, length, [=](auto v) { return v == scalar; });
+  case Comparison::NotEqual:
+    return PackPredicate(values, length, [=](auto v) { return v != scalar; });
+  case Comparison::Greater:
+    return PackPredicate(values, length, [=](auto v) { return v > scalar; });
+  case Comparison::GreaterEqual:
+    return PackPredicate(values, length, [=](auto v) { return v >= scalar; });
+  }
+  throw std::invalid_argument("unknown comparison");
+}
+
+template <typename T>
+auto Compare(const T *values, int64_t length, Comparison op, Scalar scalar)
+    -> PandasMaskArrayImpl {
+  const auto rewritten = Rewrite<T>(op, scalar);
+  if (rewritten.result) {
+    return Filled(length, *rewritten.result);
+  }
+  return Compare(values, length, op, rewritten.scalar);
+}
+
+template <typename T>
+auto IsNan(const T *values, int64_t length) -> PandasMaskArrayImpl {
+  if constexpr (std::is_floating_point_v<T>) {
+    // unlike std::isnan this also applies to a whole register
+    return PackPredicate(values, length, [](auto v) { return v != v; });
+  } else {
+    return Filled(length, false);
+  }
+}
+
+template <typename T>
+auto InRange(const T *values, int64_t length, T lo, T hi)
+    -> PandasMaskArrayImpl {
+  // & rather than &&, which is not defined on registers
+  return PackPredicate(values, length,
+                       [=](auto v) { return (lo <= v) & (v <= hi); });
+}
+
+template <typename T>
+auto InRange(const T *values, int64_t length, Scalar lo, Scalar hi)
+    -> PandasMaskArrayImpl {
+  const auto low = Rewrite<T>(Comparison::GreaterEqual, lo);
+  const auto high = Rewrite<T>(Comparison::LessEqual, hi);
+  if (low.result == false || high.result == false) {
+    return Filled(length, false);
+  }
+  // a bound that every value meets is replaced by the limit of T
+  return InRange(values, length,
+                 low.result ? std::numeric_limits<T>::lowest() : low.scalar,
+                 high.result ? std::numeric_limits<T>::max() : high.scalar);
+}
+
+#define PANDAS_MASK_COMPARE_INSTANTIATE(T)                                     \
+  template auto Compare(const T *, int64_t, Comparison, T)                     \
+      -> PandasMaskArrayImpl;                                                  \
+  template auto Compare(const T *, int64_t, Comparison, Scalar)                \
+      -> PandasMaskArrayImpl;                                                  \
+  template auto IsNan(const T *, int64_t) -> PandasMaskArrayImpl;              \
+  template auto InRange(const T *, int64_t, T, T) -> PandasMaskArrayImpl;      \
+  template auto InRange(const T *, int64_t, Scalar, Scalar)                    \
+      -> PandasMaskArrayImpl;
+
+PANDAS_MASK_COMPARE_INSTANTIATE(int8_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(int16_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(int32_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(int64_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(uint8_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(uint16_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(uint32_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(uint64_t)
+PANDAS_MASK_COMPARE_INSTANTIATE(float)
+PANDAS_MASK_COMPARE_INSTANTIATE(double)
+
+} // namespace pandas_mask::compare
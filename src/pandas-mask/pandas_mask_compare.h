@@ -0,0 +1,82 @@
+/// Masks built straight from comparisons on a column of numbers, without
+/// first materializing a byte per value
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+#include <variant>
+
+#include "pandas_mask_impl.h"
+
+namespace pandas_mask::compare {
+
+/// A scalar as Python has it: an integer of either sign, or a float
+using Scalar = std::variant<int64_t, uint64_t, double>;
+
+enum class Comparison {
+  Less,
+  LessEqual,
+  Equal,
+  NotEqual,
+  Greater,
+  GreaterEqual,
+};
+
+// Each packs its predicate over length values into a new mask, building
+// every 64-bit word of it straight from compares and movemasks over the
+// values; large columns are split across the thread pool. Comparisons follow
+// IEEE 754, so NaN compares false to everything but is NotEqual to everything
+
+/// values[i] op scalar
+template <typename T>
+auto Compare(const T *values, int64_t length, Comparison op, T scalar)
+    -> PandasMaskArrayImpl;
+
+/// values[i] op scalar, comparing by value whatever the type of scalar, as
+/// NumPy does with a Python number: one outside the range of T decides every
+/// element without reading values, and one with a fraction is compared
+/// exactly with integers, so x < 2.5 is x <= 2 and x == 2.5 is never true
+template <typename T>
+auto Compare(const T *values, int64_t length, Comparison op, Scalar scalar)
+    -> PandasMaskArrayImpl;
+
+/// Whether each value is NaN, which is never true of an integer
+template <typename T>
+auto IsNan(const T *values, int64_t length) -> PandasMaskArrayImpl;
+
+/// lo <= values[i] <= hi, as pandas' Series.between
+template <typename T>
+auto InRange(const T *values, int64_t length, T lo, T hi)
+    -> PandasMaskArrayImpl;
+
+/// InRange with bounds of any type, each compared by value as in Compare
+template <typename T>
+auto InRange(const T *values, int64_t length, Scalar lo, Scalar hi)
+    -> PandasMaskArrayImpl;
+
+// instantiated in pandas_mask_compare.cc for every NumPy integer and float
+#define PANDAS_MASK_COMPARE_EXTERN(T)                                          \
+  extern template auto Compare(const T *, int64_t, Comparison, T)              \
+      -> PandasMaskArrayImpl;                                                  \
+  extern template auto Compare(const T *, int64_t, Comparison, Scalar)         \
+      -> PandasMaskArrayImpl;                                                  \
+  extern template auto IsNan(const T *, int64_t) -> PandasMaskArrayImpl;       \
+  extern template auto InRange(const T *, int64_t, T, T)                       \
+      -> PandasMaskArrayImpl;                                                  \
+  extern template auto InRange(const T *, int64_t, Scalar, Scalar)             \
+      -> PandasMaskArrayImpl;
+
+PANDAS_MASK_COMPARE_EXTERN(int8_t)
+PANDAS_MASK_COMPARE_EXTERN(int16_t)
+PANDAS_MASK_COMPARE_EXTERN(int32_t)
+PANDAS_MASK_COMPARE_EXTERN(int64_t)
+PANDAS_MASK_COMPARE_EXTERN(uint8_t)
+PANDAS_MASK_COMPARE_EXTERN(uint16_t)
+PANDAS_MASK_COMPARE_EXTERN(uint32_t)
+PANDAS_MASK_COMPARE_EXTERN(uint64_t)
+PANDAS_MASK_COMPARE_EXTERN(float)
+PANDAS_MASK_COMPARE_EXTERN(double)
+
+#undef PANDAS_MASK_COMPARE_EXTERN
+
+} // namespace pandas_mask::compare
@@ -0,0 +1,143 @@
+#include "pandas_mask_compare.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace compare = pandas_mask::compare;
+using compare::Comparison;
+
+template <typename T> class PandasMaskCompareTest : public testing::Test {
+protected:
+  static auto Values(int64_t length) -> std::vector<T> {
+    std::mt19937 rng(6);
+    std::uniform_int_distribution<int> dist(0, 10);
+    std::vector<T> values(length);
+    for (auto &value : values) {
+      value = static_cast<T>(dist(rng));
+    }
+    return values;
+  }
+
+  template <typename Pred>
+  static auto ExpectMatches(const PandasMaskArrayImpl &mask,
+                            const std::vector<T> &values, Pred pred) -> void {
+    ASSERT_EQ(mask.Length(), static_cast<int64_t>(values.size()));
+    ASSERT_TRUE(mask.IsPacked());
+    for (size_t i = 0; i < values.size(); i++) {
+      ASSERT_EQ(mask.GetItem(i), pred(values[i])) << i;
+    }
+  }
+};
+
+using ValueTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, float, double>;
+TYPED_TEST_SUITE(PandasMaskCompareTest, ValueTypes);
+
+TYPED_TEST(PandasMaskCompareTest, MatchesScalarLoop) {
+  using T = TypeParam;
+  // whole blocks, a partial block and a partial byte
+  for (const int64_t length : {0, 1, 7, 64, 4096, 10003}) {
+    const auto values = this->Values(length);
+    const auto *data = values.data();
+    const T five = 5;
+
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::Less, five), values,
+        [&](T v) { return v < five; });
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::LessEqual, five), values,
+        [&](T v) { return v <= five; });
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::Equal, five), values,
+        [&](T v) { return v == five; });
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::NotEqual, five), values,
+        [&](T v) { return v != five; });
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::Greater, five), values,
+        [&](T v) { return v > five; });
+    this->ExpectMatches(
+        compare::Compare(data, length, Comparison::GreaterEqual, five),
+        values, [&](T v) { return v >= five; });
+    this->ExpectMatches(compare::InRange(data, length, T{3}, T{7}), values,
+                        [&](T v) { return v >= 3 && v <= 7; });
+    ASSERT_FALSE(compare::IsNan(data, length).Any());
+  }
+}
+
+TEST(PandasMaskCompareTest, NaN) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const std::vector<double> values{1.0, nan, 3.0, nan, -0.0};
+  const auto n = static_cast<int64_t>(values.size());
+
+  const auto isnan = compare::IsNan(values.data(), n);
+  for (int64_t i = 0; i < n; i++) {
+    ASSERT_EQ(isnan.GetItem(i), std::isnan(values[i]));
+  }
+  // NaN is unordered, and unequal even to itself
+  ASSERT_EQ(compare::Compare(values.data(), n, Comparison::Less, 10.0).Sum(),
+            3);
+  ASSERT_EQ(
+      compare::Compare(values.data(), n, Comparison::NotEqual, nan).Sum(), 5);
+  ASSERT_EQ(compare::InRange(values.data(), n, -1.0, 1.0).Sum(), 2);
+}
+
+TYPED_TEST(PandasMaskCompareTest, ScalarOfAnotherType) {
+  using T = TypeParam;
+  using Limits = std::numeric_limits<T>;
+  const auto values = this->Values(1000);
+  const auto *data = values.data();
+  const auto n = static_cast<int64_t>(values.size());
+  const auto all = [&](const PandasMaskArrayImpl &mask) {
+    return mask.Length() == n && mask.Sum() == n;
+  };
+  const auto none = [&](const PandasMaskArrayImpl &mask) {
+    return mask.Length() == n && mask.Sum() == 0;
+  };
+
+  // exact comparisons with a fraction, whatever the type of values
+  const compare::Scalar half = 4.5;
+  this->ExpectMatches(compare::Compare(data, n, Comparison::Less, half), values,
+                      [](T v) { return v < 4.5; });
+  this->ExpectMatches(compare::Compare(data, n, Comparison::LessEqual, half),
+                      values, [](T v) { return v <= 4.5; });
+  this->ExpectMatches(compare::Compare(data, n, Comparison::Greater, half),
+                      values, [](T v) { return v > 4.5; });
+  this->ExpectMatches(compare::Compare(data, n, Comparison::GreaterEqual, half),
+                      values, [](T v) { return v >= 4.5; });
+  ASSERT_EQ(compare::Compare(data, n, Comparison::Equal, half).Sum(), 0);
+  ASSERT_TRUE(all(compare::Compare(data, n, Comparison::NotEqual, half)));
+  this->ExpectMatches(compare::InRange(data, n, compare::Scalar{2.5},
+                                       compare::Scalar{int64_t{7}}),
+                      values, [](T v) { return v >= 2.5 && v <= 7; });
+
+  // scalars past either end of the integer types
+  const compare::Scalar huge = 1e30;
+  const compare::Scalar below = -1e30;
+  ASSERT_TRUE(all(compare::Compare(data, n, Comparison::Less, huge)));
+  ASSERT_TRUE(none(compare::Compare(data, n, Comparison::Greater, huge)));
+  ASSERT_TRUE(none(compare::Compare(data, n, Comparison::Equal, huge)));
+  ASSERT_TRUE(all(compare::Compare(data, n, Comparison::GreaterEqual, below)));
+  ASSERT_TRUE(none(compare::Compare(data, n, Comparison::LessEqual, below)));
+  ASSERT_TRUE(all(compare::InRange(data, n, below, huge)));
+  ASSERT_TRUE(none(compare::InRange(data, n, huge, huge)));
+  if constexpr (std::is_integral_v<T>) {
+    const compare::Scalar max = uint64_t{Limits::max()};
+    const compare::Scalar past = 1.0 + static_cast<double>(Limits::max());
+    ASSERT_TRUE(all(compare::Compare(data, n, Comparison::LessEqual, max)));
+    ASSERT_TRUE(all(compare::Compare(data, n, Comparison::Less, past)));
+    if constexpr (std::is_unsigned_v<T>) {
+      const compare::Scalar negative = int64_t{-1};
+      ASSERT_TRUE(none(compare::Compare(data, n, Comparison::Less, negative)));
+    }
+    const compare::Scalar nan = std::numeric_limits<double>::quiet_NaN();
+    ASSERT_TRUE(none(compare::Compare(data, n, Comparison::Less, nan)));
+    ASSERT_TRUE(all(compare::Compare(data, n, Comparison::NotEqual, nan)));
+  }
+}
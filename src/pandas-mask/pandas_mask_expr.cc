@@ -0,0 +1,171 @@
+/// Lazily evaluated boolean expressions over bitmap arrays
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_expr.h"
+#include "nanoarrow.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+using pandas_mask::kernels::LoadWords;
+using pandas_mask::kernels::LowBits;
+
+namespace {
+
+// Words per block; small enough that a block per stack slot stays in L1 for
+// any reasonable expression, large enough for the loops to vectorize
+constexpr int64_t kBlockWords = 64;
+constexpr int64_t kBlockBits = kBlockWords * 64;
+
+using Block = std::array<uint64_t, kBlockWords>;
+
+/// Loads nbits of mask starting at element start into words, zeroing any
+/// bits past nbits in the last word
+auto LoadBlock(const PandasMaskArrayImpl &mask, int64_t start, int64_t nbits,
+               uint64_t *words) -> void {
+  LoadWords(mask.Data(), mask.Offset() + start, nbits, words);
+}
+
+} // namespace
+
+PandasMaskExprImpl::PandasMaskExprImpl(const PandasMaskArrayImpl &mask)
+    : leaves_{mask.Copy()}, program_{{Opcode::Load, 0}},
+      length_(mask.Length()) {}
+
+auto PandasMaskExprImpl::Length() const noexcept -> ssize_t {
+  return length_;
+}
+
+auto PandasMaskExprImpl::Invert() const -> PandasMaskExprImpl {
+  auto result = *this;
+  result.program_.push_back({Opcode::Not, 0});
+  return result;
+}
+
+auto PandasMaskExprImpl::Combine(const PandasMaskExprImpl &other,
+                                 Opcode opcode) const -> PandasMaskExprImpl {
+  if (length_ != other.length_) {
+    throw std::invalid_argument("Shape of other does not match bitmask shape");
+  }
+
+  // other's program runs after ours, one stack slot higher, and its leaves
+  // are appended to ours
+  auto result = *this;
+  const auto leaf_base = static_cast<int32_t>(leaves_.size());
+  result.leaves_.insert(result.leaves_.end(), other.leaves_.begin(),
+                        other.leaves_.end());
+  for (auto instruction : other.program_) {
+    if (instruction.opcode == Opcode::Load) {
+      instruction.leaf += leaf_base;
+    }
+    result.program_.push_back(instruction);
+  }
+  result.program_.push_back({opcode, 0});
+  result.depth_ = std::max(depth_, other.depth_ + 1);
+
+  return result;
+}
+
+template <typename F> auto PandasMaskExprImpl::ForEachBlock(F &&func) const
+    -> void {
+  std::vector<Block> stack(depth_);
+
+  for (int64_t start = 0; start < length_; start += kBlockBits) {
+    const int64_t nbits = std::min(kBlockBits, length_ - start);
+    const int64_t nwords = (nbits + 63) / 64;
+
+    int64_t top = -1;
+    for (const auto &instruction : program_) {
+      switch (instruction.opcode) {
+      case Opcode::Load:
+        LoadBlock(leaves_[instruction.leaf], start, nbits,
+                  stack[++top].data());
+        break;
+      case Opcode::Not:
+        for (int64_t i = 0; i < nwords; i++) {
+          stack[top][i] = ~stack[top][i];
+        }
+        stack[top][nwords - 1] &= LowBits(nbits - (nwords - 1) * 64);
+        break;
+      case Opcode::And:
+        for (int64_t i = 0; i < nwords; i++) {
+          stack[top - 1][i] &= stack[top][i];
+        }
+        --top;
+        break;
+      case Opcode::Or:
+        for (int64_t i = 0; i < nwords; i++) {
+          stack[top - 1][i] |= stack[top][i];
+        }
+        --top;
+        break;
+      case Opcode::Xor:
+        for (int64_t i = 0; i < nwords; i++) {
+          stack[top - 1][i] ^= stack[top][i];
+        }
+        --top;
+        break;
+      }
+    }
+
+    if (!func(stack[0].data(), nwords, nbits)) {
+      return;
+    }
+  }
+}
+
+auto PandasMaskExprImpl::Evaluate() const -> PandasMaskArrayImpl {
+  nanoarrow::UniqueBitmap bitmap;
+  ArrowBitmapInit(bitmap.get());
+  NANOARROW_THROW_NOT_OK(ArrowBitmapReserve(bitmap.get(), length_));
+  bitmap->size_bits = length_;
+  bitmap->buffer.size_bytes = _ArrowBytesForBits(length_);
+
+  uint8_t *out = bitmap->buffer.data;
+  ForEachBlock([&](const uint64_t *words, int64_t, int64_t nbits) {
+    memcpy(out, words, _ArrowBytesForBits(nbits));
+    out += kBlockBits / 8;
+    return true;
+  });
+
+  return PandasMaskArrayImpl(std::move(bitmap));
+}
+
+auto PandasMaskExprImpl::Any() const -> bool {
+  bool any = false;
+  ForEachBlock([&](const uint64_t *words, int64_t nwords, int64_t) {
+    any = std::any_of(words, words + nwords,
+                      [](uint64_t word) { return word != 0; });
+    return !any;
+  });
+
+  return any;
+}
+
+auto PandasMaskExprImpl::All() const -> bool {
+  bool all = true;
+  ForEachBlock([&](const uint64_t *words, int64_t nwords, int64_t nbits) {
+    for (int64_t i = 0; i < nwords; i++) {
+      if (words[i] != LowBits(std::min<int64_t>(64, nbits - i * 64))) {
+        all = false;
+        break;
+      }
+    }
+    return all;
+  });
+
+  return all;
+}
+
+auto PandasMaskExprImpl::Sum() const -> ssize_t {
+  ssize_t count = 0;
+  ForEachBlock([&](const uint64_t *words, int64_t nwords, int64_t) {
+    for (int64_t i = 0; i < nwords; i++) {
+      count += std::popcount(words[i]);
+    }
+    return true;
+  });
+
+  return count;
+}
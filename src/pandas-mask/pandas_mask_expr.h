@@ -0,0 +1,68 @@
+/// Lazily evaluated boolean expressions over bitmap arrays
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "pandas_mask_impl.h"
+
+/// An expression such as (a & b) | ~c over masks of equal length. Building
+/// one only records the operations; Evaluate and the reductions then make a
+/// single word-at-a-time pass over the inputs, so no intermediate mask is
+/// ever allocated
+class PandasMaskExprImpl {
+public:
+  /// Expression that evaluates to mask. The buffer is shared, not copied
+  explicit PandasMaskExprImpl(const PandasMaskArrayImpl &mask);
+
+  auto Length() const noexcept -> ssize_t;
+
+  auto Invert() const -> PandasMaskExprImpl;
+
+  template <typename OP>
+  auto BinaryOp(const PandasMaskExprImpl &other, OP) const
+      -> PandasMaskExprImpl {
+    if constexpr (std::is_same_v<OP, std::bit_and<>>) {
+      return Combine(other, Opcode::And);
+    } else if constexpr (std::is_same_v<OP, std::bit_or<>>) {
+      return Combine(other, Opcode::Or);
+    } else {
+      static_assert(std::is_same_v<OP, std::bit_xor<>>,
+                    "expressions support bit_and, bit_or and bit_xor");
+      return Combine(other, Opcode::Xor);
+    }
+  }
+
+  /// Materializes the expression into a new mask
+  auto Evaluate() const -> PandasMaskArrayImpl;
+
+  auto Any() const -> bool;
+  auto All() const -> bool;
+  auto Sum() const -> ssize_t;
+
+private:
+  enum class Opcode : uint8_t { Load, Not, And, Or, Xor };
+
+  struct Instruction {
+    Opcode opcode;
+    // index into leaves_ for Load, unused otherwise
+    int32_t leaf;
+  };
+
+  auto Combine(const PandasMaskExprImpl &other, Opcode opcode) const
+      -> PandasMaskExprImpl;
+
+  /// Evaluates the program one block of words at a time, calling
+  /// func(words, nwords, nbits) with each result block until it returns false
+  template <typename F> auto ForEachBlock(F &&func) const -> void;
+
+  // the expression in postfix order, evaluated on a stack of word blocks
+  std::vector<PandasMaskArrayImpl> leaves_;
+  std::vector<Instruction> program_;
+  int64_t depth_ = 1;
+  int64_t length_ = 0;
+};
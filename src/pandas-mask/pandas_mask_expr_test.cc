@@ -0,0 +1,105 @@
+#include "pandas_mask_expr.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+class PandasMaskExprTest : public testing::Test {
+protected:
+  PandasMaskExprTest() {
+    std::mt19937 rng(11);
+    std::bernoulli_distribution dist(0.5);
+    for (auto &values : values_) {
+      values.resize(kLength + 16);
+      for (auto &value : values) {
+        value = dist(rng);
+      }
+    }
+  }
+
+  // Longer than one evaluation block with a ragged tail
+  static constexpr int64_t kLength = 10000;
+
+  // Mask i starts at bit offset i of its buffer so every leaf is misaligned
+  // differently
+  auto Mask(int i, int64_t length = kLength) const -> PandasMaskArrayImpl {
+    return PandasMaskArrayImpl::Pack(values_[i].data(), values_[i].size())
+        .Slice(i, length);
+  }
+
+  auto Value(int i, int64_t index) const -> bool {
+    return values_[i][i + index] != 0;
+  }
+
+  std::vector<uint8_t> values_[4];
+};
+
+TEST_F(PandasMaskExprTest, Evaluate) {
+  const PandasMaskExprImpl a(Mask(0)), b(Mask(1)), c(Mask(2)), d(Mask(3));
+
+  // (a & b) | (~c ^ d)
+  const auto expr = a.BinaryOp(b, std::bit_and<>())
+                        .BinaryOp(c.Invert().BinaryOp(d, std::bit_xor<>()),
+                                  std::bit_or<>());
+  const auto result = expr.Evaluate();
+
+  ASSERT_EQ(result.Length(), kLength);
+  ssize_t count = 0;
+  for (int64_t i = 0; i < kLength; i++) {
+    const bool expected =
+        (Value(0, i) && Value(1, i)) || (!Value(2, i) != Value(3, i));
+    ASSERT_EQ(result.GetItem(i), expected) << i;
+    count += expected;
+  }
+  ASSERT_EQ(expr.Sum(), count);
+  ASSERT_EQ(expr.Sum(), result.Sum());
+  ASSERT_EQ(expr.Any(), result.Any());
+  ASSERT_EQ(expr.All(), result.All());
+}
+
+TEST_F(PandasMaskExprTest, Reductions) {
+  const PandasMaskExprImpl a(Mask(1));
+
+  ASSERT_EQ(a.BinaryOp(a.Invert(), std::bit_and<>()).Sum(), 0);
+  ASSERT_FALSE(a.BinaryOp(a.Invert(), std::bit_and<>()).Any());
+  ASSERT_TRUE(a.BinaryOp(a.Invert(), std::bit_or<>()).All());
+  ASSERT_EQ(a.BinaryOp(a.Invert(), std::bit_xor<>()).Sum(), kLength);
+
+  const PandasMaskExprImpl b(Mask(2));
+  const auto anded = a.BinaryOp(b, std::bit_and<>());
+  ASSERT_EQ(anded.Sum(), Mask(1).BinaryOp(Mask(2), std::bit_and<>()).Sum());
+  ASSERT_TRUE(anded.Any());
+  ASSERT_FALSE(anded.All());
+}
+
+TEST_F(PandasMaskExprTest, Lengths) {
+  for (const int64_t length : {0, 1, 63, 64, 65, 4095, 4096, 4097}) {
+    const PandasMaskExprImpl a(Mask(3, length));
+    const auto inverted = a.Invert();
+    const auto result = inverted.Evaluate();
+
+    ASSERT_EQ(result.Length(), length);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(result.GetItem(i), !Value(3, i));
+    }
+    ASSERT_EQ(inverted.Sum(), length - Mask(3, length).Sum());
+    ASSERT_EQ(inverted.All(), result.All());
+    ASSERT_EQ(inverted.Any(), result.Any());
+  }
+}
+
+TEST_F(PandasMaskExprTest, SharesLeavesUntilWritten) {
+  auto mask = Mask(0);
+  const PandasMaskExprImpl expr(mask);
+  const auto before = expr.Sum();
+
+  // the expression holds a copy of the mask, so later writes do not leak in
+  mask.SetRange(0, kLength, true);
+  ASSERT_EQ(expr.Sum(), before);
+}
+
+TEST_F(PandasMaskExprTest, LengthMismatchRaises) {
+  const PandasMaskExprImpl a(Mask(0)), b(Mask(1, kLength - 1));
+  ASSERT_THROW(a.BinaryOp(b, std::bit_and<>()), std::invalid_argument);
+}
@@ -0,0 +1,219 @@
+/// File-backed storage for the Bitmap Array class
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_impl.h"
+#include "nanoarrow.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// A mask file is a 64-byte header followed by the packed bits, so the
+// payload of a page-aligned mapping starts on a cache line. All integers
+// are little-endian:
+//   bytes  0-7   magic
+//   bytes  8-11  format version
+//   bytes 12-15  header size, i.e. the offset of the payload
+//   bytes 16-23  length in bits
+//   bytes 24-63  reserved, zero
+constexpr std::array<uint8_t, 8> kMagic = {'P', 'D', 'M', 'A',
+                                           'S', 'K', '\0', '\0'};
+constexpr uint32_t kVersion = 1;
+constexpr int64_t kHeaderBytes = 64;
+
+auto StoreLE(uint8_t *dst, uint64_t value, int nbytes) -> void {
+  for (int i = 0; i < nbytes; i++) {
+    dst[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+auto LoadLE(const uint8_t *src, int nbytes) -> uint64_t {
+  uint64_t value = 0;
+  for (int i = 0; i < nbytes; i++) {
+    value |= static_cast<uint64_t>(src[i]) << (8 * i);
+  }
+  return value;
+}
+
+/// Checks the header of a file of size bytes, returning the mask length
+auto ParseHeader(const uint8_t *header, int64_t size) -> int64_t {
+  if (size < kHeaderBytes ||
+      memcmp(header, kMagic.data(), kMagic.size()) != 0) {
+    throw std::invalid_argument("not a pandas_mask file");
+  }
+  if (LoadLE(&header[8], 4) != kVersion ||
+      LoadLE(&header[12], 4) != kHeaderBytes) {
+    throw std::invalid_argument("unsupported pandas_mask file version");
+  }
+
+  const auto length = static_cast<int64_t>(LoadLE(&header[16], 8));
+  if (length < 0 || _ArrowBytesForBits(length) > size - kHeaderBytes) {
+    throw std::invalid_argument("pandas_mask file is truncated");
+  }
+  return length;
+}
+
+auto SystemError(const std::filesystem::path &path) -> std::system_error {
+#ifdef _WIN32
+  return std::system_error(static_cast<int>(GetLastError()),
+                           std::system_category(), path.string());
+#else
+  return std::system_error(errno, std::generic_category(), path.string());
+#endif
+}
+
+/// A whole file mapped into memory, unmapped on destruction
+class Mapping {
+public:
+  Mapping(const std::filesystem::path &path, bool writable) {
+#ifdef _WIN32
+    HANDLE file =
+        CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+      throw SystemError(path);
+    }
+    LARGE_INTEGER size{};
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+      mapping = CreateFileMappingW(file, nullptr,
+                                   writable ? PAGE_WRITECOPY : PAGE_READONLY,
+                                   0, 0, nullptr);
+    }
+    if (mapping != nullptr) {
+      data_ = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ,
+                            0, 0, 0);
+      CloseHandle(mapping);
+    }
+    const auto error = SystemError(path);
+    CloseHandle(file);
+    if (data_ == nullptr) {
+      // an empty file cannot be mapped, but is not a mask file either
+      if (size.QuadPart == 0) {
+        throw std::invalid_argument("not a pandas_mask file");
+      }
+      throw error;
+    }
+    size_ = size.QuadPart;
+#else
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw SystemError(path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      const auto error = SystemError(path);
+      close(fd);
+      throw error;
+    }
+    size_ = info.st_size;
+    if (size_ < kHeaderBytes) {
+      close(fd);
+      throw std::invalid_argument("not a pandas_mask file");
+    }
+
+    void *data = mmap(nullptr, size_, PROT_READ | (writable ? PROT_WRITE : 0),
+                      MAP_PRIVATE, fd, 0);
+    const auto error = SystemError(path);
+    close(fd);
+    if (data == MAP_FAILED) {
+      throw error;
+    }
+    data_ = data;
+#endif
+  }
+
+  ~Mapping() {
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(data_, size_);
+#endif
+  }
+
+  Mapping(const Mapping &) = delete;
+  auto operator=(const Mapping &) -> Mapping & = delete;
+
+  auto Data() const noexcept -> uint8_t * {
+    return static_cast<uint8_t *>(data_);
+  }
+  auto Size() const noexcept -> int64_t { return size_; }
+
+private:
+  void *data_ = nullptr;
+  int64_t size_ = 0;
+};
+
+/// Deallocator of a mapped buffer
+auto Unmap(ArrowBufferAllocator *allocator, uint8_t *, int64_t) -> void {
+  delete static_cast<Mapping *>(allocator->private_data);
+}
+
+} // namespace
+
+auto PandasMaskArrayImpl::FromFile(const std::filesystem::path &path,
+                                   bool copy_on_write) -> PandasMaskArrayImpl {
+  auto mapping = std::make_unique<Mapping>(path, copy_on_write);
+  const int64_t length = ParseHeader(mapping->Data(), mapping->Size());
+
+  // the buffer's deallocator now owns the mapping
+  nanoarrow::UniqueBitmap bitmap;
+  ArrowBitmapInit(bitmap.get());
+  uint8_t *payload = &mapping->Data()[kHeaderBytes];
+  NANOARROW_THROW_NOT_OK(ArrowBufferSetAllocator(
+      &bitmap->buffer, ArrowBufferDeallocator(&Unmap, mapping.get())));
+  mapping.release();
+  bitmap->buffer.data = payload;
+  bitmap->buffer.size_bytes = _ArrowBytesForBits(length);
+  bitmap->buffer.capacity_bytes = bitmap->buffer.size_bytes;
+  bitmap->size_bits = length;
+
+  PandasMaskArrayImpl result(std::move(bitmap));
+  result.readonly_ = !copy_on_write;
+  return result;
+}
+
+auto PandasMaskArrayImpl::ToFile(const std::filesystem::path &path) const
+    -> void {
+  std::array<uint8_t, kHeaderBytes> header{};
+  memcpy(header.data(), kMagic.data(), kMagic.size());
+  StoreLE(&header[8], kVersion, 4);
+  StoreLE(&header[12], kHeaderBytes, 4);
+  StoreLE(&header[16], static_cast<uint64_t>(length_), 8);
+
+  const auto packed = Packed();
+  const auto *payload = &packed.Data()[packed.offset_ / 8];
+
+  // written beside the target and renamed over it, so a mask mapped from
+  // the old file keeps its pages
+  auto tmp = path;
+  tmp += ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(header.data()), header.size());
+    out.write(reinterpret_cast<const char *>(payload), NBytes());
+    out.close();
+    if (!out) {
+      const auto error = SystemError(tmp);
+      std::error_code ignored;
+      std::filesystem::remove(tmp, ignored);
+      throw error;
+    }
+  }
+  std::filesystem::rename(tmp, path);
+}
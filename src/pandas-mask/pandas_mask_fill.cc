@@ -0,0 +1,145 @@
+/// Kernels applying a mask to a column of numbers, as numpy.where and
+/// numpy.putmask do with a boolean array, reading the mask a word at a time
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_fill.h"
+#include "pandas_mask_parallel.h"
+
+#include <algorithm>
+#include <cstring>
+
+using pandas_mask::kernels::LoadBits;
+using pandas_mask::kernels::LowBits;
+
+namespace pandas_mask::fill {
+
+namespace {
+
+/// One side of a blend taking values from a column
+template <typename T> struct Column {
+  const T *data;
+
+  auto operator[](int64_t i) const noexcept -> T { return data[i]; }
+
+  auto CopyTo(T *out, int64_t begin, int64_t end) const noexcept -> void {
+    // nothing to do when writing a column over itself
+    if (&out[begin] != &data[begin]) {
+      memcpy(&out[begin], &data[begin], (end - begin) * sizeof(T));
+    }
+  }
+};
+
+/// One side of a blend that is the same value everywhere
+template <typename T> struct Scalar {
+  T value;
+
+  auto operator[](int64_t) const noexcept -> T { return value; }
+
+  auto CopyTo(T *out, int64_t begin, int64_t end) const noexcept -> void {
+    std::fill(&out[begin], &out[end], value);
+  }
+};
+
+/// out[i] = mask[i] ? set[i] : unset[i]
+template <typename T, typename Set, typename Unset>
+auto Blend(const PandasMaskArrayImpl &mask, Set set, Unset unset, T *out)
+    -> void {
+  const int64_t length = mask.Length();
+
+  if (mask.IsCompressed()) {
+    // alternate between the gaps and the runs
+    for (int64_t i = 0; i < length;) {
+      int64_t end = mask.FindFirst(true, i);
+      end = end < 0 ? length : end;
+      unset.CopyTo(out, i, end);
+      if (end == length) {
+        break;
+      }
+      i = mask.FindFirst(false, end);
+      i = i < 0 ? length : i;
+      set.CopyTo(out, end, i);
+    }
+    return;
+  }
+
+  const uint8_t *bits = mask.Data();
+  const int64_t offset = mask.Offset();
+  // chunks of out fall on whole values, as out is aligned to its values
+  pandas_mask::parallel::ForEachChunk(
+      out, length * static_cast<int64_t>(sizeof(T)),
+      [=](int64_t begin, int64_t end) {
+        const int64_t last = end / static_cast<int64_t>(sizeof(T));
+        for (int64_t i = begin / static_cast<int64_t>(sizeof(T)); i < last;) {
+          const int64_t nbits = std::min<int64_t>(64, last - i);
+          const uint64_t word = LoadBits(bits, offset + i, nbits);
+          if (word == 0 || word == LowBits(nbits)) {
+            // a run of uniform words is copied or filled in one go
+            const uint64_t same = word == 0 ? 0 : UINT64_MAX;
+            int64_t j = i + nbits;
+            for (; j < last; j += 64) {
+              const int64_t n = std::min<int64_t>(64, last - j);
+              if (LoadBits(bits, offset + j, n) != (same & LowBits(n))) {
+                break;
+              }
+            }
+            j = std::min(j, last);
+            if (word == 0) {
+              unset.CopyTo(out, i, j);
+            } else {
+              set.CopyTo(out, i, j);
+            }
+            i = j;
+            continue;
+          }
+
+          // both sides are loaded unconditionally so that the compiler
+          // turns the select into a vector blend
+          for (int64_t j = 0; j < nbits; j++) {
+            const T a = set[i + j];
+            const T b = unset[i + j];
+            out[i + j] = ((word >> j) & 1) != 0 ? a : b;
+          }
+          i += nbits;
+        }
+      });
+}
+
+} // namespace
+
+template <typename T>
+auto Where(const PandasMaskArrayImpl &mask, const T *values, const T *other,
+           T *out) -> void {
+  Blend(mask, Column<T>{values}, Column<T>{other}, out);
+}
+
+template <typename T>
+auto Where(const PandasMaskArrayImpl &mask, const T *values, T other, T *out)
+    -> void {
+  Blend(mask, Column<T>{values}, Scalar<T>{other}, out);
+}
+
+template <typename T>
+auto PutMask(const PandasMaskArrayImpl &mask, const T *values, T fill, T *out)
+    -> void {
+  Blend(mask, Scalar<T>{fill}, Column<T>{values}, out);
+}
+
+#define PANDAS_MASK_FILL_INSTANTIATE(T)                                        \
+  template auto Where(const PandasMaskArrayImpl &, const T *, const T *, T *)  \
+      -> void;                                                                 \
+  template auto Where(const PandasMaskArrayImpl &, const T *, T, T *)          \
+      -> void;                                                                 \
+  template auto PutMask(const PandasMaskArrayImpl &, const T *, T, T *)        \
+      -> void;
+
+PANDAS_MASK_FILL_INSTANTIATE(int8_t)
+PANDAS_MASK_FILL_INSTANTIATE(int16_t)
+PANDAS_MASK_FILL_INSTANTIATE(int32_t)
+PANDAS_MASK_FILL_INSTANTIATE(int64_t)
+PANDAS_MASK_FILL_INSTANTIATE(uint8_t)
+PANDAS_MASK_FILL_INSTANTIATE(uint16_t)
+PANDAS_MASK_FILL_INSTANTIATE(uint32_t)
+PANDAS_MASK_FILL_INSTANTIATE(uint64_t)
+PANDAS_MASK_FILL_INSTANTIATE(float)
+PANDAS_MASK_FILL_INSTANTIATE(double)
+
+} // namespace pandas_mask::fill
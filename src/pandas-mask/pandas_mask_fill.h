@@ -0,0 +1,55 @@
+/// Kernels applying a mask to a column of numbers, as numpy.where and
+/// numpy.putmask do with a boolean array, reading the mask a word at a time
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+
+#include "pandas_mask_impl.h"
+
+namespace pandas_mask::fill {
+
+// Each writes mask.Length() values to out. out may be one of the input
+// columns itself, to work in place, but must not otherwise overlap them.
+// Words of the mask that are all set or all unset are copied or filled
+// whole; only mixed words are blended value by value
+
+/// out[i] = mask[i] ? values[i] : other[i]
+template <typename T>
+auto Where(const PandasMaskArrayImpl &mask, const T *values, const T *other,
+           T *out) -> void;
+
+/// out[i] = mask[i] ? values[i] : other
+template <typename T>
+auto Where(const PandasMaskArrayImpl &mask, const T *values, T other, T *out)
+    -> void;
+
+/// out[i] = mask[i] ? fill : values[i], e.g. filling the missing rows of a
+/// pandas masked array
+template <typename T>
+auto PutMask(const PandasMaskArrayImpl &mask, const T *values, T fill, T *out)
+    -> void;
+
+// instantiated in pandas_mask_fill.cc for every NumPy integer and float
+#define PANDAS_MASK_FILL_EXTERN(T)                                             \
+  extern template auto Where(const PandasMaskArrayImpl &, const T *,           \
+                             const T *, T *) -> void;                          \
+  extern template auto Where(const PandasMaskArrayImpl &, const T *, T, T *)   \
+      -> void;                                                                 \
+  extern template auto PutMask(const PandasMaskArrayImpl &, const T *, T,      \
+                               T *) -> void;
+
+PANDAS_MASK_FILL_EXTERN(int8_t)
+PANDAS_MASK_FILL_EXTERN(int16_t)
+PANDAS_MASK_FILL_EXTERN(int32_t)
+PANDAS_MASK_FILL_EXTERN(int64_t)
+PANDAS_MASK_FILL_EXTERN(uint8_t)
+PANDAS_MASK_FILL_EXTERN(uint16_t)
+PANDAS_MASK_FILL_EXTERN(uint32_t)
+PANDAS_MASK_FILL_EXTERN(uint64_t)
+PANDAS_MASK_FILL_EXTERN(float)
+PANDAS_MASK_FILL_EXTERN(double)
+
+#undef PANDAS_MASK_FILL_EXTERN
+
+} // namespace pandas_mask::fill
@@ -0,0 +1,85 @@
+#include "pandas_mask_fill.h"
+#include "pandas_mask_parallel.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+namespace fill = pandas_mask::fill;
+namespace parallel = pandas_mask::parallel;
+
+template <typename T> class PandasMaskFillTest : public testing::Test {
+protected:
+  // masks that are all unset, sparse, dense and all set, so that every kind
+  // of word is met, sliced to start mid-byte and compressed
+  static auto Masks(int64_t length) -> std::vector<PandasMaskArrayImpl> {
+    std::mt19937 rng(7);
+    std::vector<PandasMaskArrayImpl> masks;
+    for (const double density : {0.0, 0.01, 0.5, 1.0}) {
+      std::bernoulli_distribution dist(density);
+      std::vector<uint8_t> values(length + 5);
+      for (auto &value : values) {
+        value = dist(rng);
+      }
+      const auto mask = PandasMaskArrayImpl::Pack(values.data(), values.size());
+      masks.push_back(mask.Slice(5, length));
+      masks.push_back(mask.Slice(5, length).Compress());
+    }
+    return masks;
+  }
+
+  static auto Values(int64_t length, int seed) -> std::vector<T> {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> dist(0, 100);
+    std::vector<T> values(length);
+    for (auto &value : values) {
+      value = static_cast<T>(dist(rng));
+    }
+    return values;
+  }
+};
+
+using ValueTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, float, double>;
+TYPED_TEST_SUITE(PandasMaskFillTest, ValueTypes);
+
+TYPED_TEST(PandasMaskFillTest, MatchesScalarLoop) {
+  using T = TypeParam;
+  const auto threshold = parallel::Threshold();
+  const T fill = 42;
+
+  for (const int64_t length : {0, 1, 63, 64, 65, 1000, 20003}) {
+    const auto values = this->Values(length, 1);
+    const auto other = this->Values(length, 2);
+    for (const auto &mask : this->Masks(length)) {
+      // once on the calling thread and once split over the pool
+      for (const int64_t nbytes : {threshold, int64_t{0}}) {
+        parallel::SetThreshold(nbytes);
+        std::vector<T> where(length);
+        std::vector<T> where_scalar(length);
+        std::vector<T> filled(length);
+        fill::Where(mask, values.data(), other.data(), where.data());
+        fill::Where(mask, values.data(), fill, where_scalar.data());
+        fill::PutMask(mask, values.data(), fill, filled.data());
+
+        // in place, writing over one of the inputs
+        auto in_place = other;
+        fill::Where(mask, values.data(), in_place.data(), in_place.data());
+        auto put_in_place = values;
+        fill::PutMask(mask, put_in_place.data(), fill, put_in_place.data());
+
+        for (int64_t i = 0; i < length; i++) {
+          const bool set = mask.GetItem(i);
+          ASSERT_EQ(where[i], set ? values[i] : other[i]) << i;
+          ASSERT_EQ(where_scalar[i], set ? values[i] : fill) << i;
+          ASSERT_EQ(filled[i], set ? fill : values[i]) << i;
+          ASSERT_EQ(in_place[i], where[i]) << i;
+          ASSERT_EQ(put_in_place[i], filled[i]) << i;
+        }
+      }
+      parallel::SetThreshold(threshold);
+    }
+  }
+}
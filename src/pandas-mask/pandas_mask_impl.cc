@@ -2,197 +2,1100 @@
 /// Nothing in this mmodule may use the Python runtime
 #include "pandas_mask_impl.h"
 #include "nanoarrow.h"
+#include "pandas_mask_parallel.h"
 
-PandasMaskArrayImpl::PandasMaskArrayImpl() = default;
+#include <atomic>
+#include <bit>
+
+using pandas_mask::kernels::LoadBits;
+using pandas_mask::kernels::LowBits;
+
+namespace {
+
+using Run = PandasMaskArrayImpl::Run;
+
+// Smaller masks are never worth compressing automatically: the bitmap is
+// already small, and an operation on it is cheaper than decoding
+constexpr int64_t kMinCompressBytes = 1024;
+
+// Granularity of the rank index: one count per eight words, and a select
+// sample per this many set elements
+constexpr int64_t kRankBlockBits = 512;
+constexpr int64_t kSelectSample = 4096;
+
+/// The first run ending after pos, which contains pos if it starts at or
+/// before it
+auto FindRun(const std::vector<Run> &runs, int64_t pos)
+    -> std::vector<Run>::const_iterator {
+  return std::upper_bound(
+      runs.begin(), runs.end(), pos,
+      [](int64_t pos, const Run &run) { return pos < run.end; });
+}
+
+/// Calls func(first, last) with the part of each run within [begin, end)
+template <typename F>
+auto ForEachRunIn(const std::vector<Run> &runs, int64_t begin, int64_t end,
+                  F &&func) -> void {
+  for (auto run = FindRun(runs, begin); run != runs.end() && run->start < end;
+       ++run) {
+    func(std::max(run->start, begin), std::min(run->end, end));
+  }
+}
+
+/// Position of the set bit of word with k set bits below it
+auto SelectInWord(uint64_t word, int64_t k) noexcept -> int64_t {
+  for (; k > 0; k--) {
+    word &= word - 1;
+  }
+  return std::countr_zero(word);
+}
+
+/// Runs a kernel that writes whole bytes over bits [offset, offset + length)
+/// of data, restoring the bits it clobbers on either side of that range
+template <typename F>
+auto WithPreservedEdges(uint8_t *data, int64_t offset, int64_t length, F &&f)
+    -> void {
+  if (length == 0) {
+    return;
+  }
+
+  const int64_t first = offset / 8;
+  const int64_t last = (offset + length - 1) / 8;
+  const uint8_t head = data[first];
+  const uint8_t tail = data[last];
+
+  f();
+
+  const auto head_mask = static_cast<uint8_t>(LowBits(offset % 8));
+  data[first] = (data[first] & ~head_mask) | (head & head_mask);
+  if ((offset + length) % 8 != 0) {
+    const auto tail_mask = static_cast<uint8_t>(LowBits((offset + length) % 8));
+    data[last] = (data[last] & tail_mask) | (tail & ~tail_mask);
+  }
+}
+
+/// Runs a byte kernel over the nbits bits at dst, split across the thread
+/// pool for large masks. chunk(begin, nbits) covers bytes from begin
+template <typename F>
+auto ForEachByteChunk(uint8_t *dst, int64_t nbits, F &&chunk) -> void {
+  pandas_mask::parallel::ForEachChunk(
+      dst, _ArrowBytesForBits(nbits), [&](int64_t begin, int64_t end) {
+        chunk(begin, std::min(end * 8, nbits) - begin * 8);
+      });
+}
+
+/// Owns what an exported ArrowArray points to
+struct ExportedArray {
+  PandasMaskArrayImpl mask;
+  const void *buffers[2];
+};
+
+auto ReleaseExportedArray(ArrowArray *array) -> void {
+  delete static_cast<ExportedArray *>(array->private_data);
+  array->release = nullptr;
+}
+
+auto ReleaseExportedSchema(ArrowSchema *schema) -> void {
+  schema->release = nullptr;
+}
+
+/// Deallocator of an adopted buffer, releasing the array it came from
+auto ReleaseImportedArray(ArrowBufferAllocator *allocator, uint8_t *,
+                          int64_t) -> void {
+  auto *array = static_cast<ArrowArray *>(allocator->private_data);
+  if (array->release != nullptr) {
+    array->release(array);
+  }
+  delete array;
+}
+
+} // namespace
+
+PandasMaskArrayImpl::PandasMaskArrayImpl()
+    : bitmap_(std::make_shared<nanoarrow::UniqueBitmap>()) {}
 PandasMaskArrayImpl::PandasMaskArrayImpl(nanoarrow::UniqueBitmap &&bitmap)
-    : bitmap_(std::move(bitmap)) {}
+    : bitmap_(std::make_shared<nanoarrow::UniqueBitmap>(std::move(bitmap))),
+      length_((*bitmap_)->size_bits) {}
+
+auto PandasMaskArrayImpl::Allocate(int64_t length, int64_t offset)
+    -> PandasMaskArrayImpl {
+  nanoarrow::UniqueBitmap new_bitmap;
+  ArrowBitmapInit(new_bitmap.get());
+  const int64_t nbits = offset + length;
+  NANOARROW_THROW_NOT_OK(ArrowBitmapReserve(new_bitmap.get(), nbits));
+  new_bitmap->size_bits = nbits;
+  new_bitmap->buffer.size_bytes = _ArrowBytesForBits(nbits);
+
+  auto result = PandasMaskArrayImpl(std::move(new_bitmap));
+  result.offset_ = offset;
+  result.length_ = length;
+  return result;
+}
+
+auto PandasMaskArrayImpl::Pack(const uint8_t *values, int64_t length)
+    -> PandasMaskArrayImpl {
+  auto result = Allocate(length, 0);
+  uint8_t *out = result.MutableData();
+  ForEachByteChunk(out, length, [&](int64_t begin, int64_t nbits) {
+    pandas_mask::kernels::ActiveKernels().pack(&values[begin * 8], &out[begin],
+                                               nbits);
+  });
+  return result;
+}
+
+auto PandasMaskArrayImpl::Concatenate(
+    std::span<const PandasMaskArrayImpl *const> masks) -> PandasMaskArrayImpl {
+  int64_t length = 0;
+  for (const auto *mask : masks) {
+    length += mask->length_;
+  }
+
+  auto result = Allocate(length, 0);
+  uint8_t *data = result.MutableData();
+  if (length > 0) {
+    // the copies leave the padding bits of the final byte untouched
+    data[(length - 1) / 8] = 0;
+  }
+
+  int64_t offset = 0;
+  for (const auto *mask : masks) {
+    mask->CopyInto(data, offset);
+    offset += mask->length_;
+  }
+
+  return result;
+}
+
+auto PandasMaskArrayImpl::FromPacked(const uint8_t *bytes, int64_t length)
+    -> PandasMaskArrayImpl {
+  auto result = Allocate(length, 0);
+  const int64_t nbytes = _ArrowBytesForBits(length);
+  if (nbytes > 0) {
+    uint8_t *data = result.MutableData();
+    memcpy(data, bytes, nbytes);
+    data[nbytes - 1] &= static_cast<uint8_t>(LowBits((length - 1) % 8 + 1));
+  }
+  return result;
+}
+
 auto PandasMaskArrayImpl::Length() const noexcept -> ssize_t {
-  return bitmap_->size_bits;
+  return length_;
+}
+
+auto PandasMaskArrayImpl::Offset() const noexcept -> int64_t {
+  return offset_;
+}
+
+auto PandasMaskArrayImpl::Data() const -> const uint8_t * {
+  if (runs_ != nullptr) {
+    std::call_once(runs_->decode_once, [this] {
+      auto decoded = Allocate(length_, 0);
+      uint8_t *data = decoded.MutableData();
+      if (length_ > 0) {
+        data[(length_ - 1) / 8] = 0;
+      }
+      CopyInto(data, 0);
+      runs_->decoded = std::move(decoded.bitmap_);
+      runs_->is_decoded.store(true, std::memory_order_release);
+    });
+    return (*runs_->decoded)->buffer.data;
+  }
+
+  return (*bitmap_)->buffer.data;
 }
+
+auto PandasMaskArrayImpl::MutableData() -> uint8_t * {
+  // callers that can update the count restore it after writing
+  count_.Store(-1);
+  rank_.reset();
+  if (runs_ != nullptr) {
+    *this = Decompress();
+  }
+  if (bitmap_.use_count() > 1 || readonly_) {
+    *this = Materialize();
+  }
+
+  return (*bitmap_)->buffer.data;
+}
+
 auto PandasMaskArrayImpl::GetItem(ssize_t index) const -> bool {
   if (index < 0) {
-    index += bitmap_->size_bits;
+    index += length_;
     if (index < 0) {
       throw std::out_of_range("index out of range");
     }
   }
-  if (index >= bitmap_->size_bits) {
+  if (index >= length_) {
     throw std::out_of_range("index out of range");
   }
 
-  return ArrowBitGet(bitmap_->buffer.data, index);
+  if (runs_ != nullptr) {
+    const auto run = FindRun(runs_->runs, index);
+    return run != runs_->runs.end() && run->start <= index;
+  }
+  return ArrowBitGet(Data(), offset_ + index);
 }
 
-auto PandasMaskArrayImpl::GetItem(std::vector<ssize_t> values) const
+auto PandasMaskArrayImpl::GetItem(const std::vector<ssize_t> &values) const
     -> PandasMaskArrayImpl {
-  nanoarrow::UniqueBitmap new_bitmap;
-  ArrowBitmapInit(new_bitmap.get());
-  ArrowBitmapReserve(new_bitmap.get(), values.size());
+  static_assert(sizeof(ssize_t) == sizeof(int64_t));
+  return Take(reinterpret_cast<const int64_t *>(values.data()),
+              static_cast<int64_t>(values.size()));
+}
+
+auto PandasMaskArrayImpl::Take(const int64_t *indices, int64_t n,
+                               bool allow_fill, bool fill_value) const
+    -> PandasMaskArrayImpl {
+  const auto &kernels = pandas_mask::kernels::ActiveKernels();
+  auto result = Allocate(n, 0);
+  if (n == 0) {
+    return result;
+  }
+
+  int64_t min;
+  int64_t max;
+  kernels.min_max(indices, n, &min, &max);
+  if (max >= length_) {
+    throw std::out_of_range("index out of range");
+  }
+  if (allow_fill) {
+    if (min < -1) {
+      throw std::invalid_argument(
+          "indices must be -1 or greater when allow_fill is set");
+    }
+  } else if (min < -length_) {
+    throw std::out_of_range("index out of range");
+  }
+
+  // the kernel reads negative indices as missing, so wrap them first
+  std::vector<int64_t> wrapped;
+  if (min < 0 && !allow_fill) {
+    wrapped.assign(indices, indices + n);
+    for (auto &index : wrapped) {
+      if (index < 0) {
+        index += length_;
+      }
+    }
+    indices = wrapped.data();
+  }
 
-  for (const auto idx : values) {
-    const auto bit = GetItem(idx);
-    ArrowBitmapAppendUnsafe(new_bitmap.get(), bit, 1);
+  uint8_t *out = result.MutableData();
+  kernels.take(Data(), offset_, length_, indices, n, out);
+  if (allow_fill && fill_value && min < 0) {
+    for (int64_t i = 0; i < n; i++) {
+      if (indices[i] < 0) {
+        ArrowBitSet(out, i);
+      }
+    }
   }
 
-  return PandasMaskArrayImpl(std::move(new_bitmap));
+  return result;
+}
+
+auto PandasMaskArrayImpl::Filter(const PandasMaskArrayImpl &selector) const
+    -> PandasMaskArrayImpl {
+  if (length_ != selector.length_) {
+    throw std::invalid_argument(
+        "Shape of selector does not match bitmask shape");
+  }
+
+  auto result = Allocate(selector.Sum(), 0);
+  pandas_mask::kernels::ActiveKernels().filter(
+      Data(), offset_, selector.Data(), selector.offset_, length_,
+      result.MutableData());
+
+  return result;
+}
+
+auto PandasMaskArrayImpl::Slice(int64_t start, int64_t length) const
+    -> PandasMaskArrayImpl {
+  if (start < 0 || length < 0 || start + length > length_) {
+    throw std::out_of_range("slice out of range");
+  }
+
+  if (runs_ != nullptr && length != length_) {
+    std::vector<Run> runs;
+    ForEachRunIn(runs_->runs, start, start + length,
+                 [&](int64_t first, int64_t last) {
+                   runs.push_back({first - start, last - start});
+                 });
+    return FromRuns(std::move(runs), length);
+  }
+
+  PandasMaskArrayImpl result = *this;
+  result.offset_ = offset_ + start;
+  result.length_ = length;
+  if (length != length_) {
+    result.count_ = CachedCount();
+    result.rank_.reset();
+  }
+  return result;
+}
+
+auto PandasMaskArrayImpl::UnpackInto(uint8_t *dst, int64_t offset,
+                                     int64_t length) const -> void {
+  if (offset < 0 || length < 0 || offset + length > length_) {
+    throw std::out_of_range("unpack range out of bounds");
+  }
+
+  if (runs_ != nullptr) {
+    std::fill_n(dst, length, 0);
+    ForEachRunIn(runs_->runs, offset, offset + length,
+                 [&](int64_t first, int64_t last) {
+                   std::fill_n(&dst[first - offset], last - first, 1);
+                 });
+    return;
+  }
+
+  // the kernels start on a byte boundary, so each chunk peels off any
+  // leading bits; chunks are aligned to dst, which has a byte per bit
+  const uint8_t *bits = Data();
+  offset += offset_;
+  pandas_mask::parallel::ForEachChunk(
+      dst, length, [&](int64_t begin, int64_t end) {
+        int64_t i = begin;
+        for (; i < end && (offset + i) % 8 != 0; i++) {
+          dst[i] = ArrowBitGet(bits, offset + i);
+        }
+        pandas_mask::kernels::ActiveKernels().unpack(&bits[(offset + i) / 8],
+                                                     &dst[i], end - i);
+      });
+}
+
+auto PandasMaskArrayImpl::CopyInto(uint8_t *dst, int64_t dst_offset) const
+    noexcept -> void {
+  if (runs_ != nullptr) {
+    ArrowBitsSetTo(dst, dst_offset, length_, 0);
+    for (const auto &run : runs_->runs) {
+      ArrowBitsSetTo(dst, dst_offset + run.start, run.end - run.start, 1);
+    }
+    return;
+  }
+  pandas_mask::kernels::CopyBits(Data(), offset_, dst, dst_offset, length_);
 }
 
 auto PandasMaskArrayImpl::SetItem(ssize_t index, bool value) -> void {
   if (index < 0) {
-    index += bitmap_->size_bits;
+    index += length_;
     if (index < 0) {
       throw std::out_of_range("index out of range");
     }
   }
-  if (index >= bitmap_->size_bits) {
+  if (index >= length_) {
     throw std::out_of_range("index out of range");
   }
 
-  ArrowBitSetTo(bitmap_->buffer.data, index, value);
+  // detaching may move offset_, so it must happen before offset_ is read
+  const int64_t count = count_.Load();
+  uint8_t *data = MutableData();
+  const bool old = ArrowBitGet(data, offset_ + index);
+  ArrowBitSetTo(data, offset_ + index, value);
+  if (count >= 0) {
+    count_.Store(count + value - old);
+  }
 }
 
-auto PandasMaskArrayImpl::Invert() const noexcept -> PandasMaskArrayImpl {
-  nanoarrow::UniqueBitmap new_bitmap;
-  const size_t nbits = bitmap_->size_bits;
+auto PandasMaskArrayImpl::SetRange(int64_t start, int64_t length, bool value)
+    -> void {
+  if (start < 0 || length < 0 || start + length > length_) {
+    throw std::out_of_range("range out of bounds");
+  }
 
-  ArrowBitmapInit(new_bitmap.get());
-  ArrowBitmapReserve(new_bitmap.get(), nbits);
+  const int64_t count = count_.Load();
+  uint8_t *data = MutableData();
+  // recounting just the range is cheaper than recounting the whole mask
+  const int64_t old =
+      count >= 0 ? ArrowBitCountSet(data, offset_ + start, length) : 0;
+  ArrowBitsSetTo(data, offset_ + start, length, value);
+  if (count >= 0) {
+    count_.Store(count - old + (value ? length : 0));
+  }
+}
+
+auto PandasMaskArrayImpl::SetStrided(int64_t start, int64_t step,
+                                     int64_t length, bool value) -> void {
+  if (step == 1) {
+    return SetRange(start, length, value);
+  }
+
+  const int64_t last = start + (length - 1) * step;
+  if (length > 0 && (std::min(start, last) < 0 || std::max(start, last) >=
+                                                       length_)) {
+    throw std::out_of_range("range out of bounds");
+  }
 
-  const int64_t size_bytes = bitmap_->buffer.size_bytes;
-  const int64_t overflow_limit = INT64_MAX - sizeof(int64_t);
-  const int64_t limit =
-      size_bytes > overflow_limit ? overflow_limit : size_bytes;
+  uint8_t *data = MutableData();
+  for (int64_t i = 0; i < length; i++) {
+    ArrowBitSetTo(data, offset_ + start + i * step, value);
+  }
+}
 
+auto PandasMaskArrayImpl::SetStrided(int64_t start, int64_t step,
+                                     const PandasMaskArrayImpl &values)
+    -> void {
+  if (step == 1) {
+    return SetSlice(start, values);
+  }
+  // writing could overwrite elements of values before they are read
+  if (&values == this) {
+    return SetStrided(start, step, values.Materialize());
+  }
+
+  const int64_t length = values.length_;
+  const int64_t last = start + (length - 1) * step;
+  if (length > 0 && (std::min(start, last) < 0 || std::max(start, last) >=
+                                                       length_)) {
+    throw std::out_of_range("range out of bounds");
+  }
+
+  uint8_t *data = MutableData();
   int64_t i = 0;
-  for (; i + static_cast<int64_t>(sizeof(int64_t)) - 1 < limit;
-       i += sizeof(int64_t)) {
-    uint64_t value;
-    memcpy(&value, &bitmap_->buffer.data[i], sizeof(uint64_t));
-    value = ~value;
-    memcpy(&new_bitmap->buffer.data[i], &value, sizeof(uint64_t));
+  for (const bool value : values) {
+    ArrowBitSetTo(data, offset_ + start + i * step, value);
+    i++;
   }
+}
 
-  for (; i < bitmap_->buffer.size_bytes; i++) {
-    new_bitmap->buffer.data[i] = ~bitmap_->buffer.data[i];
+auto PandasMaskArrayImpl::SetSlice(int64_t start,
+                                   const PandasMaskArrayImpl &values) -> void {
+  if (start < 0 || start + values.length_ > length_) {
+    throw std::out_of_range("range out of bounds");
+  }
+  if (&values == this) {
+    return;
   }
 
-  new_bitmap->buffer.size_bytes = bitmap_->buffer.size_bytes;
-  new_bitmap->size_bits = nbits;
-  return PandasMaskArrayImpl(std::move(new_bitmap));
+  uint8_t *data = MutableData();
+  values.CopyInto(data, offset_ + start);
+}
+
+auto PandasMaskArrayImpl::Blend(const PandasMaskArrayImpl &selector,
+                                const PandasMaskArrayImpl &values) -> void {
+  if (length_ != selector.length_ || length_ != values.length_) {
+    throw std::invalid_argument(
+        "Shape of selector and values must match bitmask shape");
+  }
+
+  uint8_t *dst = MutableData();
+
+  // as with the binary kernels, every operand must share a sub-byte offset
+  const int64_t shift = offset_ % 8;
+  if (selector.offset_ % 8 != shift) {
+    auto aligned = Allocate(length_, shift);
+    selector.CopyInto(aligned.MutableData(), shift);
+    return Blend(aligned, values);
+  }
+  if (values.offset_ % 8 != shift) {
+    auto aligned = Allocate(length_, shift);
+    values.CopyInto(aligned.MutableData(), shift);
+    return Blend(selector, aligned);
+  }
+
+  WithPreservedEdges(dst, offset_, length_, [&] {
+    pandas_mask::kernels::ActiveKernels().blend(
+        &selector.Data()[selector.offset_ / 8],
+        &values.Data()[values.offset_ / 8], &dst[offset_ / 8],
+        shift + length_);
+  });
+}
+
+auto PandasMaskArrayImpl::Scatter(const PandasMaskArrayImpl &selector,
+                                  const PandasMaskArrayImpl &values) -> void {
+  if (length_ != selector.length_) {
+    throw std::invalid_argument(
+        "Shape of selector does not match bitmask shape");
+  }
+  if (values.length_ != selector.Sum()) {
+    throw std::invalid_argument(
+        "values must have one element per selected position");
+  }
+  if (&values == this) {
+    return Scatter(selector, values.Materialize());
+  }
+
+  uint8_t *data = MutableData();
+  auto value = values.begin();
+  for (const auto pos : selector.SetBits()) {
+    ArrowBitSetTo(data, offset_ + pos, *value);
+    ++value;
+  }
+}
+
+auto PandasMaskArrayImpl::Invert() const -> PandasMaskArrayImpl {
+  if (runs_ != nullptr) {
+    // true only where this mask, passed as both operands, is false
+    return MergeRuns(*this, 0b0001);
+  }
+
+  // keep the sub-byte offset so the kernel can work on whole bytes
+  auto result = Allocate(length_, offset_ % 8);
+  InvertInto(result);
+
+  return result;
+}
+
+auto PandasMaskArrayImpl::InvertInto(PandasMaskArrayImpl &out) const -> void {
+  if (length_ != out.length_) {
+    throw std::invalid_argument("Shape of out does not match bitmask shape");
+  }
+  if (runs_ != nullptr && out.runs_ != nullptr) {
+    out = Invert();
+    return;
+  }
+
+  // detaching may move out.offset_, so it must happen before that is read
+  uint8_t *dst = out.MutableData();
+  const int64_t shift = out.offset_ % 8;
+  if (offset_ % 8 != shift) {
+    auto aligned = Allocate(length_, shift);
+    CopyInto(aligned.MutableData(), shift);
+    return aligned.InvertInto(out);
+  }
+
+  const uint8_t *src = &Data()[offset_ / 8];
+  uint8_t *out_bytes = &dst[out.offset_ / 8];
+  WithPreservedEdges(dst, out.offset_, length_, [&] {
+    ForEachByteChunk(out_bytes, shift + length_,
+                     [&](int64_t begin, int64_t nbits) {
+                       pandas_mask::kernels::ActiveKernels().invert(
+                           &src[begin], &out_bytes[begin], nbits);
+                     });
+  });
 }
 
-auto PandasMaskArrayImpl::Size() const noexcept -> ssize_t {
-  return bitmap_->size_bits;
+auto PandasMaskArrayImpl::InvertInPlace() -> void {
+  const int64_t count = count_.Load();
+  InvertInto(*this);
+  if (count >= 0) {
+    count_.Store(length_ - count);
+  }
 }
 
+auto PandasMaskArrayImpl::BinaryKernel(const PandasMaskArrayImpl &other,
+                                       BinaryKernelFn kernel,
+                                       PandasMaskArrayImpl &out) const
+    -> void {
+  uint8_t *dst = out.MutableData();
+
+  // the byte kernels need every operand to share a sub-byte offset; shift a
+  // copy of any input that does not into line with out first
+  const int64_t shift = out.offset_ % 8;
+  if (offset_ % 8 != shift) {
+    auto aligned = Allocate(length_, shift);
+    CopyInto(aligned.MutableData(), shift);
+    return aligned.BinaryKernel(other, kernel, out);
+  }
+  if (other.offset_ % 8 != shift) {
+    auto aligned = Allocate(length_, shift);
+    other.CopyInto(aligned.MutableData(), shift);
+    return BinaryKernel(aligned, kernel, out);
+  }
+
+  const uint8_t *lhs = &Data()[offset_ / 8];
+  const uint8_t *rhs = &other.Data()[other.offset_ / 8];
+  uint8_t *out_bytes = &dst[out.offset_ / 8];
+  WithPreservedEdges(dst, out.offset_, length_, [&] {
+    ForEachByteChunk(out_bytes, shift + length_,
+                     [&](int64_t begin, int64_t nbits) {
+                       kernel(&lhs[begin], &rhs[begin], &out_bytes[begin],
+                              nbits);
+                     });
+  });
+}
+
+auto PandasMaskArrayImpl::Size() const noexcept -> ssize_t { return length_; }
+
 auto PandasMaskArrayImpl::NBytes() const noexcept -> ssize_t {
-  return bitmap_->buffer.size_bytes;
+  return _ArrowBytesForBits(length_);
+}
+
+auto PandasMaskArrayImpl::StorageBytes() const noexcept -> ssize_t {
+  if (runs_ != nullptr) {
+    const auto runs = static_cast<ssize_t>(runs_->runs.size() * sizeof(Run));
+    return runs_->is_decoded.load(std::memory_order_acquire) ? runs + NBytes()
+                                                             : runs;
+  }
+  return NBytes();
+}
+
+auto PandasMaskArrayImpl::IsPacked() const -> bool {
+  if (length_ == 0) {
+    return true;
+  }
+  if (offset_ % 8 != 0) {
+    return false;
+  }
+  const int64_t padding = (8 - length_ % 8) % 8;
+  return padding == 0 || LoadBits(Data(), offset_ + length_, padding) == 0;
+}
+
+auto PandasMaskArrayImpl::Packed() const -> PandasMaskArrayImpl {
+  if (IsPacked()) {
+    return *this;
+  }
+
+  auto result = Allocate(length_, 0);
+  uint8_t *data = result.MutableData();
+  data[(length_ - 1) / 8] = 0;
+  CopyInto(data, 0);
+  return result;
 }
 
 auto PandasMaskArrayImpl::Any() const noexcept -> bool {
-  const int64_t nbits = bitmap_->size_bits;
-  if (nbits < 1) {
+  if (const int64_t count = count_.Load(); count >= 0) {
+    return count > 0;
+  }
+  if (runs_ != nullptr) {
+    return !runs_->runs.empty();
+  }
+
+  // test bits up to the first byte boundary, then hand whole bytes to the
+  // kernel
+  const int64_t head = std::min(length_, (8 - offset_ % 8) % 8);
+  if (LoadBits(Data(), offset_, head) != 0) {
+    return true;
+  }
+
+  return pandas_mask::kernels::ActiveKernels().any(
+      &Data()[(offset_ + head) / 8], length_ - head);
+}
+
+auto PandasMaskArrayImpl::All() const noexcept -> bool {
+  if (const int64_t count = count_.Load(); count >= 0) {
+    return count == length_;
+  }
+  if (runs_ != nullptr) {
+    const auto &runs = runs_->runs;
+    return length_ == 0 ||
+           (runs.size() == 1 && runs[0].end - runs[0].start == length_);
+  }
+
+  const int64_t head = std::min(length_, (8 - offset_ % 8) % 8);
+  if (LoadBits(Data(), offset_, head) != LowBits(head)) {
     return false;
   }
 
-  const int64_t size_bytes = bitmap_->buffer.size_bytes;
-  const int64_t overflow_limit = INT64_MAX - sizeof(int64_t);
-  const int64_t limit =
-      size_bytes > overflow_limit ? overflow_limit : size_bytes;
-  int64_t i = 0;
-  for (; i + static_cast<int64_t>(sizeof(int64_t)) - 1 < limit;
-       i += sizeof(int64_t)) {
-    uint64_t value;
-    memcpy(&value, &bitmap_->buffer.data[i], sizeof(uint64_t));
-    if (value != 0x0) {
-      return true;
-    }
+  return pandas_mask::kernels::ActiveKernels().all(
+      &Data()[(offset_ + head) / 8], length_ - head);
+}
+
+auto PandasMaskArrayImpl::Sum() const noexcept -> ssize_t {
+  if (const int64_t count = count_.Load(); count >= 0) {
+    return static_cast<ssize_t>(count);
   }
 
-  for (; i < bitmap_->buffer.size_bytes - 1; i++) {
-    if (bitmap_->buffer.data[i] != 0x0) {
-      return true;
+  if (runs_ != nullptr) {
+    int64_t count = 0;
+    for (const auto &run : runs_->runs) {
+      count += run.end - run.start;
     }
+    count_.Store(count);
+    return static_cast<ssize_t>(count);
+  }
+
+  // chunks are whole bytes of the buffer, trimmed to the mask's bits
+  const uint8_t *bits = &Data()[offset_ / 8];
+  const int64_t shift = offset_ % 8;
+  std::atomic<int64_t> count{0};
+  pandas_mask::parallel::ForEachChunk(
+      bits, _ArrowBytesForBits(shift + length_),
+      [&](int64_t begin, int64_t end) {
+        const int64_t first = std::max(begin * 8, shift);
+        const int64_t last = std::min(end * 8, shift + length_);
+        count += ArrowBitCountSet(bits, first, last - first);
+      });
+  count_.Store(count.load());
+  return static_cast<ssize_t>(count.load());
+}
+
+auto PandasMaskArrayImpl::Rank(int64_t i) const -> int64_t {
+  if (i < 0 || i > length_) {
+    throw std::out_of_range("rank out of range");
   }
 
-  const int64_t bits_remaining = nbits - ((size_bytes - 1) * 8);
-  for (int64_t i = 0; i < bits_remaining; i++) {
-    if (ArrowBitGet(bitmap_->buffer.data, nbits - i - 1) == 1) {
-      return true;
+  if (runs_ != nullptr) {
+    const auto &runs = runs_->runs;
+    const auto run = FindRun(runs, i);
+    int64_t count = 0;
+    if (rank_ != nullptr) {
+      count = rank_->counts[run - runs.begin()];
+    } else {
+      for (auto before = runs.begin(); before != run; ++before) {
+        count += before->end - before->start;
+      }
     }
+    if (run != runs.end() && run->start < i) {
+      count += i - run->start;
+    }
+    return count;
   }
 
-  return false;
+  if (rank_ == nullptr) {
+    return ArrowBitCountSet(Data(), offset_, i);
+  }
+  const int64_t block = i / kRankBlockBits;
+  int64_t count = rank_->counts[block];
+  for (int64_t pos = block * kRankBlockBits; pos < i; pos += 64) {
+    const int64_t nbits = std::min<int64_t>(64, i - pos);
+    count += std::popcount(LoadBits(Data(), offset_ + pos, nbits));
+  }
+  return count;
 }
 
-auto PandasMaskArrayImpl::All() const noexcept -> bool {
-  const int64_t nbits = bitmap_->size_bits;
-  if (nbits < 1) {
-    return true;
+auto PandasMaskArrayImpl::Select(int64_t k) const -> int64_t {
+  if (k < 0 || k >= Sum()) {
+    throw std::out_of_range("select out of range");
   }
 
-  const int64_t size_bytes = bitmap_->buffer.size_bytes;
-  const int64_t overflow_limit = INT64_MAX - sizeof(int64_t);
-  const int64_t limit =
-      size_bytes > overflow_limit ? overflow_limit : size_bytes;
-  int64_t i = 0;
-  for (; i + static_cast<int64_t>(sizeof(int64_t)) - 1 < limit;
-       i += sizeof(int64_t)) {
-    uint64_t value;
-    memcpy(&value, &bitmap_->buffer.data[i], sizeof(uint64_t));
-    if (value != UINT64_MAX) {
-      return false;
+  if (runs_ != nullptr) {
+    const auto &runs = runs_->runs;
+    if (rank_ != nullptr) {
+      const auto &counts = rank_->counts;
+      const auto run =
+          std::upper_bound(counts.begin(), counts.end(), k) - counts.begin();
+      return runs[run - 1].start + k - counts[run - 1];
+    }
+    for (const auto &run : runs) {
+      if (k < run.end - run.start) {
+        return run.start + k;
+      }
+      k -= run.end - run.start;
     }
   }
 
-  for (; i < bitmap_->buffer.size_bytes - 1; i++) {
-    if (bitmap_->buffer.data[i] != 0xff) {
-      return false;
+  // the samples bound the blocks that can hold the element, and the counts
+  // pick out the one that does
+  int64_t pos = 0;
+  if (rank_ != nullptr) {
+    const auto &counts = rank_->counts;
+    const auto &samples = rank_->samples;
+    const auto j = static_cast<size_t>(k / kSelectSample);
+    const auto first = counts.begin() + samples[j];
+    const auto last = j + 1 < samples.size()
+                          ? counts.begin() + samples[j + 1] + 1
+                          : counts.end();
+    const auto block = std::upper_bound(first, last, k) - counts.begin() - 1;
+    pos = block * kRankBlockBits;
+    k -= counts[block];
+  }
+
+  for (;; pos += 64) {
+    const int64_t nbits = std::min<int64_t>(64, length_ - pos);
+    const uint64_t word = LoadBits(Data(), offset_ + pos, nbits);
+    const int64_t count = std::popcount(word);
+    if (k < count) {
+      return pos + SelectInWord(word, k);
     }
+    k -= count;
   }
+}
 
-  const size_t bits_remaining = nbits - ((size_bytes - 1) * 8);
-  for (size_t i = 0; i < bits_remaining; i++) {
-    if (ArrowBitGet(bitmap_->buffer.data, nbits - i - 1) == 0) {
-      return false;
+auto PandasMaskArrayImpl::BuildRankIndex() -> void {
+  auto index = std::make_shared<RankIndex>();
+  int64_t count = 0;
+
+  if (runs_ != nullptr) {
+    index->counts.reserve(runs_->runs.size() + 1);
+    for (const auto &run : runs_->runs) {
+      index->counts.push_back(count);
+      count += run.end - run.start;
+    }
+  } else {
+    const int64_t nblocks = (length_ + kRankBlockBits - 1) / kRankBlockBits;
+    index->counts.reserve(nblocks + 1);
+    int64_t next_sample = 0;
+    for (int64_t block = 0; block < nblocks; block++) {
+      index->counts.push_back(count);
+      const int64_t end = std::min(length_, (block + 1) * kRankBlockBits);
+      for (int64_t pos = block * kRankBlockBits; pos < end; pos += 64) {
+        const int64_t nbits = std::min<int64_t>(64, end - pos);
+        count += std::popcount(LoadBits(Data(), offset_ + pos, nbits));
+      }
+      for (; next_sample < count; next_sample += kSelectSample) {
+        index->samples.push_back(block);
+      }
     }
   }
 
-  return true;
+  index->counts.push_back(count);
+  count_.Store(count);
+  rank_ = std::move(index);
 }
 
-auto PandasMaskArrayImpl::Sum() const noexcept -> ssize_t {
-  return static_cast<ssize_t>(
-      ArrowBitCountSet(bitmap_->buffer.data, 0, bitmap_->size_bits));
+auto PandasMaskArrayImpl::HasRankIndex() const noexcept -> bool {
+  return rank_ != nullptr;
+}
+
+auto PandasMaskArrayImpl::ShareCaches(const PandasMaskArrayImpl &other) noexcept
+    -> void {
+  if (!SharesBuffer(other) || offset_ != other.offset_ ||
+      length_ != other.length_) {
+    return;
+  }
+
+  if (count_.Load() < 0) {
+    count_.Store(other.count_.Load());
+  }
+  if (rank_ == nullptr) {
+    rank_ = other.rank_;
+  }
+}
+
+auto PandasMaskArrayImpl::CountAnd(const PandasMaskArrayImpl &other) const
+    -> ssize_t {
+  return BinaryCount(other, std::bit_and<>());
+}
+
+auto PandasMaskArrayImpl::CountAndNot(const PandasMaskArrayImpl &other) const
+    -> ssize_t {
+  return BinaryCount(other, BitAndNot());
+}
+
+auto PandasMaskArrayImpl::AnyAnd(const PandasMaskArrayImpl &other) const
+    -> bool {
+  return BinaryAny(other, std::bit_and<>());
 }
 
 auto PandasMaskArrayImpl::Copy() const noexcept -> PandasMaskArrayImpl {
-  nanoarrow::UniqueBitmap new_bitmap;
-  const size_t nbits = bitmap_->size_bits;
+  return *this;
+}
 
-  ArrowBitmapInit(new_bitmap.get());
-  ArrowBitmapReserve(new_bitmap.get(), nbits);
-  memcpy(new_bitmap->buffer.data, bitmap_->buffer.data,
-         bitmap_->buffer.size_bytes);
+auto PandasMaskArrayImpl::SharesBuffer(const PandasMaskArrayImpl &other) const
+    noexcept -> bool {
+  return bitmap_ == other.bitmap_ && runs_ == other.runs_;
+}
 
-  new_bitmap->buffer.size_bytes = bitmap_->buffer.size_bytes;
-  new_bitmap->size_bits = nbits;
-  return PandasMaskArrayImpl(std::move(new_bitmap));
+auto PandasMaskArrayImpl::Detach() -> void { MutableData(); }
+
+auto PandasMaskArrayImpl::Compress() const -> PandasMaskArrayImpl {
+  if (runs_ != nullptr) {
+    return *this;
+  }
+  return FromRuns(*EncodeRuns(SIZE_MAX), length_);
 }
 
-auto PandasMaskArrayImpl::ArgMin() const -> size_t {
-  if (Length() == 0) {
-    throw std::length_error("attempt to get argmax of an empty sequence");
+auto PandasMaskArrayImpl::CompressIfSmaller() const -> PandasMaskArrayImpl {
+  if (runs_ != nullptr || NBytes() < kMinCompressBytes) {
+    return *this;
   }
 
-  for (std::size_t i = 0; const auto val : *this) {
-    if (val == false) {
-      return i;
+  const auto max_runs = static_cast<size_t>(NBytes() / 8) / sizeof(Run);
+  auto runs = EncodeRuns(max_runs);
+  return runs ? FromRuns(std::move(*runs), length_) : *this;
+}
+
+auto PandasMaskArrayImpl::Decompress() const -> PandasMaskArrayImpl {
+  if (runs_ == nullptr) {
+    return *this;
+  }
+
+  // shares the bitmap decoded for the runs, so a write copies it first
+  Data();
+  PandasMaskArrayImpl result;
+  result.bitmap_ = runs_->decoded;
+  result.length_ = length_;
+  return result;
+}
+
+auto PandasMaskArrayImpl::IsCompressed() const noexcept -> bool {
+  return runs_ != nullptr;
+}
+
+auto PandasMaskArrayImpl::EncodeRuns(size_t max_runs) const
+    -> std::optional<std::vector<Run>> {
+  std::vector<Run> runs;
+  bool in_run = false;
+  int64_t run_start = 0;
+
+  for (int64_t i = 0; i < length_; i += 64) {
+    const int64_t nbits = std::min<int64_t>(64, length_ - i);
+    const uint64_t word = LoadBits(Data(), offset_ + i, nbits);
+    // a word without a change of value is skipped whole
+    if (word == (in_run ? LowBits(nbits) : 0)) {
+      continue;
     }
-    i++;
+
+    // alternately find the next set bit, which starts a run, and the next
+    // unset bit, which ends it
+    for (int64_t bit = 0; bit < nbits;) {
+      const uint64_t ahead = ~LowBits(bit) & LowBits(nbits);
+      const uint64_t wanted = (in_run ? ~word : word) & ahead;
+      if (wanted == 0) {
+        break;
+      }
+      bit = std::countr_zero(wanted);
+      if (in_run) {
+        if (runs.size() == max_runs) {
+          return std::nullopt;
+        }
+        runs.push_back({run_start, i + bit});
+      } else {
+        run_start = i + bit;
+      }
+      in_run = !in_run;
+    }
+  }
+
+  if (in_run) {
+    if (runs.size() == max_runs) {
+      return std::nullopt;
+    }
+    runs.push_back({run_start, length_});
+  }
+  return runs;
+}
+
+auto PandasMaskArrayImpl::FromRuns(std::vector<Run> runs, int64_t length)
+    -> PandasMaskArrayImpl {
+  auto storage = std::make_shared<RunStorage>();
+  storage->runs = std::move(runs);
+
+  PandasMaskArrayImpl result;
+  result.bitmap_.reset();
+  result.runs_ = std::move(storage);
+  result.length_ = length;
+  return result;
+}
+
+auto PandasMaskArrayImpl::MergeRuns(const PandasMaskArrayImpl &other,
+                                    unsigned table) const
+    -> PandasMaskArrayImpl {
+  if (length_ != other.length_) {
+    throw std::invalid_argument("Shape of other does not match bitmask shape");
+  }
+
+  // both operands are constant between consecutive run boundaries, so the
+  // result is too; walk the boundaries of both in order
+  const auto &a = runs_->runs;
+  const auto &b = other.runs_->runs;
+  std::vector<Run> runs;
+  size_t i = 0;
+  size_t j = 0;
+  for (int64_t pos = 0; pos < length_;) {
+    // a[i] and b[j] are the first runs ending after pos
+    const bool in_a = i < a.size() && a[i].start <= pos;
+    const bool in_b = j < b.size() && b[j].start <= pos;
+    int64_t next = length_;
+    if (i < a.size()) {
+      next = std::min(next, in_a ? a[i].end : a[i].start);
+    }
+    if (j < b.size()) {
+      next = std::min(next, in_b ? b[j].end : b[j].start);
+    }
+
+    if ((table >> (in_a * 2 + in_b)) & 1) {
+      if (!runs.empty() && runs.back().end == pos) {
+        runs.back().end = next;
+      } else {
+        runs.push_back({pos, next});
+      }
+    }
+
+    pos = next;
+    i += i < a.size() && a[i].end <= pos;
+    j += j < b.size() && b[j].end <= pos;
+  }
+
+  return FromRuns(std::move(runs), length_);
+}
+
+auto PandasMaskArrayImpl::ExportArrowSchema(ArrowSchema *out) -> void {
+  *out = ArrowSchema{};
+  out->format = "b";
+  out->name = "";
+  out->release = &ReleaseExportedSchema;
+}
+
+auto PandasMaskArrayImpl::ExportArrow(ArrowArray *out) const -> void {
+  // consumers may not accept a null data buffer, even for an empty array
+  static const uint8_t kEmpty = 0;
+
+  auto exported = std::make_unique<ExportedArray>(
+      ExportedArray{*this, {nullptr, Data() ? Data() : &kEmpty}});
+  *out = ArrowArray{};
+  out->length = length_;
+  out->offset = offset_;
+  out->n_buffers = 2;
+  out->buffers = exported->buffers;
+  out->release = &ReleaseExportedArray;
+  out->private_data = exported.release();
+}
+
+auto PandasMaskArrayImpl::ImportArrow(ArrowArray *array, int64_t buffer)
+    -> PandasMaskArrayImpl {
+  // take ownership first so the array is released on every error path
+  nanoarrow::UniqueArray owned(array);
+  if (buffer < 0 || buffer >= owned->n_buffers) {
+    throw std::invalid_argument("array has no such buffer");
+  }
+
+  const int64_t length = owned->length;
+  const int64_t offset = owned->offset;
+  const auto *data = static_cast<const uint8_t *>(owned->buffers[buffer]);
+  if (data == nullptr) {
+    if (buffer != 0 && length > 0) {
+      throw std::invalid_argument("array buffer is missing");
+    }
+    // no validity bitmap, so every element is valid, or no elements at all
+    auto result = Allocate(length, 0);
+    if (length > 0) {
+      ArrowBitsSetTo(result.MutableData(), 0, length, 1);
+    }
+    return result;
+  }
+
+  // the buffer's deallocator now owns the array
+  auto *adopted = new ArrowArray;
+  owned.move(adopted);
+
+  nanoarrow::UniqueBitmap bitmap;
+  ArrowBitmapInit(bitmap.get());
+  NANOARROW_THROW_NOT_OK(ArrowBufferSetAllocator(
+      &bitmap->buffer,
+      ArrowBufferDeallocator(&ReleaseImportedArray, adopted)));
+  bitmap->buffer.data = const_cast<uint8_t *>(data);
+  bitmap->buffer.size_bytes = _ArrowBytesForBits(offset + length);
+  bitmap->buffer.capacity_bytes = bitmap->buffer.size_bytes;
+  bitmap->size_bits = offset + length;
+
+  PandasMaskArrayImpl result(std::move(bitmap));
+  result.offset_ = offset;
+  result.length_ = length;
+  result.readonly_ = true;
+  return result;
+}
+
+auto PandasMaskArrayImpl::ArrowNullCount(const ArrowArray &array)
+    -> int64_t {
+  if (array.null_count >= 0) {
+    return array.null_count;
+  }
+  if (array.n_buffers == 0 || array.buffers[0] == nullptr) {
+    return 0;
+  }
+  const auto *validity = static_cast<const uint8_t *>(array.buffers[0]);
+  return array.length -
+         ArrowBitCountSet(validity, array.offset, array.length);
+}
+
+auto PandasMaskArrayImpl::Materialize() const -> PandasMaskArrayImpl {
+  // keep the sub-byte offset so the bytes can be copied verbatim
+  const int64_t shift = offset_ % 8;
+  auto result = Allocate(length_, shift);
+  if (length_ > 0) {
+    memcpy(result.MutableData(), &Data()[offset_ / 8],
+           _ArrowBytesForBits(shift + length_));
+  }
+
+  return result;
+}
+
+auto PandasMaskArrayImpl::ArgMin() const -> size_t {
+  if (Length() == 0) {
+    throw std::length_error("attempt to get argmax of an empty sequence");
   }
 
-  return 0;
+  return std::max<int64_t>(0, FindFirst(false));
 }
 
 auto PandasMaskArrayImpl::ArgMax() const -> size_t {
@@ -200,12 +1103,102 @@ auto PandasMaskArrayImpl::ArgMax() const -> size_t {
     throw std::length_error("attempt to get argmin of an empty sequence");
   }
 
-  for (std::size_t i = 0; const auto val : *this) {
-    if (val == true) {
-      return i;
+  return std::max<int64_t>(0, FindFirst(true));
+}
+
+auto PandasMaskArrayImpl::NonZero(int64_t *out) const noexcept -> int64_t {
+  if (runs_ != nullptr) {
+    int64_t count = 0;
+    for (const auto &run : runs_->runs) {
+      for (int64_t pos = run.start; pos < run.end; pos++) {
+        out[count++] = pos;
+      }
+    }
+    return count;
+  }
+
+  // visit bits up to the first byte boundary, then hand whole bytes to the
+  // kernel
+  const int64_t head = std::min(length_, (8 - offset_ % 8) % 8);
+  int64_t count = 0;
+  for (uint64_t word = LoadBits(Data(), offset_, head); word != 0;
+       word &= word - 1) {
+    out[count++] = std::countr_zero(word);
+  }
+
+  return count + pandas_mask::kernels::ActiveKernels().nonzero(
+                     &Data()[(offset_ + head) / 8], length_ - head, head,
+                     &out[count]);
+}
+
+auto PandasMaskArrayImpl::FindFirst(bool value, int64_t start) const
+    -> int64_t {
+  if (start < 0 || start > length_) {
+    throw std::out_of_range("start out of range");
+  }
+
+  if (runs_ != nullptr) {
+    const auto run = FindRun(runs_->runs, start);
+    const bool found_run = run != runs_->runs.end();
+    int64_t pos;
+    if (value) {
+      pos = found_run ? std::max(run->start, start) : length_;
+    } else {
+      // runs never touch, so the end of a run is always unset
+      pos = found_run && run->start <= start ? run->end : start;
+    }
+    return pos < length_ ? pos : -1;
+  }
+
+  // searching for false is a search for set bits in the inverted words
+  const uint64_t flip = value ? 0 : UINT64_MAX;
+  for (int64_t i = start; i < length_; i += 64) {
+    const int64_t nbits = std::min<int64_t>(64, length_ - i);
+    const uint64_t word =
+        (LoadBits(Data(), offset_ + i, nbits) ^ flip) & LowBits(nbits);
+    if (word != 0) {
+      return i + std::countr_zero(word);
+    }
+  }
+
+  return -1;
+}
+
+auto PandasMaskArrayImpl::FindLast(bool value) const -> int64_t {
+  return FindLast(value, length_);
+}
+
+auto PandasMaskArrayImpl::FindLast(bool value, int64_t end) const -> int64_t {
+  if (end < 0 || end > length_) {
+    throw std::out_of_range("end out of range");
+  }
+
+  if (runs_ != nullptr) {
+    if (end == 0) {
+      return -1;
+    }
+    const auto &runs = runs_->runs;
+    const int64_t last = end - 1;
+    const auto run = FindRun(runs, last);
+    const bool inside = run != runs.end() && run->start <= last;
+    if (!value) {
+      return inside ? run->start - 1 : last;
+    }
+    if (inside) {
+      return last;
+    }
+    return run == runs.begin() ? -1 : std::prev(run)->end - 1;
+  }
+
+  const uint64_t flip = value ? 0 : UINT64_MAX;
+  for (int64_t i = end; i > 0; i -= 64) {
+    const int64_t nbits = std::min<int64_t>(64, i);
+    const uint64_t word =
+        (LoadBits(Data(), offset_ + i - nbits, nbits) ^ flip) & LowBits(nbits);
+    if (word != 0) {
+      return i - nbits + 63 - std::countl_zero(word);
     }
-    i++;
   }
 
-  return 0;
+  return -1;
 }
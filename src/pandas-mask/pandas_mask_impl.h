@@ -2,100 +2,619 @@
 /// Nothing in this mmodule may use the Python runtime
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <filesystem>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 
 #include <nanoarrow/nanoarrow.hpp>
 
+#include "pandas_mask_kernels.h"
+
+/// Word-wise a & ~b, for use with the binary operations and reductions
+struct BitAndNot {
+  constexpr auto operator()(uint64_t a, uint64_t b) const noexcept
+      -> uint64_t {
+    return a & ~b;
+  }
+};
+
 class PandasMaskArrayImpl {
 public:
-  // TODO: this should be private
-  nanoarrow::UniqueBitmap bitmap_;
+  /// A maximal run of set elements [start, end) of a compressed mask
+  struct Run {
+    int64_t start;
+    int64_t end;
+  };
 
   PandasMaskArrayImpl();
   explicit PandasMaskArrayImpl(nanoarrow::UniqueBitmap &&bitmap);
+
+  /// Builds a mask from one byte per value, e.g. a NumPy bool array. Any
+  /// non-zero byte is considered true
+  static auto Pack(const uint8_t *values, int64_t length)
+      -> PandasMaskArrayImpl;
+
+  /// Joins masks end to end into a single buffer, allocated once. Masks
+  /// starting on a byte boundary are copied with memcpy; the rest are
+  /// shifted into place a word at a time
+  static auto Concatenate(std::span<const PandasMaskArrayImpl *const> masks)
+      -> PandasMaskArrayImpl;
+
+  /// Builds a mask from the NBytes() bytes of an already packed bitmap, such
+  /// as Packed().Data(). Bits past length in the final byte are ignored
+  static auto FromPacked(const uint8_t *bytes, int64_t length)
+      -> PandasMaskArrayImpl;
+
   auto Length() const noexcept -> ssize_t;
+
+  /// Bit position of the first element within Data(). Like an Arrow validity
+  /// buffer this need not fall on a byte boundary
+  auto Offset() const noexcept -> int64_t;
+
+  /// The bitmap holding this mask. A compressed mask decodes it on the first
+  /// call, which allocates, so prefer operations that work on the runs where
+  /// there is one
+  auto Data() const -> const uint8_t *;
+
   auto GetItem(ssize_t index) const -> bool;
-  auto GetItem(std::vector<ssize_t> index) const -> PandasMaskArrayImpl;
+  auto GetItem(const std::vector<ssize_t> &index) const -> PandasMaskArrayImpl;
+
+  /// Gathers the elements at n indices into a new mask. Negative indices
+  /// count from the end, unless allow_fill is set, in which case -1 marks a
+  /// missing element that is set to fill_value and any other negative index
+  /// is an error. Every index is checked in one pass before any are read
+  auto Take(const int64_t *indices, int64_t n, bool allow_fill = false,
+            bool fill_value = false) const -> PandasMaskArrayImpl;
+
+  /// Elements at the positions set in selector, which must be the same length.
+  /// The result is sized by a popcount of selector so it is allocated once
+  auto Filter(const PandasMaskArrayImpl &selector) const
+      -> PandasMaskArrayImpl;
+
+  /// Zero-copy view of [start, start + length) sharing this mask's buffer.
+  /// A compressed mask instead copies the runs within the slice
+  auto Slice(int64_t start, int64_t length) const -> PandasMaskArrayImpl;
+
+  /// Writes bits [offset, offset + length) to dst as one 0/1 byte per value,
+  /// e.g. into the buffer of a NumPy bool array
+  auto UnpackInto(uint8_t *dst, int64_t offset, int64_t length) const -> void;
+
+  /// Copies every bit of this mask into dst starting at bit dst_offset
+  auto CopyInto(uint8_t *dst, int64_t dst_offset) const noexcept -> void;
 
   auto SetItem(ssize_t index, bool value) -> void;
-  auto Invert() const noexcept -> PandasMaskArrayImpl;
+  auto SetRange(int64_t start, int64_t length, bool value) -> void;
+
+  /// Sets length elements start, start + step, ... to value. step may be
+  /// negative, as in a Python slice
+  auto SetStrided(int64_t start, int64_t step, int64_t length, bool value)
+      -> void;
+
+  /// Copies every element of values to start, start + step, ...
+  auto SetStrided(int64_t start, int64_t step,
+                  const PandasMaskArrayImpl &values) -> void;
+
+  /// Copies values into [start, start + values.Length()) a word at a time
+  auto SetSlice(int64_t start, const PandasMaskArrayImpl &values) -> void;
+
+  /// Replaces the elements set in selector with the corresponding element of
+  /// values, i.e. this = (this & ~selector) | (values & selector). All three
+  /// masks must be the same length
+  auto Blend(const PandasMaskArrayImpl &selector,
+             const PandasMaskArrayImpl &values) -> void;
+
+  /// Assigns consecutive elements of values to the positions set in
+  /// selector, as NumPy does for a[selector] = values. values must hold
+  /// selector.Sum() elements
+  auto Scatter(const PandasMaskArrayImpl &selector,
+               const PandasMaskArrayImpl &values) -> void;
+  auto Invert() const -> PandasMaskArrayImpl;
+
+  /// Writes the inverse of this mask into out, which must be the same length.
+  /// out may be this mask, and its buffer is reused unless it is shared
+  auto InvertInto(PandasMaskArrayImpl &out) const -> void;
+  auto InvertInPlace() -> void;
 
   template <typename OP>
   auto BinaryOp(const PandasMaskArrayImpl &other, OP op) const
       -> PandasMaskArrayImpl {
-    if (bitmap_->size_bits != other.bitmap_->size_bits) {
+    // two compressed masks are combined run by run, never decoded
+    if (IsCompressed() && other.IsCompressed()) {
+      unsigned table = 0;
+      for (unsigned k = 0; k < 4; k++) {
+        const uint64_t a = k & 2 ? UINT64_MAX : 0;
+        const uint64_t b = k & 1 ? UINT64_MAX : 0;
+        table |= static_cast<unsigned>(op(a, b) & 1) << k;
+      }
+      return MergeRuns(other, table);
+    }
+
+    auto result = Allocate(length_, offset_ % 8);
+    BinaryOpInto(other, op, result);
+    return result;
+  }
+
+  /// Writes op(this, other) into out, which must be the same length. out may
+  /// be either operand, and its buffer is reused unless it is shared
+  template <typename OP>
+  auto BinaryOpInto(const PandasMaskArrayImpl &other, OP op,
+                    PandasMaskArrayImpl &out) const -> void {
+    if (length_ != other.length_) {
       throw std::invalid_argument(
           "Shape of other does not match bitmask shape");
     }
-
-    nanoarrow::UniqueBitmap new_bitmap;
-    const size_t nbits = bitmap_->size_bits;
-
-    ArrowBitmapInit(new_bitmap.get());
-    ArrowBitmapReserve(new_bitmap.get(), nbits);
-
-    const size_t size_bytes = bitmap_->buffer.size_bytes;
-    const size_t overflow_limit = SIZE_MAX - sizeof(size_t);
-    const size_t limit =
-        size_bytes > overflow_limit ? overflow_limit : size_bytes;
-
-    int64_t i = 0;
-    for (; i + sizeof(int64_t) - 1 < limit; i += sizeof(int64_t)) {
-      uint64_t value1;
-      uint64_t value2;
-      uint64_t result;
-      memcpy(&value1, &bitmap_->buffer.data[i], sizeof(uint64_t));
-      memcpy(&value2, &other.bitmap_->buffer.data[i], sizeof(uint64_t));
-      result = op(value1, value2);
-      memcpy(&new_bitmap->buffer.data[i], &result, sizeof(uint64_t));
+    if (length_ != out.length_) {
+      throw std::invalid_argument("Shape of out does not match bitmask shape");
     }
 
-    for (; i < bitmap_->buffer.size_bytes; i++) {
-      new_bitmap->buffer.data[i] =
-          op(bitmap_->buffer.data[i], other.bitmap_->buffer.data[i]);
-    }
+    const auto &kernels = pandas_mask::kernels::ActiveKernels();
 
-    new_bitmap->size_bits = bitmap_->size_bits;
-    new_bitmap->buffer.size_bytes = bitmap_->buffer.size_bytes;
+    // the standard bitwise functors map onto the dispatched SIMD kernels; any
+    // other operation falls back to a generic word-at-a-time loop
+    if constexpr (std::is_same_v<OP, std::bit_and<>>) {
+      BinaryKernel(other, kernels.bitwise_and, out);
+    } else if constexpr (std::is_same_v<OP, std::bit_or<>>) {
+      BinaryKernel(other, kernels.bitwise_or, out);
+    } else if constexpr (std::is_same_v<OP, std::bit_xor<>>) {
+      BinaryKernel(other, kernels.bitwise_xor, out);
+    } else {
+      uint8_t *dst = out.MutableData();
 
-    return PandasMaskArrayImpl(std::move(new_bitmap));
+      for (int64_t i = 0; i < length_; i += 64) {
+        const int64_t nbits = std::min<int64_t>(64, length_ - i);
+        const uint64_t value1 =
+            pandas_mask::kernels::LoadBits(Data(), offset_ + i, nbits);
+        const uint64_t value2 = pandas_mask::kernels::LoadBits(
+            other.Data(), other.offset_ + i, nbits);
+        pandas_mask::kernels::StoreBits(dst, out.offset_ + i,
+                                        op(value1, value2), nbits);
+      }
+    }
+  }
+
+  template <typename OP>
+  auto BinaryOpInPlace(const PandasMaskArrayImpl &other, OP op) -> void {
+    if (IsCompressed() && other.IsCompressed()) {
+      *this = BinaryOp(other, op);
+      return;
+    }
+    BinaryOpInto(other, op, *this);
   }
 
   auto Size() const noexcept -> ssize_t;
+
+  /// Packed size of the bits in this mask. This is the same whether or not
+  /// the buffer is shared, so a copy reports what it would own once written
   auto NBytes() const noexcept -> ssize_t;
+
+  /// Memory held by this mask: NBytes() for a bitmap, or the size of its
+  /// runs when compressed, plus NBytes() once Data() has decoded them. Like
+  /// NBytes() this ignores sharing
+  auto StorageBytes() const noexcept -> ssize_t;
+
+  /// Whether the NBytes() bytes from Data() + Offset() / 8 are exactly the
+  /// packed mask: it starts on a byte boundary and any padding bits are zero
+  auto IsPacked() const -> bool;
+
+  /// This mask if IsPacked(), otherwise a copy that is
+  auto Packed() const -> PandasMaskArrayImpl;
+
+  /// Sum() is cached until the mask is next written, and Any() and All() are
+  /// answered from the cached count when there is one. SetItem and SetRange
+  /// keep the count up to date; any other write discards it
   auto Any() const noexcept -> bool;
   auto All() const noexcept -> bool;
   auto Sum() const noexcept -> ssize_t;
 
+  /// Number of set elements before position i, for i in [0, Length()]
+  auto Rank(int64_t i) const -> int64_t;
+
+  /// Position of the set element with k set elements before it, for k in
+  /// [0, Sum())
+  auto Select(int64_t k) const -> int64_t;
+
+  /// Builds a succinct index of the count of set elements before every 512
+  /// bits, or before every run of a compressed mask, plus the block holding
+  /// every 4096th set element. With it Rank reads at most eight words and
+  /// Select searches only between two samples; without it both scan the
+  /// mask. The index is shared by copies and discarded by any write
+  auto BuildRankIndex() -> void;
+  auto HasRankIndex() const noexcept -> bool;
+
+  /// Takes the cached Sum() and rank index of other if it views exactly the
+  /// same bits as this mask, e.g. a Copy() that computed them without the
+  /// GIL
+  auto ShareCaches(const PandasMaskArrayImpl &other) noexcept -> void;
+
+  /// Reductions over op(this, other) computed directly from both buffers,
+  /// without allocating the combined mask. op combines 64-bit words, e.g.
+  /// std::bit_and<>()
+  template <typename OP>
+  auto BinaryCount(const PandasMaskArrayImpl &other, OP op) const -> ssize_t {
+    ssize_t count = 0;
+    ForEachWordPair(other, [&](uint64_t a, uint64_t b, int64_t nbits) {
+      count += std::popcount(op(a, b) & pandas_mask::kernels::LowBits(nbits));
+      return true;
+    });
+    return count;
+  }
+
+  template <typename OP>
+  auto BinaryAny(const PandasMaskArrayImpl &other, OP op) const -> bool {
+    bool any = false;
+    ForEachWordPair(other, [&](uint64_t a, uint64_t b, int64_t nbits) {
+      any = (op(a, b) & pandas_mask::kernels::LowBits(nbits)) != 0;
+      return !any;
+    });
+    return any;
+  }
+
+  template <typename OP>
+  auto BinaryAll(const PandasMaskArrayImpl &other, OP op) const -> bool {
+    bool all = true;
+    ForEachWordPair(other, [&](uint64_t a, uint64_t b, int64_t nbits) {
+      const uint64_t mask = pandas_mask::kernels::LowBits(nbits);
+      all = (op(a, b) & mask) == mask;
+      return all;
+    });
+    return all;
+  }
+
+  /// Number of positions set in both masks, i.e. (this & other).Sum()
+  auto CountAnd(const PandasMaskArrayImpl &other) const -> ssize_t;
+  /// Number of positions set in this mask but not other
+  auto CountAndNot(const PandasMaskArrayImpl &other) const -> ssize_t;
+  /// Whether any position is set in both masks
+  auto AnyAnd(const PandasMaskArrayImpl &other) const -> bool;
+
+  /// O(1) copy that shares this mask's buffer. Either side takes a private
+  /// copy of the bytes it covers the first time it is written to
   auto Copy() const noexcept -> PandasMaskArrayImpl;
+
+  /// Whether both masks currently reference the same underlying buffer
+  auto SharesBuffer(const PandasMaskArrayImpl &other) const noexcept -> bool;
+
+  /// Gives this mask a bitmap of its own now, decompressing it or copying a
+  /// shared buffer, so that the next in-place write reuses that bitmap
+  /// rather than allocating. Discards the cached Sum() and rank index, as
+  /// any write does
+  auto Detach() -> void;
+
+  /// Run-length encoded copy of this mask, which stores only the positions
+  /// where it changes value. Reductions, slicing, indexing, Invert and
+  /// BinaryOp between two compressed masks work on the runs directly; any
+  /// other operation decodes a bitmap once, on first use, and keeps it
+  /// alongside the runs. Writing to a compressed mask decompresses it
+  auto Compress() const -> PandasMaskArrayImpl;
+
+  /// Compress() if the runs take at most an eighth of the packed bitmap,
+  /// as for a mask that is almost all true or all false, otherwise this
+  /// mask. Gives up as soon as the runs outgrow that budget, so a dense,
+  /// irregular mask is rejected after a short prefix
+  auto CompressIfSmaller() const -> PandasMaskArrayImpl;
+
+  /// Bitmap copy of this mask, or this mask if it is not compressed
+  auto Decompress() const -> PandasMaskArrayImpl;
+
+  auto IsCompressed() const noexcept -> bool;
+
+  /// Describes the type written by ExportArrow, a non-nullable boolean
+  static auto ExportArrowSchema(ArrowSchema *out) -> void;
+
+  /// Zero-copy export through the Arrow C data interface. out references
+  /// this mask's buffer, including any bit offset, and keeps it alive until
+  /// it is released; later writes to this mask detach from it first
+  auto ExportArrow(ArrowArray *out) const -> void;
+
+  /// Adopts buffers[buffer] of array without copying, taking ownership of
+  /// array, which is released once no mask references the buffer. Use
+  /// buffer 1 for the values of a boolean array or 0 for the validity
+  /// bitmap of any array; a missing validity bitmap means every element is
+  /// valid, and an empty array need not have a buffer at all. The adopted
+  /// buffer is never written to
+  static auto ImportArrow(ArrowArray *array, int64_t buffer)
+      -> PandasMaskArrayImpl;
+
+  /// Nulls in array. A producer may leave null_count as -1 if it has not
+  /// counted them, in which case the validity bitmap is counted here
+  static auto ArrowNullCount(const ArrowArray &array) -> int64_t;
+
+  /// Maps a file written by ToFile into memory rather than reading it. A
+  /// read-only mapping is copied to the heap the first time the mask is
+  /// written; a copy_on_write mapping is written in place, in pages private
+  /// to this process, and the file itself never changes. Throws
+  /// std::system_error if the file cannot be mapped and std::invalid_argument
+  /// if it is not a mask file. Defined in pandas_mask_file.cc
+  static auto FromFile(const std::filesystem::path &path, bool copy_on_write)
+      -> PandasMaskArrayImpl;
+
+  /// Writes the packed mask after a small header, replacing path atomically
+  /// so that masks already mapped from it are unaffected
+  auto ToFile(const std::filesystem::path &path) const -> void;
+
   auto ArgMin() const -> size_t;
   auto ArgMax() const -> size_t;
 
-  class iterator {
-  public:
-    explicit iterator(const PandasMaskArrayImpl &bmai, int curr_index = 0)
-        : bmai_(bmai), curr_index_(curr_index) {}
+  /// Writes the position of every set element to out in ascending order and
+  /// returns how many were written. out must hold at least Sum() values
+  auto NonZero(int64_t *out) const noexcept -> int64_t;
 
-    iterator &operator++() {
-      ++curr_index_;
-      return *this;
+  /// Position of the first element at or after start that equals value, or
+  /// -1 if there is none
+  auto FindFirst(bool value, int64_t start = 0) const -> int64_t;
+
+  /// Position of the last element before end that equals value, or -1 if
+  /// there is none. end defaults to the length of the mask
+  auto FindLast(bool value) const -> int64_t;
+  auto FindLast(bool value, int64_t end) const -> int64_t;
+
+  /// Iterates over every element, decoding the mask a word at a time rather
+  /// than calling the bounds checked GetItem per bit
+  class iterator;
+
+  auto begin() const -> iterator;
+  auto end() const -> iterator;
+
+  /// Iterates over the positions of the set elements only, so a sparse mask
+  /// costs O(popcount) rather than O(length). A range-for over SetBits()
+  /// visits each position in ascending order
+  class SetBitIterator;
+  struct SetBitRange;
+
+  auto SetBits() const -> SetBitRange;
+
+private:
+  using BinaryKernelFn = void (*)(const uint8_t *, const uint8_t *, uint8_t *,
+                                  int64_t) noexcept;
+
+  /// Uninitialized mask of length bits whose first element sits at bit offset
+  /// of a newly allocated buffer
+  static auto Allocate(int64_t length, int64_t offset) -> PandasMaskArrayImpl;
+
+  auto BinaryKernel(const PandasMaskArrayImpl &other, BinaryKernelFn kernel,
+                    PandasMaskArrayImpl &out) const -> void;
+
+  /// Runs of set elements in this bitmap, or nothing if there would be more
+  /// than max_runs of them
+  auto EncodeRuns(size_t max_runs) const -> std::optional<std::vector<Run>>;
+
+  static auto FromRuns(std::vector<Run> runs, int64_t length)
+      -> PandasMaskArrayImpl;
+
+  /// Combines two compressed masks of the same length. Bit k of table is the
+  /// result where this mask is set if k & 2 and other is set if k & 1
+  auto MergeRuns(const PandasMaskArrayImpl &other, unsigned table) const
+      -> PandasMaskArrayImpl;
+
+  /// Calls func(value1, value2, nbits) with each pair of up to 64 aligned bits
+  /// from this mask and other until it returns false. Bits past nbits in
+  /// either value are zero
+  template <typename F>
+  auto ForEachWordPair(const PandasMaskArrayImpl &other, F &&func) const
+      -> void {
+    if (length_ != other.length_) {
+      throw std::invalid_argument(
+          "Shape of other does not match bitmask shape");
     }
 
-    bool operator==(iterator other) const {
-      return &bmai_ == &other.bmai_ && curr_index_ == other.curr_index_;
+    for (int64_t i = 0; i < length_; i += 64) {
+      const int64_t nbits = std::min<int64_t>(64, length_ - i);
+      const uint64_t value1 =
+          pandas_mask::kernels::LoadBits(Data(), offset_ + i, nbits);
+      const uint64_t value2 = pandas_mask::kernels::LoadBits(
+          other.Data(), other.offset_ + i, nbits);
+      if (!func(value1, value2, nbits)) {
+        return;
+      }
     }
+  }
+
+  /// Buffer that is safe to write through. If another mask shares the buffer
+  /// the bytes backing this mask are first copied into a private buffer
+  auto MutableData() -> uint8_t *;
+
+  /// Private copy of just the bytes backing this mask
+  auto Materialize() const -> PandasMaskArrayImpl;
+
+  // The mask is bits [offset_, offset_ + length_) of a buffer that slices and
+  // copies of it may share until one of them is written to
+  std::shared_ptr<nanoarrow::UniqueBitmap> bitmap_;
+  int64_t offset_ = 0;
+  int64_t length_ = 0;
+  // the buffer was adopted from another library, so writes must detach even
+  // when no other mask shares it
+  bool readonly_ = false;
+
+  /// Storage of a compressed mask. runs are sorted and neither overlap nor
+  /// touch, so every mask has exactly one encoding
+  struct RunStorage {
+    std::vector<Run> runs;
+    // decoded by the first call to Data() and shared by every copy
+    mutable std::once_flag decode_once;
+    mutable std::shared_ptr<nanoarrow::UniqueBitmap> decoded;
+    // set once decoded is, so StorageBytes() can read it without decoding
+    mutable std::atomic<bool> is_decoded{false};
+  };
 
-    bool operator!=(iterator other) const { return !(*this == other); }
+  // set for a compressed mask, which has no bitmap_ and an offset_ of 0
+  std::shared_ptr<const RunStorage> runs_;
 
-    bool operator*() { return bmai_.GetItem(curr_index_); }
+  /// Sum(), or -1 until it is computed. Atomic so that threads reading the
+  /// same mask may each fill it in, but copied like a plain integer
+  class CachedCount {
+  public:
+    CachedCount() = default;
+    CachedCount(const CachedCount &other) noexcept : value_(other.Load()) {}
+    auto operator=(const CachedCount &other) noexcept -> CachedCount & {
+      Store(other.Load());
+      return *this;
+    }
+
+    auto Load() const noexcept -> int64_t {
+      return value_.load(std::memory_order_relaxed);
+    }
+    auto Store(int64_t value) const noexcept -> void {
+      value_.store(value, std::memory_order_relaxed);
+    }
 
   private:
-    const PandasMaskArrayImpl &bmai_;
-    int curr_index_ = 0;
+    mutable std::atomic<int64_t> value_{-1};
+  };
+
+  struct RankIndex {
+    // set elements before each block of bits, or each run, then the total
+    std::vector<int64_t> counts;
+    // for a bitmap, the block holding every kSelectSample-th set element
+    std::vector<int64_t> samples;
   };
 
-  iterator begin() const noexcept { return iterator(*this); }
-  iterator end() const noexcept { return iterator(*this, Length()); }
+  CachedCount count_;
+  std::shared_ptr<const RankIndex> rank_;
 };
+
+// Both iterators hold a Copy() of the mask they walk, which shares its buffer
+// in O(1). One therefore outlives the mask it came from, and later writes to
+// that mask detach from the buffer rather than changing what it reads.
+// Iterators compare by position alone, so only those over the same mask may
+// be compared
+
+class PandasMaskArrayImpl::iterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = bool;
+  using difference_type = ssize_t;
+  using pointer = void;
+  using reference = bool;
+
+  iterator() = default;
+  explicit iterator(const PandasMaskArrayImpl &bmai, ssize_t curr_index = 0)
+      : bmai_(bmai.Copy()), curr_index_(curr_index) {
+    LoadWord();
+  }
+
+  iterator &operator++() {
+    ++curr_index_;
+    if (curr_index_ % 64 == 0) {
+      LoadWord();
+    }
+    return *this;
+  }
+
+  iterator operator++(int) {
+    auto result = *this;
+    ++*this;
+    return result;
+  }
+
+  bool operator==(const iterator &other) const {
+    return curr_index_ == other.curr_index_;
+  }
+
+  bool operator!=(const iterator &other) const { return !(*this == other); }
+
+  bool operator*() const { return (word_ >> (curr_index_ % 64)) & 1; }
+
+private:
+  auto LoadWord() -> void {
+    const ssize_t start = curr_index_ - curr_index_ % 64;
+    word_ = pandas_mask::kernels::LoadBits(
+        bmai_.Data(), bmai_.offset_ + start,
+        std::min<int64_t>(64, bmai_.length_ - start));
+  }
+
+  PandasMaskArrayImpl bmai_;
+  ssize_t curr_index_ = 0;
+  // the 64 elements starting at curr_index_ rounded down to a multiple of 64
+  uint64_t word_ = 0;
+};
+
+inline auto PandasMaskArrayImpl::begin() const -> iterator {
+  return iterator(*this);
+}
+
+inline auto PandasMaskArrayImpl::end() const -> iterator {
+  return iterator(*this, Length());
+}
+
+class PandasMaskArrayImpl::SetBitIterator {
+public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = ssize_t;
+  using difference_type = ssize_t;
+  using pointer = void;
+  using reference = ssize_t;
+
+  SetBitIterator() = default;
+  SetBitIterator(const PandasMaskArrayImpl &bmai, ssize_t start)
+      : bmai_(bmai.Copy()), word_start_(start - start % 64) {
+    LoadWord();
+    word_ &= ~pandas_mask::kernels::LowBits(start % 64);
+    Advance();
+  }
+
+  SetBitIterator &operator++() {
+    word_ &= word_ - 1;
+    Advance();
+    return *this;
+  }
+
+  SetBitIterator operator++(int) {
+    auto result = *this;
+    ++*this;
+    return result;
+  }
+
+  bool operator==(const SetBitIterator &other) const {
+    return **this == *other;
+  }
+
+  bool operator!=(const SetBitIterator &other) const {
+    return !(*this == other);
+  }
+
+  ssize_t operator*() const {
+    return word_ != 0 ? word_start_ + std::countr_zero(word_) : bmai_.length_;
+  }
+
+private:
+  auto LoadWord() -> void {
+    word_ = pandas_mask::kernels::LoadBits(
+        bmai_.Data(), bmai_.offset_ + word_start_,
+        std::min<int64_t>(64, bmai_.length_ - word_start_));
+  }
+
+  /// Moves to the next word holding a set bit, if the current one is empty
+  auto Advance() -> void {
+    while (word_ == 0 && word_start_ + 64 < bmai_.length_) {
+      word_start_ += 64;
+      LoadWord();
+    }
+  }
+
+  PandasMaskArrayImpl bmai_;
+  ssize_t word_start_ = 0;
+  // set bits of the word at word_start_ that have not been visited yet
+  uint64_t word_ = 0;
+};
+
+struct PandasMaskArrayImpl::SetBitRange {
+  SetBitIterator first;
+  SetBitIterator last;
+
+  SetBitIterator begin() const noexcept { return first; }
+  SetBitIterator end() const noexcept { return last; }
+};
+
+inline auto PandasMaskArrayImpl::SetBits() const -> SetBitRange {
+  return {SetBitIterator(*this, 0), SetBitIterator(*this, Length())};
+}
@@ -2,7 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <filesystem>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <random>
 
 TEST(PandasMaskArrayImplTest, BitmapConstructor) {
   nanoarrow::UniqueBitmap bitmap;
@@ -19,6 +23,39 @@ TEST(PandasMaskArrayImplTest, BitmapConstructor) {
   ASSERT_EQ(bma.GetItem(3), true);
 }
 
+TEST(PandasMaskArrayImplTest, Pack) {
+  const std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 0, 1, 1, 0, 2};
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+
+  ASSERT_EQ(bma.Length(), 11);
+  ASSERT_EQ(bma.NBytes(), 2);
+  for (size_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ(bma.GetItem(i), values[i] != 0);
+  }
+  ASSERT_EQ(bma.Sum(), 6);
+}
+
+TEST(PandasMaskArrayImplTest, UnpackInto) {
+  std::vector<uint8_t> values(150);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = (i % 3 == 0) || (i % 7 == 0);
+  }
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+
+  for (const int64_t offset : {0, 1, 5, 8, 13, 64, 149, 150}) {
+    const int64_t length = bma.Length() - offset;
+    std::vector<uint8_t> result(length, 0xff);
+    bma.UnpackInto(result.data(), offset, length);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(result[i], values[offset + i]) << offset << " " << i;
+    }
+  }
+
+  std::vector<uint8_t> result(values.size());
+  EXPECT_THROW(bma.UnpackInto(result.data(), 1, 150), std::out_of_range);
+  EXPECT_THROW(bma.UnpackInto(result.data(), -1, 1), std::out_of_range);
+}
+
 TEST(PandasMaskArrayImplTest, GetItemVector) {
   nanoarrow::UniqueBitmap bitmap;
   ArrowBitmapInit(bitmap.get());
@@ -115,8 +152,8 @@ TEST(PandasMaskArrayImplTest, Invert) {
   ASSERT_EQ(inverted.GetItem(3), false);
   ASSERT_EQ(inverted.GetItem(8), false);
 
-  ASSERT_EQ(inverted.bitmap_->buffer.size_bytes, 2);
-  ASSERT_EQ(inverted.bitmap_->size_bits, 9);
+  ASSERT_EQ(inverted.NBytes(), 2);
+  ASSERT_EQ(inverted.Length(), 9);
 }
 
 class PandasMaskArrayBinaryOpTest : public testing::Test {
@@ -278,8 +315,72 @@ TEST(PandasMaskArrayImplTest, Copy) {
   ASSERT_EQ(copied.GetItem(2), true);
   ASSERT_EQ(copied.GetItem(3), true);
 
-  ASSERT_EQ(copied.bitmap_->buffer.size_bytes, 1);
-  ASSERT_EQ(copied.bitmap_->size_bits, 4);
+  ASSERT_EQ(copied.NBytes(), 1);
+  ASSERT_EQ(copied.Length(), 4);
+}
+
+TEST(PandasMaskArrayImplTest, CopyOnWrite) {
+  std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1};
+  auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  auto copied = bma.Copy();
+
+  ASSERT_TRUE(copied.SharesBuffer(bma));
+  ASSERT_EQ(copied.Data(), bma.Data());
+  ASSERT_EQ(copied.NBytes(), bma.NBytes());
+
+  copied.SetItem(1, true);
+  ASSERT_FALSE(copied.SharesBuffer(bma));
+  ASSERT_NE(copied.Data(), bma.Data());
+  ASSERT_EQ(copied.NBytes(), 2);
+  ASSERT_TRUE(copied.GetItem(1));
+  ASSERT_FALSE(bma.GetItem(1));
+
+  // the original is the sole owner again so writes happen in place
+  const auto *data = bma.Data();
+  bma.SetItem(0, false);
+  ASSERT_EQ(bma.Data(), data);
+  ASSERT_TRUE(copied.GetItem(0));
+}
+
+TEST(PandasMaskArrayImplTest, Detach) {
+  std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0, 1};
+  auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  const auto copied = bma.Copy();
+  bma.Detach();
+  ASSERT_FALSE(bma.SharesBuffer(copied));
+
+  // the write then reuses the detached buffer
+  const auto *data = bma.Data();
+  bma.BinaryOpInPlace(copied, std::bit_xor<>());
+  ASSERT_EQ(bma.Data(), data);
+  ASSERT_FALSE(bma.Any());
+
+  auto compressed = copied.Compress();
+  compressed.Detach();
+  ASSERT_FALSE(compressed.IsCompressed());
+  for (size_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ(compressed.GetItem(i), values[i] != 0);
+  }
+}
+
+TEST(PandasMaskArrayImplTest, CopyOnWriteSliceCopiesCoveredBytes) {
+  std::vector<uint8_t> values(100);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = i % 3 == 0;
+  }
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  auto sliced = bma.Slice(42, 20).Copy();
+
+  sliced.SetRange(0, 4, true);
+  ASSERT_FALSE(sliced.SharesBuffer(bma));
+  ASSERT_EQ(sliced.Offset(), 42 % 8);
+  ASSERT_EQ(sliced.NBytes(), 3);
+  for (int64_t i = 0; i < sliced.Length(); i++) {
+    ASSERT_EQ(sliced.GetItem(i), i < 4 || values[42 + i]);
+  }
+  for (size_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ(bma.GetItem(i), values[i]);
+  }
 }
 
 TEST(PandasMaskArrayImplTest, Iteration) {
@@ -352,3 +453,1033 @@ TEST(PandasMaskArrayImplTest, ArgMin) {
   const auto bma3 = PandasMaskArrayImpl(std::move(bitmap));
   ASSERT_THROW(bma3.ArgMax(), std::length_error);
 }
+
+TEST(PandasMaskArrayImplTest, SliceSharesBuffer) {
+  std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 1, 0, 1, 1};
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  const auto sliced = bma.Slice(3, 5);
+
+  ASSERT_EQ(sliced.Length(), 5);
+  ASSERT_EQ(sliced.Offset(), 3);
+  ASSERT_EQ(sliced.Data(), bma.Data());
+  for (int64_t i = 0; i < sliced.Length(); i++) {
+    ASSERT_EQ(sliced.GetItem(i), values[i + 3]);
+  }
+  ASSERT_EQ(sliced.GetItem(-1), values[7]);
+  ASSERT_THROW(sliced.GetItem(5), std::out_of_range);
+  ASSERT_THROW(bma.Slice(6, 5), std::out_of_range);
+}
+
+TEST(PandasMaskArrayImplTest, SliceSetItemDoesNotPropagate) {
+  std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 1, 0, 1, 1};
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  auto sliced = bma.Slice(2, 6);
+
+  sliced.SetItem(0, false);
+  sliced.SetRange(1, 3, true);
+  ASSERT_FALSE(sliced.GetItem(0));
+  ASSERT_TRUE(sliced.GetItem(3));
+  for (size_t i = 0; i < values.size(); i++) {
+    ASSERT_EQ(bma.GetItem(i), values[i]);
+  }
+}
+
+class PandasMaskArrayOffsetTest : public testing::Test {
+protected:
+  PandasMaskArrayOffsetTest() {
+    std::mt19937 rng(7);
+    std::bernoulli_distribution dist(0.5);
+    values_.resize(1500);
+    for (auto &value : values_) {
+      value = dist(rng);
+    }
+    bma_ = PandasMaskArrayImpl::Pack(values_.data(), values_.size());
+  }
+
+  // Slices starting at every sub-byte offset, with lengths that end both on
+  // and off word boundaries
+  static auto Ranges() -> std::vector<std::pair<int64_t, int64_t>> {
+    std::vector<std::pair<int64_t, int64_t>> ranges;
+    for (int64_t start = 0; start < 17; start++) {
+      for (const int64_t length : {0, 1, 7, 64, 65, 300, 1400}) {
+        ranges.emplace_back(start, length);
+      }
+    }
+    return ranges;
+  }
+
+  auto Expected(int64_t start, int64_t i) const -> bool {
+    return values_[start + i] != 0;
+  }
+
+  std::vector<uint8_t> values_;
+  PandasMaskArrayImpl bma_;
+};
+
+TEST_F(PandasMaskArrayOffsetTest, Reductions) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    int64_t count = 0;
+    int64_t first_set = -1;
+    int64_t first_unset = -1;
+    for (int64_t i = 0; i < length; i++) {
+      count += Expected(start, i);
+      if (Expected(start, i) && first_set < 0) {
+        first_set = i;
+      }
+      if (!Expected(start, i) && first_unset < 0) {
+        first_unset = i;
+      }
+    }
+
+    ASSERT_EQ(sliced.Sum(), count);
+    ASSERT_EQ(sliced.Any(), count > 0);
+    ASSERT_EQ(sliced.All(), count == length);
+    ASSERT_EQ(sliced.NBytes(), (length + 7) / 8);
+    if (length > 0) {
+      ASSERT_EQ(sliced.ArgMax(),
+                static_cast<size_t>(std::max<int64_t>(0, first_set)));
+      ASSERT_EQ(sliced.ArgMin(),
+                static_cast<size_t>(std::max<int64_t>(0, first_unset)));
+    }
+
+    const auto inverted = sliced.Invert();
+    const auto copied = sliced.Copy();
+    std::vector<uint8_t> unpacked(length);
+    sliced.UnpackInto(unpacked.data(), 0, length);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(inverted.GetItem(i), !Expected(start, i));
+      ASSERT_EQ(copied.GetItem(i), Expected(start, i));
+      ASSERT_EQ(unpacked[i], Expected(start, i));
+    }
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, BinaryOpMixedOffsets) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto lhs = bma_.Slice(start, length);
+    for (const int64_t other_start : {0, 3, 8, 13}) {
+      const auto rhs = bma_.Slice(other_start, length);
+      const auto anded = lhs.BinaryOp(rhs, std::bit_and());
+      const auto ored = lhs.BinaryOp(rhs, std::bit_or());
+      const auto xored = lhs.BinaryOp(rhs, std::bit_xor());
+      const auto generic = lhs.BinaryOp(
+          rhs, [](uint64_t a, uint64_t b) -> uint64_t { return a & ~b; });
+
+      for (int64_t i = 0; i < length; i++) {
+        const bool a = Expected(start, i);
+        const bool b = Expected(other_start, i);
+        ASSERT_EQ(anded.GetItem(i), a && b);
+        ASSERT_EQ(ored.GetItem(i), a || b);
+        ASSERT_EQ(xored.GetItem(i), a != b);
+        ASSERT_EQ(generic.GetItem(i), a && !b);
+      }
+    }
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, InPlaceMixedOffsets) {
+  for (const auto &[start, length] : Ranges()) {
+    for (const int64_t other_start : {0, 3, 8, 13}) {
+      // drop the parent so the view owns a buffer with bits either side of it
+      auto owner = PandasMaskArrayImpl::Pack(values_.data(), values_.size());
+      auto lhs = owner.Slice(start, length);
+      owner = PandasMaskArrayImpl();
+      const auto rhs = bma_.Slice(other_start, length);
+      const uint8_t *data = lhs.Data();
+
+      lhs.BinaryOpInPlace(rhs, std::bit_xor());
+      lhs.BinaryOpInPlace(rhs, std::bit_or());
+      // as mask[rhs] = False, through the generic word loop
+      lhs.BinaryOpInPlace(rhs, BitAndNot());
+      lhs.InvertInPlace();
+      ASSERT_EQ(lhs.Data(), data);
+      ASSERT_EQ(lhs.Offset(), start);
+
+      for (int64_t i = 0; i < length; i++) {
+        const bool a = Expected(start, i);
+        const bool b = Expected(other_start, i);
+        ASSERT_EQ(lhs.GetItem(i), !(((a != b) || b) && !b));
+      }
+      for (int64_t i = 0; i < start; i++) {
+        ASSERT_EQ(ArrowBitGet(data, i), values_[i] != 0);
+      }
+      const int64_t end = _ArrowBytesForBits(start + length) * 8;
+      for (int64_t i = start + length; i < end; i++) {
+        ASSERT_EQ(ArrowBitGet(data, i), values_[i] != 0);
+      }
+    }
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, InPlaceCopiesSharedBuffer) {
+  auto sliced = bma_.Slice(3, 100);
+  sliced.BinaryOpInPlace(bma_.Slice(5, 100), std::bit_and());
+  sliced.InvertInPlace();
+
+  ASSERT_FALSE(sliced.SharesBuffer(bma_));
+  for (int64_t i = 0; i < 100; i++) {
+    ASSERT_EQ(sliced.GetItem(i), !(Expected(3, i) && Expected(5, i)));
+    ASSERT_EQ(bma_.GetItem(3 + i), Expected(3, i));
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, BinaryOpIntoReusesOut) {
+  auto out = bma_.Slice(11, 200).Invert();
+  const uint8_t *data = out.Data();
+
+  bma_.Slice(0, 200).BinaryOpInto(bma_.Slice(7, 200), std::bit_and(), out);
+  ASSERT_EQ(out.Data(), data);
+  for (int64_t i = 0; i < 200; i++) {
+    ASSERT_EQ(out.GetItem(i), Expected(0, i) && Expected(7, i));
+  }
+
+  bma_.Slice(1, 200).InvertInto(out);
+  ASSERT_EQ(out.Data(), data);
+  for (int64_t i = 0; i < 200; i++) {
+    ASSERT_EQ(out.GetItem(i), !Expected(1, i));
+  }
+
+  auto wrong_length = bma_.Slice(0, 199);
+  ASSERT_THROW(bma_.Slice(0, 200).BinaryOpInto(bma_.Slice(7, 200),
+                                               std::bit_or(), wrong_length),
+               std::invalid_argument);
+  ASSERT_THROW(bma_.Slice(0, 200).InvertInto(wrong_length),
+               std::invalid_argument);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, BinaryReductionsMixedOffsets) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto lhs = bma_.Slice(start, length);
+    for (const int64_t other_start : {0, 3, 8, 13}) {
+      const auto rhs = bma_.Slice(other_start, length);
+
+      ASSERT_EQ(lhs.CountAnd(rhs), lhs.BinaryOp(rhs, std::bit_and()).Sum());
+      ASSERT_EQ(lhs.CountAndNot(rhs), lhs.BinaryOp(rhs, BitAndNot()).Sum());
+      ASSERT_EQ(lhs.AnyAnd(rhs), lhs.BinaryOp(rhs, std::bit_and()).Any());
+      ASSERT_EQ(lhs.BinaryCount(rhs, std::bit_xor()),
+                lhs.BinaryOp(rhs, std::bit_xor()).Sum());
+      ASSERT_EQ(lhs.BinaryAny(rhs, std::bit_or()),
+                lhs.BinaryOp(rhs, std::bit_or()).Any());
+      ASSERT_EQ(lhs.BinaryAll(rhs, std::bit_or()),
+                lhs.BinaryOp(rhs, std::bit_or()).All());
+    }
+
+    // ~b sets every padding bit, which must not be counted
+    ASSERT_EQ(lhs.CountAndNot(lhs), 0);
+    ASSERT_FALSE(lhs.AnyAnd(lhs.Invert()));
+    ASSERT_TRUE(lhs.BinaryAll(lhs, [](uint64_t a, uint64_t b) -> uint64_t {
+      return ~(a ^ b);
+    }));
+  }
+
+  ASSERT_THROW(bma_.Slice(0, 10).CountAnd(bma_.Slice(0, 11)),
+               std::invalid_argument);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, FindFirstFindLast) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    for (const bool value : {true, false}) {
+      for (const int64_t from : {int64_t{0}, int64_t{1}, length / 3, length}) {
+        if (from > length) {
+          continue;
+        }
+
+        int64_t first = -1;
+        for (int64_t i = from; i < length && first < 0; i++) {
+          if (Expected(start, i) == value) {
+            first = i;
+          }
+        }
+        int64_t last = -1;
+        for (int64_t i = from - 1; i >= 0 && last < 0; i--) {
+          if (Expected(start, i) == value) {
+            last = i;
+          }
+        }
+
+        ASSERT_EQ(sliced.FindFirst(value, from), first);
+        ASSERT_EQ(sliced.FindLast(value, from), last);
+      }
+    }
+  }
+
+  ASSERT_THROW(bma_.FindFirst(true, bma_.Length() + 1), std::out_of_range);
+  ASSERT_THROW(bma_.FindLast(true, bma_.Length() + 1), std::out_of_range);
+  ASSERT_THROW(bma_.FindFirst(true, -1), std::out_of_range);
+  ASSERT_THROW(bma_.FindLast(true, -1), std::out_of_range);
+}
+
+TEST(PandasMaskArrayImplTest, FindFirstFindLastUniform) {
+  std::vector<uint8_t> values(1000, 0);
+  auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+
+  ASSERT_EQ(bma.FindFirst(true), -1);
+  ASSERT_EQ(bma.FindLast(true), -1);
+  ASSERT_EQ(bma.FindFirst(false), 0);
+  ASSERT_EQ(bma.FindLast(false), 999);
+  ASSERT_EQ(bma.ArgMax(), 0);
+
+  bma.SetItem(997, true);
+  ASSERT_EQ(bma.FindFirst(true), 997);
+  ASSERT_EQ(bma.FindLast(true), 997);
+  ASSERT_EQ(bma.FindFirst(true, 998), -1);
+  ASSERT_EQ(bma.FindLast(true, 997), -1);
+  ASSERT_EQ(bma.ArgMax(), 997);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, NonZero) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    std::vector<int64_t> expected;
+    for (int64_t i = 0; i < length; i++) {
+      if (Expected(start, i)) {
+        expected.push_back(i);
+      }
+    }
+
+    std::vector<int64_t> result(sliced.Sum());
+    ASSERT_EQ(sliced.NonZero(result.data()), sliced.Sum());
+    ASSERT_EQ(result, expected);
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, Iterators) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+
+    int64_t i = 0;
+    for (const bool value : sliced) {
+      ASSERT_EQ(value, Expected(start, i));
+      i++;
+    }
+    ASSERT_EQ(i, length);
+
+    std::vector<int64_t> expected(sliced.Sum());
+    sliced.NonZero(expected.data());
+    std::vector<int64_t> positions;
+    for (const auto position : sliced.SetBits()) {
+      positions.push_back(position);
+    }
+    ASSERT_EQ(positions, expected);
+  }
+}
+
+TEST(PandasMaskArrayImplTest, SetBitIteratorSparse) {
+  std::vector<uint8_t> values(10000, 0);
+  values[0] = values[63] = values[64] = values[5000] = values[9999] = 1;
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+
+  std::vector<ssize_t> positions(bma.SetBits().begin(), bma.SetBits().end());
+  ASSERT_EQ(positions, (std::vector<ssize_t>{0, 63, 64, 5000, 9999}));
+
+  const auto empty = PandasMaskArrayImpl::Pack(values.data(), 0);
+  ASSERT_EQ(empty.SetBits().begin(), empty.SetBits().end());
+  ASSERT_EQ(empty.begin(), empty.end());
+}
+
+TEST(PandasMaskArrayImplTest, IteratorsOutliveMask) {
+  std::vector<uint8_t> values(200, 0);
+  values[1] = values[100] = 1;
+  auto mask = std::make_unique<PandasMaskArrayImpl>(
+      PandasMaskArrayImpl::Pack(values.data(), values.size()));
+  auto value = mask->begin();
+  const auto end = mask->end();
+  auto position = mask->SetBits().begin();
+
+  // writes made after the iterators were created are not seen by them
+  mask->SetRange(0, 200, true);
+  mask->InvertInPlace();
+  mask.reset();
+
+  int64_t count = 0;
+  for (; value != end; ++value) {
+    count += *value;
+  }
+  ASSERT_EQ(count, 2);
+  ASSERT_EQ(*position, 1);
+  ASSERT_EQ(*++position, 100);
+  ASSERT_EQ(*++position, 200);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, Take) {
+  std::mt19937 rng(10);
+  for (const auto &[start, length] : Ranges()) {
+    if (length == 0) {
+      continue;
+    }
+    const auto sliced = bma_.Slice(start, length);
+    std::uniform_int_distribution<int64_t> dist(-length, length - 1);
+    std::vector<int64_t> indices(300);
+    for (auto &index : indices) {
+      index = dist(rng);
+    }
+
+    const auto taken = sliced.Take(indices.data(), indices.size());
+    ASSERT_EQ(taken.Length(), 300);
+    for (size_t i = 0; i < indices.size(); i++) {
+      const auto index = indices[i] < 0 ? indices[i] + length : indices[i];
+      ASSERT_EQ(taken.GetItem(i), Expected(start, index));
+    }
+  }
+}
+
+TEST(PandasMaskArrayImplTest, TakeAllowFill) {
+  std::vector<uint8_t> values{1, 0, 1, 1, 0, 0, 1, 0, 1, 1};
+  const auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  const std::vector<int64_t> indices{-1, 0, 1, -1, 9, 4, -1, 2, 3};
+
+  for (const bool fill_value : {false, true}) {
+    const auto taken =
+        bma.Take(indices.data(), indices.size(), true, fill_value);
+    for (size_t i = 0; i < indices.size(); i++) {
+      const bool expected =
+          indices[i] < 0 ? fill_value : values[indices[i]] != 0;
+      ASSERT_EQ(taken.GetItem(i), expected);
+    }
+  }
+
+  const std::vector<int64_t> too_small{0, -2};
+  ASSERT_THROW(bma.Take(too_small.data(), too_small.size(), true),
+               std::invalid_argument);
+  ASSERT_EQ(bma.Take(too_small.data(), too_small.size()).GetItem(1), true);
+
+  const std::vector<int64_t> too_large{0, 10};
+  ASSERT_THROW(bma.Take(too_large.data(), too_large.size()),
+               std::out_of_range);
+  ASSERT_THROW(bma.Take(too_large.data(), too_large.size(), true),
+               std::out_of_range);
+  const std::vector<int64_t> too_negative{-11};
+  ASSERT_THROW(bma.Take(too_negative.data(), too_negative.size()),
+               std::out_of_range);
+
+  // an empty mask can still be filled
+  const auto empty = PandasMaskArrayImpl::Pack(values.data(), 0);
+  const std::vector<int64_t> missing{-1, -1};
+  ASSERT_TRUE(empty.Take(missing.data(), missing.size(), true, true).All());
+  ASSERT_THROW(empty.Take(indices.data() + 1, 1), std::out_of_range);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, Filter) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    for (const int64_t selector_start : {0, 3, 8, 13}) {
+      const auto selector = bma_.Slice(selector_start, length);
+      const auto filtered = sliced.Filter(selector);
+
+      ASSERT_EQ(filtered.Length(), selector.Sum());
+      int64_t j = 0;
+      for (int64_t i = 0; i < length; i++) {
+        if (Expected(selector_start, i)) {
+          ASSERT_EQ(filtered.GetItem(j++), Expected(start, i));
+        }
+      }
+    }
+  }
+
+  ASSERT_THROW(bma_.Filter(bma_.Slice(0, 10)), std::invalid_argument);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, SetSliceMixedOffsets) {
+  for (const auto &[start, length] : Ranges()) {
+    for (const int64_t dst_start : {0, 5, 8, 63}) {
+      auto dst = bma_.Slice(dst_start, 1450 - dst_start).Copy();
+      const auto values = bma_.Slice(start, std::min<int64_t>(length, 40));
+      dst.SetSlice(17, values);
+
+      for (int64_t i = 0; i < dst.Length(); i++) {
+        const bool expected = i >= 17 && i < 17 + values.Length()
+                                  ? Expected(start, i - 17)
+                                  : Expected(dst_start, i);
+        ASSERT_EQ(dst.GetItem(i), expected) << i;
+      }
+    }
+  }
+
+  // the source buffer is untouched
+  for (int64_t i = 0; i < bma_.Length(); i++) {
+    ASSERT_EQ(bma_.GetItem(i), Expected(0, i));
+  }
+  ASSERT_THROW(bma_.Copy().SetSlice(1490, bma_.Slice(0, 11)),
+               std::out_of_range);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, SetStrided) {
+  for (const int64_t step : {2, 3, 9, -1, -7}) {
+    auto dst = bma_.Slice(3, 1000).Copy();
+    const int64_t first = step > 0 ? 1 : 998;
+    const int64_t count = step > 0 ? (998 - first) / step + 1
+                                   : first / -step + 1;
+    const auto values = bma_.Slice(11, count);
+    dst.SetStrided(first, step, values);
+
+    auto filled = bma_.Slice(3, 1000).Copy();
+    filled.SetStrided(first, step, count, true);
+
+    std::vector<int64_t> written(1000, -1);
+    for (int64_t i = 0; i < count; i++) {
+      written[first + i * step] = i;
+    }
+    for (int64_t i = 0; i < 1000; i++) {
+      if (written[i] >= 0) {
+        ASSERT_EQ(dst.GetItem(i), Expected(11, written[i])) << i;
+        ASSERT_TRUE(filled.GetItem(i));
+      } else {
+        ASSERT_EQ(dst.GetItem(i), Expected(3, i)) << i;
+        ASSERT_EQ(filled.GetItem(i), Expected(3, i)) << i;
+      }
+    }
+  }
+
+  auto dst = bma_.Copy();
+  ASSERT_THROW(dst.SetStrided(0, 2, 751, true), std::out_of_range);
+  ASSERT_THROW(dst.SetStrided(10, -3, 5, true), std::out_of_range);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, BlendMixedOffsets) {
+  for (const auto &[start, length] : Ranges()) {
+    for (const int64_t other_start : {0, 3, 8, 13}) {
+      auto dst = bma_.Slice(start, length);
+      const auto selector = bma_.Slice(other_start, length);
+      const auto values = bma_.Slice(other_start + 50, length).Invert();
+      dst.Blend(selector, values);
+
+      ASSERT_EQ(dst.Length(), length);
+      for (int64_t i = 0; i < length; i++) {
+        const bool expected = Expected(other_start, i)
+                                  ? !Expected(other_start + 50, i)
+                                  : Expected(start, i);
+        ASSERT_EQ(dst.GetItem(i), expected) << i;
+      }
+    }
+  }
+
+  // dst shared its buffer with bma_ until written
+  for (int64_t i = 0; i < bma_.Length(); i++) {
+    ASSERT_EQ(bma_.GetItem(i), Expected(0, i));
+  }
+  auto dst = bma_.Slice(0, 10);
+  ASSERT_THROW(dst.Blend(bma_.Slice(0, 10), bma_.Slice(0, 11)),
+               std::invalid_argument);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, Scatter) {
+  for (const auto &[start, length] : Ranges()) {
+    auto dst = bma_.Slice(start, length);
+    const auto selector = bma_.Slice(start + 1, length);
+    const auto values = bma_.Slice(5, selector.Sum());
+    dst.Scatter(selector, values);
+
+    int64_t next = 0;
+    for (int64_t i = 0; i < length; i++) {
+      const bool expected = Expected(start + 1, i) ? Expected(5, next++)
+                                                   : Expected(start, i);
+      ASSERT_EQ(dst.GetItem(i), expected) << i;
+    }
+  }
+
+  auto dst = bma_.Slice(0, 10);
+  ASSERT_THROW(dst.Scatter(bma_.Slice(0, 10), bma_.Slice(0, 11)),
+               std::invalid_argument);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, Concatenate) {
+  // chunks at every sub-byte offset, some empty, so both the memcpy and the
+  // shifting paths are exercised against either kind of destination offset
+  std::vector<PandasMaskArrayImpl> chunks;
+  std::vector<bool> expected;
+  for (const auto &[start, length] : Ranges()) {
+    if (length > 100) {
+      continue;
+    }
+    chunks.push_back(bma_.Slice(start, length));
+    for (int64_t i = 0; i < length; i++) {
+      expected.push_back(Expected(start, i));
+    }
+  }
+  chunks.push_back(bma_);
+  for (int64_t i = 0; i < bma_.Length(); i++) {
+    expected.push_back(Expected(0, i));
+  }
+
+  std::vector<const PandasMaskArrayImpl *> pointers;
+  for (const auto &chunk : chunks) {
+    pointers.push_back(&chunk);
+  }
+  const auto result = PandasMaskArrayImpl::Concatenate(pointers);
+
+  ASSERT_EQ(result.Length(), static_cast<ssize_t>(expected.size()));
+  for (size_t i = 0; i < expected.size(); i++) {
+    ASSERT_EQ(result.GetItem(i), expected[i]) << i;
+  }
+  ASSERT_EQ(result.Invert().Sum(),
+            std::count(expected.begin(), expected.end(), false));
+
+  ASSERT_EQ(PandasMaskArrayImpl::Concatenate({}).Length(), 0);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, ArrowRoundTrip) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    ArrowArray array;
+    sliced.ExportArrow(&array);
+    ASSERT_EQ(array.length, length);
+    ASSERT_EQ(array.offset, start);
+    ASSERT_EQ(array.null_count, 0);
+    ASSERT_EQ(array.n_buffers, 2);
+    ASSERT_EQ(array.buffers[0], nullptr);
+
+    // the values are adopted, not copied
+    auto imported = PandasMaskArrayImpl::ImportArrow(&array, 1);
+    ASSERT_EQ(array.release, nullptr);
+    ASSERT_EQ(imported.Data(), bma_.Data());
+    ASSERT_EQ(imported.Offset(), start);
+    ASSERT_EQ(imported.Length(), length);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(imported.GetItem(i), Expected(start, i));
+    }
+
+    // neither side sees the other's writes
+    if (length > 0) {
+      imported.SetItem(0, !Expected(start, 0));
+      ASSERT_NE(imported.Data(), bma_.Data());
+      ASSERT_EQ(bma_.GetItem(start), Expected(start, 0));
+    }
+  }
+
+  ArrowSchema schema;
+  PandasMaskArrayImpl::ExportArrowSchema(&schema);
+  ASSERT_STREQ(schema.format, "b");
+  schema.release(&schema);
+  ASSERT_EQ(schema.release, nullptr);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, ArrowExportOutlivesMask) {
+  ArrowArray array;
+  {
+    auto mask = bma_.Slice(5, 100).Copy();
+    mask.ExportArrow(&array);
+    // the export keeps the buffer it was given, not later writes
+    mask.SetRange(0, 100, true);
+  }
+
+  const auto exported = PandasMaskArrayImpl::ImportArrow(&array, 1);
+  for (int64_t i = 0; i < 100; i++) {
+    ASSERT_EQ(exported.GetItem(i), Expected(5, i));
+  }
+}
+
+namespace {
+
+// A producer-owned array with a validity bitmap that counts its releases
+struct ProducedArray {
+  static void Release(ArrowArray *array) {
+    ++*static_cast<int *>(array->private_data);
+    array->release = nullptr;
+  }
+
+  ProducedArray(const void *validity, int64_t length, int64_t offset) {
+    buffers[0] = validity;
+    array.length = length;
+    array.offset = offset;
+    array.n_buffers = 2;
+    array.buffers = buffers;
+    array.release = &Release;
+    array.private_data = &releases;
+  }
+
+  const void *buffers[2] = {nullptr, nullptr};
+  ArrowArray array{};
+  int releases = 0;
+};
+
+} // namespace
+
+TEST(PandasMaskArrayImplTest, ArrowImportValidity) {
+  const uint8_t validity[] = {0b10110100, 0b00000011};
+  {
+    ProducedArray produced(validity, 7, 2);
+    {
+      const auto mask = PandasMaskArrayImpl::ImportArrow(&produced.array, 0);
+      ASSERT_EQ(mask.Data(), validity);
+      ASSERT_EQ(mask.Sum(), 5);
+      ASSERT_TRUE(mask.GetItem(0));
+      ASSERT_FALSE(mask.GetItem(1));
+      ASSERT_EQ(produced.releases, 0);
+    }
+    ASSERT_EQ(produced.releases, 1);
+  }
+
+  // no validity bitmap means no nulls
+  ProducedArray all_valid(nullptr, 10, 3);
+  const auto mask = PandasMaskArrayImpl::ImportArrow(&all_valid.array, 0);
+  ASSERT_EQ(mask.Length(), 10);
+  ASSERT_TRUE(mask.All());
+  ASSERT_EQ(all_valid.releases, 1);
+
+  // the array is released when it cannot be adopted
+  ProducedArray missing(nullptr, 10, 0);
+  ASSERT_THROW(PandasMaskArrayImpl::ImportArrow(&missing.array, 1),
+               std::invalid_argument);
+  ASSERT_THROW(PandasMaskArrayImpl::ImportArrow(&missing.array, 2),
+               std::invalid_argument);
+  ASSERT_EQ(missing.releases, 1);
+
+  // an empty array need not have a values buffer
+  ProducedArray empty(nullptr, 0, 0);
+  ASSERT_EQ(PandasMaskArrayImpl::ImportArrow(&empty.array, 1).Length(), 0);
+  ASSERT_EQ(empty.releases, 1);
+}
+
+TEST(PandasMaskArrayImplTest, ArrowNullCount) {
+  const uint8_t validity[] = {0b10110100, 0b00000011};
+  ProducedArray produced(validity, 7, 2);
+  produced.array.null_count = 2;
+  ASSERT_EQ(PandasMaskArrayImpl::ArrowNullCount(produced.array), 2);
+
+  // left uncounted by the producer, so counted from the bitmap
+  produced.array.null_count = -1;
+  ASSERT_EQ(PandasMaskArrayImpl::ArrowNullCount(produced.array), 2);
+  ProducedArray all_valid(nullptr, 10, 3);
+  all_valid.array.null_count = -1;
+  ASSERT_EQ(PandasMaskArrayImpl::ArrowNullCount(all_valid.array), 0);
+}
+
+TEST_F(PandasMaskArrayOffsetTest, PackedRoundTrip) {
+  for (const auto &[start, length] : Ranges()) {
+    const auto sliced = bma_.Slice(start, length);
+    const auto packed = sliced.Packed();
+    ASSERT_TRUE(packed.IsPacked());
+    // a slice that starts mid-byte is always copied, one that covers whole
+    // bytes never is
+    if (length > 0 && start % 8 != 0) {
+      ASSERT_FALSE(packed.SharesBuffer(sliced));
+    } else if (length % 8 == 0) {
+      ASSERT_TRUE(packed.SharesBuffer(sliced));
+    }
+
+    const auto *bytes = &packed.Data()[packed.Offset() / 8];
+    const auto restored = PandasMaskArrayImpl::FromPacked(bytes, length);
+    ASSERT_EQ(restored.Length(), length);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(restored.GetItem(i), Expected(start, i));
+      ASSERT_EQ(packed.GetItem(i), Expected(start, i));
+    }
+    if (length % 8 != 0) {
+      ASSERT_EQ(bytes[length / 8] >> (length % 8), 0);
+    }
+  }
+}
+
+TEST_F(PandasMaskArrayOffsetTest, FileRoundTrip) {
+  const auto path = std::filesystem::path(testing::TempDir()) / "mask.bin";
+  for (const auto &[start, length] : Ranges()) {
+    bma_.Slice(start, length).ToFile(path);
+
+    for (const bool copy_on_write : {false, true}) {
+      auto mapped = PandasMaskArrayImpl::FromFile(path, copy_on_write);
+      ASSERT_EQ(mapped.Length(), length);
+      ASSERT_EQ(mapped.Offset(), 0);
+      // the payload is used in place and sits on a cache line
+      ASSERT_EQ(reinterpret_cast<uintptr_t>(mapped.Data()) % 64, 0u);
+      for (int64_t i = 0; i < length; i++) {
+        ASSERT_EQ(mapped.GetItem(i), Expected(start, i));
+      }
+      ASSERT_EQ(mapped.Invert().Sum(), length - mapped.Sum());
+
+      // writes never reach the file
+      const auto *data = mapped.Data();
+      mapped.SetRange(0, length, true);
+      ASSERT_EQ(mapped.Data() == data, copy_on_write);
+      ASSERT_TRUE(mapped.All());
+    }
+
+    const auto reopened = PandasMaskArrayImpl::FromFile(path, false);
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(reopened.GetItem(i), Expected(start, i));
+    }
+  }
+  std::filesystem::remove(path);
+}
+
+TEST(PandasMaskArrayImplTest, FileErrors) {
+  const auto dir = std::filesystem::path(testing::TempDir());
+  ASSERT_THROW(PandasMaskArrayImpl::FromFile(dir / "missing.bin", false),
+               std::system_error);
+
+  const auto path = dir / "not_a_mask.bin";
+  {
+    std::ofstream out(path, std::ios::binary);
+    out << std::string(100, 'x');
+  }
+  ASSERT_THROW(PandasMaskArrayImpl::FromFile(path, false),
+               std::invalid_argument);
+
+  // a valid header whose payload has been cut short
+  std::vector<uint8_t> values(1000, 1);
+  PandasMaskArrayImpl::Pack(values.data(), values.size()).ToFile(path);
+  std::filesystem::resize_file(path, 64 + 100);
+  ASSERT_THROW(PandasMaskArrayImpl::FromFile(path, false),
+               std::invalid_argument);
+  std::filesystem::remove(path);
+}
+
+/// Alternating runs of random length, starting with a false run
+static auto RunValues(int64_t length, int mean_run) -> std::vector<uint8_t> {
+  std::mt19937 rng(11);
+  std::geometric_distribution<int> run_length(1.0 / mean_run);
+  std::vector<uint8_t> values;
+  uint8_t value = 0;
+  while (static_cast<int64_t>(values.size()) < length) {
+    values.insert(values.end(), run_length(rng) + 1, value);
+    value = !value;
+  }
+  values.resize(length);
+  return values;
+}
+
+TEST(PandasMaskArrayImplTest, CompressedMatchesBitmap) {
+  for (const int64_t length : {0, 1, 63, 64, 65, 1000, 5003}) {
+    for (const int mean_run : {1, 7, 100}) {
+      const auto values = RunValues(length, mean_run);
+      const auto dense = PandasMaskArrayImpl::Pack(values.data(), length);
+      const auto compressed = dense.Compress();
+      ASSERT_TRUE(compressed.IsCompressed());
+      ASSERT_FALSE(compressed.Decompress().IsCompressed());
+
+      ASSERT_EQ(compressed.Length(), length);
+      ASSERT_EQ(compressed.Sum(), dense.Sum());
+      ASSERT_EQ(compressed.Any(), dense.Any());
+      ASSERT_EQ(compressed.All(), dense.All());
+      for (int64_t i = 0; i < length; i++) {
+        ASSERT_EQ(compressed.GetItem(i), values[i] != 0);
+      }
+      for (const bool value : {false, true}) {
+        for (int64_t i = 0; i <= length; i += std::max<int64_t>(1, i / 4)) {
+          ASSERT_EQ(compressed.FindFirst(value, i), dense.FindFirst(value, i));
+          ASSERT_EQ(compressed.FindLast(value, i), dense.FindLast(value, i));
+        }
+      }
+
+      std::vector<int64_t> positions(dense.Sum());
+      ASSERT_EQ(compressed.NonZero(positions.data()), dense.Sum());
+      for (const auto pos : positions) {
+        ASSERT_TRUE(values[pos]);
+      }
+
+      const int64_t start = length / 3;
+      const int64_t count = length / 2;
+      const auto slice = compressed.Slice(start, count);
+      ASSERT_TRUE(slice.IsCompressed());
+      std::vector<uint8_t> unpacked(count);
+      compressed.UnpackInto(unpacked.data(), start, count);
+      for (int64_t i = 0; i < count; i++) {
+        ASSERT_EQ(slice.GetItem(i), values[start + i] != 0);
+        ASSERT_EQ(unpacked[i], values[start + i]);
+      }
+
+      // an operation without a path of its own decodes a bitmap
+      const auto packed = compressed.Packed();
+      for (int64_t i = 0; i < length; i++) {
+        ASSERT_EQ(ArrowBitGet(packed.Data(), i), values[i] != 0);
+      }
+    }
+  }
+}
+
+TEST(PandasMaskArrayImplTest, CompressedBinaryOps) {
+  const int64_t length = 2000;
+  const auto lhs_values = RunValues(length, 50);
+  auto rhs_values = RunValues(length + 17, 30);
+  rhs_values.erase(rhs_values.begin(), rhs_values.begin() + 17);
+  const auto lhs = PandasMaskArrayImpl::Pack(lhs_values.data(), length);
+  const auto rhs = PandasMaskArrayImpl::Pack(rhs_values.data(), length);
+  const auto clhs = lhs.Compress();
+  const auto crhs = rhs.Compress();
+
+  const auto check = [&](const auto &op) {
+    const auto expected = lhs.BinaryOp(rhs, op);
+    const auto merged = clhs.BinaryOp(crhs, op);
+    ASSERT_TRUE(merged.IsCompressed());
+    const auto mixed = clhs.BinaryOp(rhs, op);
+    ASSERT_FALSE(mixed.IsCompressed());
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(merged.GetItem(i), expected.GetItem(i));
+      ASSERT_EQ(mixed.GetItem(i), expected.GetItem(i));
+    }
+    // merged runs are maximal, so they match a fresh encoding
+    ASSERT_EQ(merged.StorageBytes(), expected.Compress().StorageBytes());
+  };
+  check(std::bit_and<>());
+  check(std::bit_or<>());
+  check(std::bit_xor<>());
+  check(BitAndNot());
+
+  const auto inverted = clhs.Invert();
+  ASSERT_TRUE(inverted.IsCompressed());
+  for (int64_t i = 0; i < length; i++) {
+    ASSERT_EQ(inverted.GetItem(i), lhs_values[i] == 0);
+  }
+
+  auto in_place = clhs.Copy();
+  in_place.BinaryOpInPlace(crhs, std::bit_or<>());
+  ASSERT_TRUE(in_place.IsCompressed());
+  ASSERT_EQ(in_place.Sum(), lhs.BinaryOp(rhs, std::bit_or<>()).Sum());
+  in_place.InvertInPlace();
+  ASSERT_EQ(in_place.Sum(), length - lhs.BinaryOp(rhs, std::bit_or<>()).Sum());
+  ASSERT_THROW(clhs.BinaryOp(crhs.Slice(0, 10), std::bit_and<>()),
+               std::invalid_argument);
+}
+
+TEST(PandasMaskArrayImplTest, CompressedWritesDecompress) {
+  const auto values = RunValues(500, 40);
+  const auto compressed =
+      PandasMaskArrayImpl::Pack(values.data(), values.size()).Compress();
+  auto copy = compressed.Copy();
+  ASSERT_TRUE(copy.SharesBuffer(compressed));
+
+  copy.SetItem(0, true);
+  ASSERT_FALSE(copy.IsCompressed());
+  ASSERT_FALSE(copy.SharesBuffer(compressed));
+  ASSERT_TRUE(copy.GetItem(0));
+  ASSERT_FALSE(compressed.GetItem(0));
+  for (size_t i = 1; i < values.size(); i++) {
+    ASSERT_EQ(copy.GetItem(i), values[i] != 0);
+  }
+}
+
+TEST(PandasMaskArrayImplTest, CompressIfSmaller) {
+  const int64_t length = 100000;
+  std::vector<uint8_t> values(length, 1);
+  values[12345] = 0;
+  const auto clean = PandasMaskArrayImpl::Pack(values.data(), length);
+  const auto compressed = clean.CompressIfSmaller();
+  ASSERT_TRUE(compressed.IsCompressed());
+  ASSERT_EQ(compressed.StorageBytes(), 2 * sizeof(PandasMaskArrayImpl::Run));
+  ASSERT_EQ(compressed.NBytes(), clean.NBytes());
+  ASSERT_EQ(compressed.Sum(), length - 1);
+  ASSERT_FALSE(compressed.All());
+
+  // once decoded, the bitmap is held alongside the runs and counted
+  const auto copy = compressed.Copy();
+  copy.Data();
+  ASSERT_EQ(compressed.StorageBytes(),
+            2 * sizeof(PandasMaskArrayImpl::Run) + compressed.NBytes());
+
+  // irregular, and too small to be worth it
+  const auto random = RunValues(length, 1);
+  ASSERT_FALSE(PandasMaskArrayImpl::Pack(random.data(), length)
+                   .CompressIfSmaller()
+                   .IsCompressed());
+  ASSERT_FALSE(PandasMaskArrayImpl::Pack(values.data(), 1000)
+                   .CompressIfSmaller()
+                   .IsCompressed());
+}
+
+TEST(PandasMaskArrayImplTest, CachedSumFollowsWrites) {
+  const auto values = RunValues(1000, 5);
+  auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  const auto recount = [](const PandasMaskArrayImpl &mask) {
+    return ArrowBitCountSet(mask.Data(), mask.Offset(), mask.Length());
+  };
+
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  const auto copy = bma.Copy();
+  const auto expected = copy.Sum();
+
+  bma.SetItem(3, !values[3]);
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.SetItem(4, values[4]);
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.SetRange(10, 300, true);
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  ASSERT_TRUE(bma.Any());
+  bma.InvertInPlace();
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.SetSlice(500, copy.Slice(0, 400));
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.BinaryOpInPlace(copy, std::bit_or<>());
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.Blend(copy, copy.Invert());
+  ASSERT_EQ(bma.Sum(), recount(bma));
+  bma.SetRange(0, bma.Length(), true);
+  ASSERT_TRUE(bma.All());
+  bma.SetItem(-1, false);
+  ASSERT_FALSE(bma.All());
+
+  // the copy detached before the first write, so its count still holds
+  ASSERT_EQ(copy.Sum(), expected);
+  ASSERT_EQ(copy.Slice(100, 200).Sum(), recount(copy.Slice(100, 200)));
+}
+
+TEST(PandasMaskArrayImplTest, RankSelect) {
+  for (const int64_t length : {0, 1, 511, 512, 513, 20000, 100003}) {
+    for (const int mean_run : {1, 3, 400}) {
+      const auto values = RunValues(length + 5, mean_run);
+      for (const bool compress : {false, true}) {
+        auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size())
+                       .Slice(5, length);
+        if (compress) {
+          bma = bma.Compress();
+        }
+        std::vector<int64_t> positions(bma.Sum());
+        bma.NonZero(positions.data());
+
+        for (const bool indexed : {false, true}) {
+          if (indexed) {
+            bma.BuildRankIndex();
+          }
+          ASSERT_EQ(bma.HasRankIndex(), indexed);
+
+          int64_t count = 0;
+          const int64_t step = indexed ? 1 : 97;
+          for (int64_t i = 0; i < length; i++) {
+            if (i % step == 0) {
+              ASSERT_EQ(bma.Rank(i), count);
+            }
+            count += values[5 + i] != 0;
+          }
+          ASSERT_EQ(bma.Rank(length), count);
+          for (size_t k = 0; k < positions.size(); k += indexed ? 1 : 97) {
+            ASSERT_EQ(bma.Select(k), positions[k]);
+          }
+          ASSERT_THROW(bma.Rank(length + 1), std::out_of_range);
+          ASSERT_THROW(bma.Select(count), std::out_of_range);
+          ASSERT_THROW(bma.Select(-1), std::out_of_range);
+        }
+
+        // a write discards the index, and a copy shares it until then
+        auto copy = bma.Copy();
+        ASSERT_TRUE(copy.HasRankIndex());
+        if (length > 0) {
+          copy.SetItem(0, true);
+          ASSERT_FALSE(copy.HasRankIndex());
+          ASSERT_TRUE(bma.HasRankIndex());
+        }
+      }
+    }
+  }
+}
+
+TEST(PandasMaskArrayImplTest, ShareCaches) {
+  const auto values = RunValues(5000, 10);
+  auto bma = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  auto copy = bma.Copy();
+  copy.BuildRankIndex();
+
+  bma.ShareCaches(copy);
+  ASSERT_TRUE(bma.HasRankIndex());
+
+  // nothing is taken from a mask over different bits
+  auto slice = bma.Slice(1, 100);
+  slice.ShareCaches(copy);
+  ASSERT_FALSE(slice.HasRankIndex());
+  auto written = copy.Copy();
+  written.SetItem(0, !values[0]);
+  written.BuildRankIndex();
+  auto other = copy.Copy();
+  other.SetItem(1, values[1]);
+  other.ShareCaches(written);
+  ASSERT_FALSE(other.HasRankIndex());
+}
@@ -0,0 +1,1081 @@
+/// Word and SIMD kernels operating on raw bitmap buffers
+/// Nothing in this module may use the Python runtime
+#include "pandas_mask_kernels.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define PANDAS_MASK_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#else
+#define PANDAS_MASK_X86_64 0
+#endif
+
+// GCC and clang require the target ISA to be enabled per function before its
+// intrinsics can be used; MSVC allows them anywhere
+#if defined(__GNUC__) || defined(__clang__)
+#define PANDAS_MASK_TARGET_AVX2 __attribute__((target("avx2")))
+#define PANDAS_MASK_TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define PANDAS_MASK_TARGET_BMI2 __attribute__((target("bmi2")))
+#define PANDAS_MASK_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define PANDAS_MASK_TARGET_AVX2
+#define PANDAS_MASK_TARGET_AVX512
+#define PANDAS_MASK_TARGET_BMI2
+#define PANDAS_MASK_ALWAYS_INLINE __forceinline
+#endif
+
+namespace pandas_mask::kernels {
+namespace {
+
+enum class BitwiseOp { And, Or, Xor };
+
+constexpr auto BytesForBits(int64_t nbits) noexcept -> int64_t {
+  return (nbits >> 3) + ((nbits & 7) != 0);
+}
+
+template <BitwiseOp Op, typename T>
+constexpr auto Apply(T lhs, T rhs) noexcept -> T {
+  if constexpr (Op == BitwiseOp::And) {
+    return lhs & rhs;
+  } else if constexpr (Op == BitwiseOp::Or) {
+    return lhs | rhs;
+  } else {
+    return lhs ^ rhs;
+  }
+}
+
+// The scalar kernels double as the tail handlers for every SIMD kernel, so
+// they accept the byte position at which to start
+
+template <BitwiseOp Op>
+auto BinaryScalarFrom(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                      int64_t i, int64_t nbytes) noexcept -> void {
+  for (; i + static_cast<int64_t>(sizeof(uint64_t)) <= nbytes;
+       i += sizeof(uint64_t)) {
+    uint64_t value1;
+    uint64_t value2;
+    memcpy(&value1, &lhs[i], sizeof(uint64_t));
+    memcpy(&value2, &rhs[i], sizeof(uint64_t));
+    const uint64_t result = Apply<Op>(value1, value2);
+    memcpy(&out[i], &result, sizeof(uint64_t));
+  }
+
+  for (; i < nbytes; i++) {
+    out[i] = Apply<Op>(lhs[i], rhs[i]);
+  }
+}
+
+auto InvertScalarFrom(const uint8_t *src, uint8_t *out, int64_t i,
+                      int64_t nbytes) noexcept -> void {
+  for (; i + static_cast<int64_t>(sizeof(uint64_t)) <= nbytes;
+       i += sizeof(uint64_t)) {
+    uint64_t value;
+    memcpy(&value, &src[i], sizeof(uint64_t));
+    value = ~value;
+    memcpy(&out[i], &value, sizeof(uint64_t));
+  }
+
+  for (; i < nbytes; i++) {
+    out[i] = static_cast<uint8_t>(~src[i]);
+  }
+}
+
+auto BlendScalarFrom(const uint8_t *selector, const uint8_t *values,
+                     uint8_t *dst, int64_t i, int64_t nbytes) noexcept -> void {
+  for (; i + static_cast<int64_t>(sizeof(uint64_t)) <= nbytes;
+       i += sizeof(uint64_t)) {
+    uint64_t select;
+    uint64_t value;
+    uint64_t result;
+    memcpy(&select, &selector[i], sizeof(uint64_t));
+    memcpy(&value, &values[i], sizeof(uint64_t));
+    memcpy(&result, &dst[i], sizeof(uint64_t));
+    result = (result & ~select) | (value & select);
+    memcpy(&dst[i], &result, sizeof(uint64_t));
+  }
+
+  for (; i < nbytes; i++) {
+    dst[i] = static_cast<uint8_t>((dst[i] & ~selector[i]) |
+                                  (values[i] & selector[i]));
+  }
+}
+
+/// Checks the full bytes in [i, nbits / 8) and then the trailing partial byte
+auto AnyScalarFrom(const uint8_t *src, int64_t i, int64_t nbits) noexcept
+    -> bool {
+  const int64_t full_bytes = nbits / 8;
+  for (; i + static_cast<int64_t>(sizeof(uint64_t)) <= full_bytes;
+       i += sizeof(uint64_t)) {
+    uint64_t value;
+    memcpy(&value, &src[i], sizeof(uint64_t));
+    if (value != 0x0) {
+      return true;
+    }
+  }
+
+  for (; i < full_bytes; i++) {
+    if (src[i] != 0x0) {
+      return true;
+    }
+  }
+
+  const int64_t bits_remaining = nbits % 8;
+  if (bits_remaining == 0) {
+    return false;
+  }
+  const uint8_t tail_mask = static_cast<uint8_t>((1u << bits_remaining) - 1);
+  return (src[full_bytes] & tail_mask) != 0x0;
+}
+
+auto AllScalarFrom(const uint8_t *src, int64_t i, int64_t nbits) noexcept
+    -> bool {
+  const int64_t full_bytes = nbits / 8;
+  for (; i + static_cast<int64_t>(sizeof(uint64_t)) <= full_bytes;
+       i += sizeof(uint64_t)) {
+    uint64_t value;
+    memcpy(&value, &src[i], sizeof(uint64_t));
+    if (value != UINT64_MAX) {
+      return false;
+    }
+  }
+
+  for (; i < full_bytes; i++) {
+    if (src[i] != 0xff) {
+      return false;
+    }
+  }
+
+  const int64_t bits_remaining = nbits % 8;
+  if (bits_remaining == 0) {
+    return true;
+  }
+  const uint8_t tail_mask = static_cast<uint8_t>((1u << bits_remaining) - 1);
+  return (src[full_bytes] & tail_mask) == tail_mask;
+}
+
+/// Packs values[i, nbits) into bits, where i must be a multiple of 8. Any
+/// non-zero byte is treated as true and padding bits are zeroed
+auto PackScalarFrom(const uint8_t *values, uint8_t *out, int64_t i,
+                    int64_t nbits) noexcept -> void {
+  for (; i + 8 <= nbits; i += 8) {
+    uint8_t byte = 0;
+    for (int j = 0; j < 8; j++) {
+      byte |= static_cast<uint8_t>((values[i + j] != 0) << j);
+    }
+    out[i / 8] = byte;
+  }
+
+  if (i < nbits) {
+    uint8_t byte = 0;
+    for (int j = 0; i + j < nbits; j++) {
+      byte |= static_cast<uint8_t>((values[i + j] != 0) << j);
+    }
+    out[i / 8] = byte;
+  }
+}
+
+/// Expands bits[i, nbits) into bytes, where i must be a multiple of 8
+auto UnpackScalarFrom(const uint8_t *bits, uint8_t *out, int64_t i,
+                      int64_t nbits) noexcept -> void {
+  for (; i + 8 <= nbits; i += 8) {
+    const uint8_t byte = bits[i / 8];
+    for (int j = 0; j < 8; j++) {
+      out[i + j] = (byte >> j) & 1;
+    }
+  }
+
+  for (; i < nbits; i++) {
+    out[i] = (bits[i / 8] >> (i % 8)) & 1;
+  }
+}
+
+/// Writes base + j for every set bit j in [i, nbits), where i must be a
+/// multiple of 8, and returns the number of indices written
+auto NonzeroScalarFrom(const uint8_t *bits, int64_t i, int64_t nbits,
+                       int64_t base, int64_t *out) noexcept -> int64_t {
+  int64_t count = 0;
+  for (; i < nbits; i += 64) {
+    const int64_t nword = std::min<int64_t>(64, nbits - i);
+    uint64_t word = 0;
+    memcpy(&word, &bits[i / 8], BytesForBits(nword));
+    word &= LowBits(nword);
+    // visit set bits lowest first, clearing each once it is written
+    while (word != 0) {
+      out[count++] = base + i + std::countr_zero(word);
+      word &= word - 1;
+    }
+  }
+
+  return count;
+}
+
+auto MinMaxScalarFrom(const int64_t *values, int64_t i, int64_t n,
+                      int64_t *min, int64_t *max) noexcept -> void {
+  for (; i < n; i++) {
+    *min = std::min(*min, values[i]);
+    *max = std::max(*max, values[i]);
+  }
+}
+
+/// Gathers indices[i, n) into out, where i must be a multiple of 8. Each
+/// group of eight gathered bits is assembled and then stored as one byte
+auto TakeScalarFrom(const uint8_t *bits, int64_t offset,
+                    const int64_t *indices, int64_t i, int64_t n,
+                    uint8_t *out) noexcept -> void {
+  for (; i < n; i += 8) {
+    const int64_t nvalues = std::min<int64_t>(8, n - i);
+    uint8_t byte = 0;
+    for (int64_t j = 0; j < nvalues; j++) {
+      const int64_t index = indices[i + j];
+      if (index >= 0) {
+        const int64_t pos = offset + index;
+        byte |= static_cast<uint8_t>(((bits[pos / 8] >> (pos % 8)) & 1) << j);
+      }
+    }
+    out[i / 8] = byte;
+  }
+}
+
+/// Shared body of the filter kernels. extract(value, selector) must gather
+/// the bits of value under selector into the low bits of the result, like
+/// BMI2 pext. It is forced inline so extract inlines into each kernel with
+/// that kernel's target ISA
+template <typename Extract>
+PANDAS_MASK_ALWAYS_INLINE auto
+FilterWith(const uint8_t *values, int64_t values_offset,
+           const uint8_t *selector, int64_t selector_offset, int64_t nbits,
+           uint8_t *out, Extract extract) noexcept -> int64_t {
+  // extracted bits collect in pending until a whole word can be stored
+  uint64_t pending = 0;
+  int npending = 0;
+  int64_t written = 0;
+  for (int64_t i = 0; i < nbits; i += 64) {
+    const int64_t nword = std::min<int64_t>(64, nbits - i);
+    const uint64_t select = LoadBits(selector, selector_offset + i, nword);
+    if (select == 0) {
+      continue;
+    }
+
+    const uint64_t bits =
+        extract(LoadBits(values, values_offset + i, nword), select);
+    const int nselected = std::popcount(select);
+    pending |= bits << npending;
+    if (npending + nselected >= 64) {
+      memcpy(&out[written / 8], &pending, sizeof(pending));
+      written += 64;
+      pending = npending == 0 ? 0 : bits >> (64 - npending);
+      npending = npending + nselected - 64;
+    } else {
+      npending += nselected;
+    }
+  }
+
+  if (npending > 0) {
+    memcpy(&out[written / 8], &pending, BytesForBits(npending));
+  }
+  return written + npending;
+}
+
+/// Portable equivalent of pext, visiting one selected bit at a time
+auto ExtractScalar(uint64_t value, uint64_t selector) noexcept -> uint64_t {
+  if (selector == UINT64_MAX) {
+    return value;
+  }
+
+  uint64_t result = 0;
+  for (uint64_t bit = 1; selector != 0; selector &= selector - 1, bit <<= 1) {
+    if (value & selector & -selector) {
+      result |= bit;
+    }
+  }
+  return result;
+}
+
+template <BitwiseOp Op>
+auto BinaryScalar(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                  int64_t nbits) noexcept -> void {
+  BinaryScalarFrom<Op>(lhs, rhs, out, 0, BytesForBits(nbits));
+}
+
+auto InvertScalar(const uint8_t *src, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  InvertScalarFrom(src, out, 0, BytesForBits(nbits));
+}
+
+auto BlendScalar(const uint8_t *selector, const uint8_t *values, uint8_t *dst,
+                 int64_t nbits) noexcept -> void {
+  BlendScalarFrom(selector, values, dst, 0, BytesForBits(nbits));
+}
+
+auto PackScalar(const uint8_t *values, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  PackScalarFrom(values, out, 0, nbits);
+}
+
+auto UnpackScalar(const uint8_t *bits, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  UnpackScalarFrom(bits, out, 0, nbits);
+}
+
+auto NonzeroScalar(const uint8_t *bits, int64_t nbits, int64_t base,
+                   int64_t *out) noexcept -> int64_t {
+  return NonzeroScalarFrom(bits, 0, nbits, base, out);
+}
+
+auto MinMaxScalar(const int64_t *values, int64_t n, int64_t *min,
+                  int64_t *max) noexcept -> void {
+  *min = std::numeric_limits<int64_t>::max();
+  *max = std::numeric_limits<int64_t>::min();
+  MinMaxScalarFrom(values, 0, n, min, max);
+}
+
+auto TakeScalar(const uint8_t *bits, int64_t offset, int64_t /* length */,
+                const int64_t *indices, int64_t n, uint8_t *out) noexcept
+    -> void {
+  TakeScalarFrom(bits, offset, indices, 0, n, out);
+}
+
+auto FilterScalar(const uint8_t *values, int64_t values_offset,
+                  const uint8_t *selector, int64_t selector_offset,
+                  int64_t nbits, uint8_t *out) noexcept -> int64_t {
+  return FilterWith(values, values_offset, selector, selector_offset, nbits,
+                    out, ExtractScalar);
+}
+
+auto AnyScalar(const uint8_t *src, int64_t nbits) noexcept -> bool {
+  return AnyScalarFrom(src, 0, nbits);
+}
+
+auto AllScalar(const uint8_t *src, int64_t nbits) noexcept -> bool {
+  return AllScalarFrom(src, 0, nbits);
+}
+
+constexpr KernelTable kScalarKernels{
+    Isa::Scalar,
+    &BinaryScalar<BitwiseOp::And>,
+    &BinaryScalar<BitwiseOp::Or>,
+    &BinaryScalar<BitwiseOp::Xor>,
+    &InvertScalar,
+    &BlendScalar,
+    &AnyScalar,
+    &AllScalar,
+    &PackScalar,
+    &UnpackScalar,
+    &NonzeroScalar,
+    &MinMaxScalar,
+    &TakeScalar,
+    &FilterScalar,
+};
+
+#if PANDAS_MASK_X86_64
+
+// SSE2 is part of the x86-64 baseline so needs no target attribute
+
+template <BitwiseOp Op>
+auto BinarySse2(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 16 <= nbytes; i += 16) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&lhs[i]));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&rhs[i]));
+    __m128i result;
+    if constexpr (Op == BitwiseOp::And) {
+      result = _mm_and_si128(a, b);
+    } else if constexpr (Op == BitwiseOp::Or) {
+      result = _mm_or_si128(a, b);
+    } else {
+      result = _mm_xor_si128(a, b);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i]), result);
+  }
+
+  BinaryScalarFrom<Op>(lhs, rhs, out, i, nbytes);
+}
+
+auto InvertSse2(const uint8_t *src, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  const __m128i ones = _mm_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 16 <= nbytes; i += 16) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i]),
+                     _mm_xor_si128(value, ones));
+  }
+
+  InvertScalarFrom(src, out, i, nbytes);
+}
+
+auto BlendSse2(const uint8_t *selector, const uint8_t *values, uint8_t *dst,
+               int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 16 <= nbytes; i += 16) {
+    const __m128i select =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&selector[i]));
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&values[i]));
+    const __m128i result =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&dst[i]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&dst[i]),
+                     _mm_or_si128(_mm_andnot_si128(select, result),
+                                  _mm_and_si128(value, select)));
+  }
+
+  BlendScalarFrom(selector, values, dst, i, nbytes);
+}
+
+auto AnySse2(const uint8_t *src, int64_t nbits) noexcept -> bool {
+  const int64_t full_bytes = nbits / 8;
+  const __m128i zero = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 16 <= full_bytes; i += 16) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(value, zero)) != 0xffff) {
+      return true;
+    }
+  }
+
+  return AnyScalarFrom(src, i, nbits);
+}
+
+auto AllSse2(const uint8_t *src, int64_t nbits) noexcept -> bool {
+  const int64_t full_bytes = nbits / 8;
+  const __m128i ones = _mm_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 16 <= full_bytes; i += 16) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&src[i]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(value, ones)) != 0xffff) {
+      return false;
+    }
+  }
+
+  return AllScalarFrom(src, i, nbits);
+}
+
+auto PackSse2(const uint8_t *values, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  const __m128i zero = _mm_setzero_si128();
+  int64_t i = 0;
+  for (; i + 16 <= nbits; i += 16) {
+    const __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&values[i]));
+    const auto bits = static_cast<uint16_t>(
+        ~_mm_movemask_epi8(_mm_cmpeq_epi8(value, zero)));
+    memcpy(&out[i / 8], &bits, sizeof(bits));
+  }
+
+  PackScalarFrom(values, out, i, nbits);
+}
+
+auto UnpackSse2(const uint8_t *bits, uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  // byte k of each 8 byte group selects bit k of the source byte
+  const __m128i select = _mm_set1_epi64x(0x8040201008040201);
+  const __m128i one = _mm_set1_epi8(1);
+  int64_t i = 0;
+  for (; i + 16 <= nbits; i += 16) {
+    uint16_t word;
+    memcpy(&word, &bits[i / 8], sizeof(word));
+    // broadcast source byte 0 into output bytes 0-7 and byte 1 into 8-15
+    __m128i value = _mm_cvtsi32_si128(word);
+    value = _mm_unpacklo_epi8(value, value);
+    value = _mm_unpacklo_epi16(value, value);
+    value = _mm_unpacklo_epi32(value, value);
+    const __m128i is_set =
+        _mm_cmpeq_epi8(_mm_and_si128(value, select), select);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i]),
+                     _mm_and_si128(is_set, one));
+  }
+
+  UnpackScalarFrom(bits, out, i, nbits);
+}
+
+constexpr KernelTable kSse2Kernels{
+    Isa::SSE2,
+    &BinarySse2<BitwiseOp::And>,
+    &BinarySse2<BitwiseOp::Or>,
+    &BinarySse2<BitwiseOp::Xor>,
+    &InvertSse2,
+    &BlendSse2,
+    &AnySse2,
+    &AllSse2,
+    &PackSse2,
+    &UnpackSse2,
+    &NonzeroScalar,
+    &MinMaxScalar,
+    &TakeScalar,
+    &FilterScalar,
+};
+
+template <BitwiseOp Op>
+PANDAS_MASK_TARGET_AVX2 auto BinaryAvx2(const uint8_t *lhs, const uint8_t *rhs,
+                                        uint8_t *out, int64_t nbits) noexcept
+    -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 32 <= nbytes; i += 32) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&lhs[i]));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&rhs[i]));
+    __m256i result;
+    if constexpr (Op == BitwiseOp::And) {
+      result = _mm256_and_si256(a, b);
+    } else if constexpr (Op == BitwiseOp::Or) {
+      result = _mm256_or_si256(a, b);
+    } else {
+      result = _mm256_xor_si256(a, b);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[i]), result);
+  }
+
+  BinaryScalarFrom<Op>(lhs, rhs, out, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto InvertAvx2(const uint8_t *src, uint8_t *out,
+                                        int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  const __m256i ones = _mm256_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 32 <= nbytes; i += 32) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[i]),
+                        _mm256_xor_si256(value, ones));
+  }
+
+  InvertScalarFrom(src, out, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto BlendAvx2(const uint8_t *selector,
+                                       const uint8_t *values, uint8_t *dst,
+                                       int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 32 <= nbytes; i += 32) {
+    const __m256i select =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&selector[i]));
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&values[i]));
+    const __m256i result =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&dst[i]));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&dst[i]),
+                        _mm256_or_si256(_mm256_andnot_si256(select, result),
+                                        _mm256_and_si256(value, select)));
+  }
+
+  BlendScalarFrom(selector, values, dst, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto AnyAvx2(const uint8_t *src, int64_t nbits) noexcept
+    -> bool {
+  const int64_t full_bytes = nbits / 8;
+  int64_t i = 0;
+  for (; i + 32 <= full_bytes; i += 32) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i]));
+    if (!_mm256_testz_si256(value, value)) {
+      return true;
+    }
+  }
+
+  return AnyScalarFrom(src, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto AllAvx2(const uint8_t *src, int64_t nbits) noexcept
+    -> bool {
+  const int64_t full_bytes = nbits / 8;
+  const __m256i ones = _mm256_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 32 <= full_bytes; i += 32) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&src[i]));
+    // testc is set when every bit of ones is also set in value
+    if (!_mm256_testc_si256(value, ones)) {
+      return false;
+    }
+  }
+
+  return AllScalarFrom(src, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto PackAvx2(const uint8_t *values, uint8_t *out,
+                                      int64_t nbits) noexcept -> void {
+  const __m256i zero = _mm256_setzero_si256();
+  int64_t i = 0;
+  for (; i + 32 <= nbits; i += 32) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&values[i]));
+    const auto bits = static_cast<uint32_t>(
+        ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(value, zero)));
+    memcpy(&out[i / 8], &bits, sizeof(bits));
+  }
+
+  PackScalarFrom(values, out, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto UnpackAvx2(const uint8_t *bits, uint8_t *out,
+                                        int64_t nbits) noexcept -> void {
+  // shuffle source byte k into output bytes [8k, 8k + 8); each 128 bit lane
+  // indexes within itself so the upper lane selects bytes 2 and 3
+  const __m256i spread = _mm256_setr_epi8(
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 2, 2, 2, 2, 3,
+      3, 3, 3, 3, 3, 3, 3);
+  const __m256i select = _mm256_set1_epi64x(0x8040201008040201);
+  const __m256i one = _mm256_set1_epi8(1);
+  int64_t i = 0;
+  for (; i + 32 <= nbits; i += 32) {
+    uint32_t word;
+    memcpy(&word, &bits[i / 8], sizeof(word));
+    const __m256i value =
+        _mm256_shuffle_epi8(_mm256_set1_epi32(static_cast<int>(word)), spread);
+    const __m256i is_set =
+        _mm256_cmpeq_epi8(_mm256_and_si256(value, select), select);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(&out[i]),
+                        _mm256_and_si256(is_set, one));
+  }
+
+  UnpackScalarFrom(bits, out, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto MinMaxAvx2(const int64_t *values, int64_t n,
+                                        int64_t *min, int64_t *max) noexcept
+    -> void {
+  // AVX2 has no 64 bit min/max, so select with compares instead
+  __m256i vmin = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+  __m256i vmax = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+  int64_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(&values[i]));
+    vmin = _mm256_blendv_epi8(vmin, value, _mm256_cmpgt_epi64(vmin, value));
+    vmax = _mm256_blendv_epi8(vmax, value, _mm256_cmpgt_epi64(value, vmax));
+  }
+
+  int64_t lanes_min[4];
+  int64_t lanes_max[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes_min), vmin);
+  _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes_max), vmax);
+  *min = *std::min_element(lanes_min, lanes_min + 4);
+  *max = *std::max_element(lanes_max, lanes_max + 4);
+  MinMaxScalarFrom(values, i, n, min, max);
+}
+
+PANDAS_MASK_TARGET_AVX2 auto TakeAvx2(const uint8_t *bits, int64_t offset,
+                                      int64_t length, const int64_t *indices,
+                                      int64_t n, uint8_t *out) noexcept
+    -> void {
+  // Bytes cannot be gathered, so gather the 4 bytes from the one holding each
+  // bit instead. Those near the end of the buffer start at its last 4 bytes,
+  // with a larger shift, so that no byte past it is read
+  const int64_t nbytes = BytesForBits(offset + length);
+  int64_t i = 0;
+  if (nbytes < static_cast<int64_t>(sizeof(int32_t))) {
+    TakeScalarFrom(bits, offset, indices, i, n, out);
+    return;
+  }
+
+  const auto *base = reinterpret_cast<const int *>(bits);
+  const __m256i bias = _mm256_set1_epi64x(offset);
+  const __m256i last = _mm256_set1_epi64x(nbytes - sizeof(int32_t));
+  const __m256i minus_one = _mm256_set1_epi64x(-1);
+  // moves the low half of each 64 bit lane into the low 128 bits
+  const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+
+  for (; i + 8 <= n; i += 8) {
+    int byte = 0;
+    for (int half = 0; half < 2; half++) {
+      const __m256i index = _mm256_loadu_si256(
+          reinterpret_cast<const __m256i *>(&indices[i + 4 * half]));
+      const __m256i pos = _mm256_add_epi64(index, bias);
+      __m256i byte_index = _mm256_srli_epi64(pos, 3);
+      byte_index = _mm256_blendv_epi8(byte_index, last,
+                                      _mm256_cmpgt_epi64(byte_index, last));
+      // negative indices are masked off and so read as zero
+      const __m128i valid = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+          _mm256_cmpgt_epi64(index, minus_one), narrow));
+      const __m128i gathered = _mm256_mask_i64gather_epi32(
+          _mm_setzero_si128(), base, byte_index, valid, 1);
+      // at most 31, as byte_index is at most 3 bytes before pos
+      const __m128i shift = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+          _mm256_sub_epi64(pos, _mm256_slli_epi64(byte_index, 3)), narrow));
+      const __m128i bit = _mm_slli_epi32(_mm_srlv_epi32(gathered, shift), 31);
+      byte |= _mm_movemask_ps(_mm_castsi128_ps(bit)) << (4 * half);
+    }
+    out[i / 8] = static_cast<uint8_t>(byte);
+  }
+
+  TakeScalarFrom(bits, offset, indices, i, n, out);
+}
+
+PANDAS_MASK_TARGET_BMI2 auto FilterBmi2(const uint8_t *values,
+                                        int64_t values_offset,
+                                        const uint8_t *selector,
+                                        int64_t selector_offset, int64_t nbits,
+                                        uint8_t *out) noexcept -> int64_t {
+  return FilterWith(
+      values, values_offset, selector, selector_offset, nbits, out,
+      [](uint64_t value, uint64_t select)
+          PANDAS_MASK_TARGET_BMI2 { return _pext_u64(value, select); });
+}
+
+constexpr KernelTable kAvx2Kernels{
+    Isa::AVX2,
+    &BinaryAvx2<BitwiseOp::And>,
+    &BinaryAvx2<BitwiseOp::Or>,
+    &BinaryAvx2<BitwiseOp::Xor>,
+    &InvertAvx2,
+    &BlendAvx2,
+    &AnyAvx2,
+    &AllAvx2,
+    &PackAvx2,
+    &UnpackAvx2,
+    &NonzeroScalar,
+    &MinMaxAvx2,
+    &TakeAvx2,
+    &FilterBmi2,
+};
+
+template <BitwiseOp Op>
+PANDAS_MASK_TARGET_AVX512 auto BinaryAvx512(const uint8_t *lhs,
+                                            const uint8_t *rhs, uint8_t *out,
+                                            int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 64 <= nbytes; i += 64) {
+    const __m512i a = _mm512_loadu_si512(&lhs[i]);
+    const __m512i b = _mm512_loadu_si512(&rhs[i]);
+    __m512i result;
+    if constexpr (Op == BitwiseOp::And) {
+      result = _mm512_and_si512(a, b);
+    } else if constexpr (Op == BitwiseOp::Or) {
+      result = _mm512_or_si512(a, b);
+    } else {
+      result = _mm512_xor_si512(a, b);
+    }
+    _mm512_storeu_si512(&out[i], result);
+  }
+
+  BinaryScalarFrom<Op>(lhs, rhs, out, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto InvertAvx512(const uint8_t *src, uint8_t *out,
+                                            int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  const __m512i ones = _mm512_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 64 <= nbytes; i += 64) {
+    const __m512i value = _mm512_loadu_si512(&src[i]);
+    _mm512_storeu_si512(&out[i], _mm512_xor_si512(value, ones));
+  }
+
+  InvertScalarFrom(src, out, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto BlendAvx512(const uint8_t *selector,
+                                           const uint8_t *values, uint8_t *dst,
+                                           int64_t nbits) noexcept -> void {
+  const int64_t nbytes = BytesForBits(nbits);
+  int64_t i = 0;
+  for (; i + 64 <= nbytes; i += 64) {
+    const __m512i select = _mm512_loadu_si512(&selector[i]);
+    const __m512i value = _mm512_loadu_si512(&values[i]);
+    const __m512i result = _mm512_loadu_si512(&dst[i]);
+    // 0xca is the truth table of select ? value : result
+    _mm512_storeu_si512(&dst[i],
+                        _mm512_ternarylogic_epi64(select, value, result, 0xca));
+  }
+
+  BlendScalarFrom(selector, values, dst, i, nbytes);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto AnyAvx512(const uint8_t *src,
+                                         int64_t nbits) noexcept -> bool {
+  const int64_t full_bytes = nbits / 8;
+  int64_t i = 0;
+  for (; i + 64 <= full_bytes; i += 64) {
+    const __m512i value = _mm512_loadu_si512(&src[i]);
+    if (_mm512_test_epi64_mask(value, value) != 0) {
+      return true;
+    }
+  }
+
+  return AnyScalarFrom(src, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto AllAvx512(const uint8_t *src,
+                                         int64_t nbits) noexcept -> bool {
+  const int64_t full_bytes = nbits / 8;
+  const __m512i ones = _mm512_set1_epi32(-1);
+  int64_t i = 0;
+  for (; i + 64 <= full_bytes; i += 64) {
+    const __m512i value = _mm512_loadu_si512(&src[i]);
+    if (_mm512_cmpneq_epi64_mask(value, ones) != 0) {
+      return false;
+    }
+  }
+
+  return AllScalarFrom(src, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto PackAvx512(const uint8_t *values, uint8_t *out,
+                                          int64_t nbits) noexcept -> void {
+  int64_t i = 0;
+  for (; i + 64 <= nbits; i += 64) {
+    const __m512i value = _mm512_loadu_si512(&values[i]);
+    const uint64_t bits = _mm512_test_epi8_mask(value, value);
+    memcpy(&out[i / 8], &bits, sizeof(bits));
+  }
+
+  PackScalarFrom(values, out, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto UnpackAvx512(const uint8_t *bits, uint8_t *out,
+                                            int64_t nbits) noexcept -> void {
+  const __m512i one = _mm512_set1_epi8(1);
+  int64_t i = 0;
+  for (; i + 64 <= nbits; i += 64) {
+    uint64_t word;
+    memcpy(&word, &bits[i / 8], sizeof(word));
+    _mm512_storeu_si512(&out[i], _mm512_maskz_mov_epi8(word, one));
+  }
+
+  UnpackScalarFrom(bits, out, i, nbits);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto NonzeroAvx512(const uint8_t *bits,
+                                             int64_t nbits, int64_t base,
+                                             int64_t *out) noexcept
+    -> int64_t {
+  // Skips 512 bits per test through the empty stretches of a sparse mask.
+  // Words with more than a few set bits are written with compress, eight
+  // indices per step, instead of one countr_zero per bit
+  const __m512i lanes = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+  int64_t count = 0;
+  int64_t i = 0;
+  for (; i + 512 <= nbits; i += 512) {
+    const __m512i block = _mm512_loadu_si512(&bits[i / 8]);
+    if (_mm512_test_epi64_mask(block, block) == 0) {
+      continue;
+    }
+
+    for (int64_t j = i; j < i + 512; j += 64) {
+      uint64_t word;
+      memcpy(&word, &bits[j / 8], sizeof(word));
+      if (std::popcount(word) <= 8) {
+        while (word != 0) {
+          out[count++] = base + j + std::countr_zero(word);
+          word &= word - 1;
+        }
+        continue;
+      }
+
+      for (int64_t k = 0; k < 64; k += 8) {
+        const auto byte = static_cast<__mmask8>(word >> k);
+        const __m512i indices =
+            _mm512_add_epi64(lanes, _mm512_set1_epi64(base + j + k));
+        const int nset = std::popcount(static_cast<unsigned>(byte));
+        _mm512_mask_storeu_epi64(
+            &out[count], static_cast<__mmask8>((1u << nset) - 1),
+            _mm512_maskz_compress_epi64(byte, indices));
+        count += nset;
+      }
+    }
+  }
+
+  return count + NonzeroScalarFrom(bits, i, nbits, base, &out[count]);
+}
+
+PANDAS_MASK_TARGET_AVX512 auto MinMaxAvx512(const int64_t *values, int64_t n,
+                                            int64_t *min, int64_t *max) noexcept
+    -> void {
+  __m512i vmin = _mm512_set1_epi64(std::numeric_limits<int64_t>::max());
+  __m512i vmax = _mm512_set1_epi64(std::numeric_limits<int64_t>::min());
+  int64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512i value = _mm512_loadu_si512(&values[i]);
+    vmin = _mm512_mask_blend_epi64(_mm512_cmpgt_epi64_mask(vmin, value), vmin,
+                                   value);
+    vmax = _mm512_mask_blend_epi64(_mm512_cmpgt_epi64_mask(value, vmax), vmax,
+                                   value);
+  }
+
+  int64_t lanes_min[8];
+  int64_t lanes_max[8];
+  _mm512_storeu_si512(lanes_min, vmin);
+  _mm512_storeu_si512(lanes_max, vmax);
+  *min = *std::min_element(lanes_min, lanes_min + 8);
+  *max = *std::max_element(lanes_max, lanes_max + 8);
+  MinMaxScalarFrom(values, i, n, min, max);
+}
+
+constexpr KernelTable kAvx512Kernels{
+    Isa::AVX512,
+    &BinaryAvx512<BitwiseOp::And>,
+    &BinaryAvx512<BitwiseOp::Or>,
+    &BinaryAvx512<BitwiseOp::Xor>,
+    &InvertAvx512,
+    &BlendAvx512,
+    &AnyAvx512,
+    &AllAvx512,
+    &PackAvx512,
+    &UnpackAvx512,
+    &NonzeroAvx512,
+    &MinMaxAvx512,
+    &TakeAvx2,
+    &FilterBmi2,
+};
+
+#if defined(_MSC_VER) && !defined(__clang__)
+auto CpuidRegister(int leaf, int subleaf, int reg) noexcept -> int {
+  int info[4];
+  __cpuidex(info, leaf, subleaf);
+  return info[reg];
+}
+#endif
+
+#endif // PANDAS_MASK_X86_64
+
+} // namespace
+
+auto CopyBits(const uint8_t *src, int64_t src_offset, uint8_t *dst,
+              int64_t dst_offset, int64_t nbits) noexcept -> void {
+  // bring the destination to a byte boundary so the bulk can be written as
+  // whole words
+  const int64_t head = std::min(nbits, (8 - dst_offset % 8) % 8);
+  if (head > 0) {
+    StoreBits(dst, dst_offset, LoadBits(src, src_offset, head), head);
+  }
+  src_offset += head;
+  dst_offset += head;
+  nbits -= head;
+
+  if (src_offset % 8 == 0) {
+    const int64_t nbytes = nbits / 8;
+    if (nbytes > 0) {
+      memcpy(&dst[dst_offset / 8], &src[src_offset / 8], nbytes);
+    }
+    const int64_t tail = nbits % 8;
+    if (tail > 0) {
+      StoreBits(dst, dst_offset + nbytes * 8,
+                LoadBits(src, src_offset + nbytes * 8, tail), tail);
+    }
+    return;
+  }
+
+  int64_t i = 0;
+  for (; i + 64 <= nbits; i += 64) {
+    const uint64_t word = LoadBits(src, src_offset + i, 64);
+    memcpy(&dst[(dst_offset + i) / 8], &word, sizeof(word));
+  }
+  if (i < nbits) {
+    StoreBits(dst, dst_offset + i, LoadBits(src, src_offset + i, nbits - i),
+              nbits - i);
+  }
+}
+
+auto IsaName(Isa isa) noexcept -> const char * {
+  switch (isa) {
+  case Isa::Scalar:
+    return "scalar";
+  case Isa::SSE2:
+    return "sse2";
+  case Isa::AVX2:
+    return "avx2";
+  case Isa::AVX512:
+    return "avx512";
+  }
+
+  return "unknown";
+}
+
+auto DetectIsa() noexcept -> Isa {
+#if PANDAS_MASK_X86_64
+#if defined(__GNUC__) || defined(__clang__)
+  // __builtin_cpu_supports also verifies the OS saves the wider registers
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("bmi2")) {
+    return Isa::SSE2;
+  }
+  if (__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512bw")) {
+    return Isa::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return Isa::AVX2;
+  }
+  return Isa::SSE2;
+#else
+  constexpr int ecx = 2;
+  constexpr int ebx = 1;
+  const bool osxsave = (CpuidRegister(1, 0, ecx) >> 27) & 1;
+  if (!osxsave) {
+    return Isa::SSE2;
+  }
+
+  const auto xcr0 = _xgetbv(0);
+  const bool os_avx = (xcr0 & 0x6) == 0x6;
+  const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+  const int features = CpuidRegister(7, 0, ebx);
+  const bool bmi2 = (features >> 8) & 1;
+  if (!bmi2) {
+    return Isa::SSE2;
+  }
+  if (os_avx512 && ((features >> 16) & 1) && ((features >> 30) & 1)) {
+    return Isa::AVX512;
+  }
+  if (os_avx && ((features >> 5) & 1)) {
+    return Isa::AVX2;
+  }
+  return Isa::SSE2;
+#endif
+#else
+  return Isa::Scalar;
+#endif
+}
+
+auto IsaSupported(Isa isa) noexcept -> bool {
+  return static_cast<int>(isa) <= static_cast<int>(DetectIsa());
+}
+
+auto GetKernels(Isa isa) -> const KernelTable & {
+  if (!IsaSupported(isa)) {
+    throw std::invalid_argument("instruction set not supported by this host");
+  }
+
+  switch (isa) {
+#if PANDAS_MASK_X86_64
+  case Isa::AVX512:
+    return kAvx512Kernels;
+  case Isa::AVX2:
+    return kAvx2Kernels;
+  case Isa::SSE2:
+    return kSse2Kernels;
+#endif
+  default:
+    return kScalarKernels;
+  }
+}
+
+auto ActiveKernels() noexcept -> const KernelTable & {
+  static const KernelTable &kernels = GetKernels(DetectIsa());
+  return kernels;
+}
+
+} // namespace pandas_mask::kernels
@@ -0,0 +1,161 @@
+/// Word and SIMD kernels operating on raw bitmap buffers
+/// Nothing in this module may use the Python runtime
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+namespace pandas_mask::kernels {
+
+// Words are assembled with memcpy, which only matches the Arrow (LSB first)
+// bit order on little endian hosts
+static_assert(std::endian::native == std::endian::little);
+
+/// Mask with the lowest nbits set, for nbits in [0, 64]
+constexpr auto LowBits(int64_t nbits) noexcept -> uint64_t {
+  return nbits >= 64 ? UINT64_MAX : (uint64_t{1} << nbits) - 1;
+}
+
+/// Reads nbits (at most 64) starting at an arbitrary bit offset into the low
+/// bits of a word. Only the bytes covering [offset, offset + nbits) are read
+inline auto LoadBits(const uint8_t *data, int64_t offset,
+                     int64_t nbits) noexcept -> uint64_t {
+  if (nbits <= 0) {
+    return 0;
+  }
+
+  const uint8_t *src = &data[offset / 8];
+  const int shift = offset % 8;
+  const int64_t nbytes = (shift + nbits + 7) / 8;
+
+  uint64_t word = 0;
+  memcpy(&word, src, nbytes < 8 ? nbytes : 8);
+  word >>= shift;
+  if (nbytes > 8) {
+    word |= static_cast<uint64_t>(src[8]) << (64 - shift);
+  }
+  return word & LowBits(nbits);
+}
+
+/// Reads nbits starting at an arbitrary bit offset into (nbits + 63) / 64
+/// words, zeroing any bits past nbits in the last one. A byte-aligned
+/// offset is read with a single memcpy
+inline auto LoadWords(const uint8_t *data, int64_t offset, int64_t nbits,
+                      uint64_t *words) noexcept -> void {
+  if (nbits <= 0) {
+    return;
+  }
+
+  const int64_t nwords = (nbits + 63) / 64;
+  if (offset % 8 == 0) {
+    words[nwords - 1] = 0;
+    memcpy(words, &data[offset / 8], (nbits + 7) / 8);
+  } else {
+    for (int64_t i = 0; i < nwords; i++) {
+      const int64_t remaining = nbits - i * 64;
+      words[i] =
+          LoadBits(data, offset + i * 64, remaining < 64 ? remaining : 64);
+    }
+  }
+  words[nwords - 1] &= LowBits(nbits - (nwords - 1) * 64);
+}
+
+/// Writes the low nbits (at most 64) of value starting at an arbitrary bit
+/// offset, leaving every bit outside of [offset, offset + nbits) untouched
+inline auto StoreBits(uint8_t *data, int64_t offset, uint64_t value,
+                      int64_t nbits) noexcept -> void {
+  if (nbits <= 0) {
+    return;
+  }
+
+  uint8_t *dst = &data[offset / 8];
+  const int shift = offset % 8;
+  if (shift == 0 && nbits == 64) {
+    memcpy(dst, &value, sizeof(value));
+    return;
+  }
+
+  const uint64_t mask = LowBits(nbits);
+  value &= mask;
+  const int64_t nbytes = (shift + nbits + 7) / 8;
+  const int64_t low_bytes = nbytes < 8 ? nbytes : 8;
+
+  uint64_t word = 0;
+  memcpy(&word, dst, low_bytes);
+  word = (word & ~(mask << shift)) | (value << shift);
+  memcpy(dst, &word, low_bytes);
+  if (nbytes > 8) {
+    const auto high_mask = static_cast<uint8_t>(mask >> (64 - shift));
+    const auto high_value = static_cast<uint8_t>(value >> (64 - shift));
+    dst[8] = static_cast<uint8_t>((dst[8] & ~high_mask) | high_value);
+  }
+}
+
+/// Copies nbits from src starting at bit src_offset to dst starting at bit
+/// dst_offset. Bits of dst outside of the destination range are preserved
+auto CopyBits(const uint8_t *src, int64_t src_offset, uint8_t *dst,
+              int64_t dst_offset, int64_t nbits) noexcept -> void;
+
+/// Instruction set a KernelTable was compiled for, ordered from least to most
+/// capable. The AVX2 and AVX512 levels also require BMI2
+enum class Isa { Scalar, SSE2, AVX2, AVX512 };
+
+/// Function table shared by all bitmap operations. Every kernel takes a
+/// length in bits and operates on the bytes that cover it; Any/All ignore any
+/// padding bits in the final byte
+struct KernelTable {
+  Isa isa;
+  void (*bitwise_and)(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                      int64_t nbits) noexcept;
+  void (*bitwise_or)(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                     int64_t nbits) noexcept;
+  void (*bitwise_xor)(const uint8_t *lhs, const uint8_t *rhs, uint8_t *out,
+                      int64_t nbits) noexcept;
+  void (*invert)(const uint8_t *src, uint8_t *out, int64_t nbits) noexcept;
+  /// dst = (dst & ~selector) | (values & selector)
+  void (*blend)(const uint8_t *selector, const uint8_t *values, uint8_t *dst,
+                int64_t nbits) noexcept;
+  bool (*any)(const uint8_t *src, int64_t nbits) noexcept;
+  bool (*all)(const uint8_t *src, int64_t nbits) noexcept;
+  /// Packs one byte per value (non-zero meaning true) into bits, zeroing any
+  /// padding bits in the final byte
+  void (*pack)(const uint8_t *values, uint8_t *out, int64_t nbits) noexcept;
+  /// Expands bits into one 0/1 byte per value
+  void (*unpack)(const uint8_t *bits, uint8_t *out, int64_t nbits) noexcept;
+  /// Writes base + i for every set bit i, in order, and returns how many were
+  /// written. out must have room for one index per set bit
+  int64_t (*nonzero)(const uint8_t *bits, int64_t nbits, int64_t base,
+                     int64_t *out) noexcept;
+  /// Smallest and largest of n > 0 values, used to bounds check indices in a
+  /// single pass before they are used
+  void (*min_max)(const int64_t *values, int64_t n, int64_t *min,
+                  int64_t *max) noexcept;
+  /// Gathers bit offset + indices[i] of bits into bit i of out for n indices,
+  /// zeroing padding bits. bits holds offset + length bits, and no byte past
+  /// them is read. Negative indices produce a zero bit; all others must
+  /// already be less than length
+  void (*take)(const uint8_t *bits, int64_t offset, int64_t length,
+               const int64_t *indices, int64_t n, uint8_t *out) noexcept;
+  /// Appends bit i of values to out, starting from bit 0, for every i in
+  /// [0, nbits) where bit i of selector is set. Returns the number of bits
+  /// written; out must have room for one bit per set selector bit
+  int64_t (*filter)(const uint8_t *values, int64_t values_offset,
+                    const uint8_t *selector, int64_t selector_offset,
+                    int64_t nbits, uint8_t *out) noexcept;
+};
+
+auto IsaName(Isa isa) noexcept -> const char *;
+
+/// Most capable instruction set supported by both this build and the host CPU
+auto DetectIsa() noexcept -> Isa;
+auto IsaSupported(Isa isa) noexcept -> bool;
+
+/// Kernels for a specific instruction set. Throws std::invalid_argument if the
+/// host cannot run them
+auto GetKernels(Isa isa) -> const KernelTable &;
+
+/// Kernels selected once via CPUID when the module is loaded
+auto ActiveKernels() noexcept -> const KernelTable &;
+
+} // namespace pandas_mask::kernels
@@ -0,0 +1,373 @@
+#include "pandas_mask_kernels.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+using pandas_mask::kernels::GetKernels;
+using pandas_mask::kernels::Isa;
+using pandas_mask::kernels::IsaName;
+using pandas_mask::kernels::IsaSupported;
+
+namespace {
+
+auto BitGet(const std::vector<uint8_t> &bits, int64_t i) -> bool {
+  return (bits[i / 8] >> (i % 8)) & 1;
+}
+
+auto RandomBytes(std::mt19937 &rng, int64_t nbits) -> std::vector<uint8_t> {
+  std::uniform_int_distribution<int> dist(0, 255);
+  std::vector<uint8_t> bytes((nbits + 7) / 8);
+  for (auto &byte : bytes) {
+    byte = static_cast<uint8_t>(dist(rng));
+  }
+  return bytes;
+}
+
+auto ExpectBitsEqual(const std::vector<uint8_t> &expected,
+                     const std::vector<uint8_t> &result, int64_t nbits)
+    -> void {
+  for (int64_t i = 0; i < nbits; i++) {
+    ASSERT_EQ(BitGet(expected, i), BitGet(result, i))
+        << "bit " << i << " of " << nbits;
+  }
+}
+
+} // namespace
+
+class PandasMaskKernelsTest : public testing::TestWithParam<Isa> {
+protected:
+  void SetUp() override {
+    if (!IsaSupported(GetParam())) {
+      GTEST_SKIP() << IsaName(GetParam()) << " not supported by this host";
+    }
+  }
+
+  // Lengths cover empty, sub-byte, byte-aligned and every SIMD width with
+  // ragged tails on either side
+  static auto Lengths() -> std::vector<int64_t> {
+    std::vector<int64_t> lengths{0, 1, 7, 8, 9, 63, 64, 65, 127, 128, 129,
+                                 255, 256, 257, 511, 512, 513, 1023, 1024};
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int64_t> dist(0, 5000);
+    for (int i = 0; i < 50; i++) {
+      lengths.push_back(dist(rng));
+    }
+    return lengths;
+  }
+};
+
+TEST_P(PandasMaskKernelsTest, BinaryOpsMatchScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(1);
+
+  for (const auto nbits : Lengths()) {
+    const auto lhs = RandomBytes(rng, nbits);
+    const auto rhs = RandomBytes(rng, nbits);
+    std::vector<uint8_t> expected(lhs.size());
+    std::vector<uint8_t> result(lhs.size());
+
+    scalar.bitwise_and(lhs.data(), rhs.data(), expected.data(), nbits);
+    kernels.bitwise_and(lhs.data(), rhs.data(), result.data(), nbits);
+    ExpectBitsEqual(expected, result, nbits);
+
+    scalar.bitwise_or(lhs.data(), rhs.data(), expected.data(), nbits);
+    kernels.bitwise_or(lhs.data(), rhs.data(), result.data(), nbits);
+    ExpectBitsEqual(expected, result, nbits);
+
+    scalar.bitwise_xor(lhs.data(), rhs.data(), expected.data(), nbits);
+    kernels.bitwise_xor(lhs.data(), rhs.data(), result.data(), nbits);
+    ExpectBitsEqual(expected, result, nbits);
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, InvertMatchesScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(2);
+
+  for (const auto nbits : Lengths()) {
+    const auto src = RandomBytes(rng, nbits);
+    std::vector<uint8_t> expected(src.size());
+    std::vector<uint8_t> result(src.size());
+
+    scalar.invert(src.data(), expected.data(), nbits);
+    kernels.invert(src.data(), result.data(), nbits);
+    ExpectBitsEqual(expected, result, nbits);
+    for (int64_t i = 0; i < nbits; i++) {
+      ASSERT_NE(BitGet(src, i), BitGet(result, i));
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, BlendMatchesScalar) {
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(11);
+
+  for (const auto nbits : Lengths()) {
+    const auto selector = RandomBytes(rng, nbits);
+    const auto values = RandomBytes(rng, nbits);
+    const auto original = RandomBytes(rng, nbits);
+    auto result = original;
+
+    kernels.blend(selector.data(), values.data(), result.data(), nbits);
+    for (int64_t i = 0; i < nbits; i++) {
+      ASSERT_EQ(BitGet(result, i), BitGet(selector, i) ? BitGet(values, i)
+                                                       : BitGet(original, i));
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, AnyAllMatchScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(3);
+
+  for (const auto nbits : Lengths()) {
+    // start from uniform buffers whose padding bits disagree with the data,
+    // then flip a single random bit so the result hinges on one position
+    std::vector<uint8_t> zeros((nbits + 7) / 8, 0x0);
+    std::vector<uint8_t> ones((nbits + 7) / 8, 0xff);
+    if (nbits % 8 != 0) {
+      zeros.back() = static_cast<uint8_t>(0xff << (nbits % 8));
+      ones.back() = static_cast<uint8_t>(~(0xff << (nbits % 8)));
+    }
+
+    ASSERT_EQ(kernels.any(zeros.data(), nbits), false);
+    ASSERT_EQ(kernels.all(zeros.data(), nbits), nbits == 0);
+    ASSERT_EQ(kernels.any(ones.data(), nbits), nbits != 0);
+    ASSERT_EQ(kernels.all(ones.data(), nbits), true);
+
+    if (nbits == 0) {
+      continue;
+    }
+
+    std::uniform_int_distribution<int64_t> dist(0, nbits - 1);
+    const auto pos = dist(rng);
+    zeros[pos / 8] ^= static_cast<uint8_t>(1 << (pos % 8));
+    ones[pos / 8] ^= static_cast<uint8_t>(1 << (pos % 8));
+
+    ASSERT_EQ(kernels.any(zeros.data(), nbits),
+              scalar.any(zeros.data(), nbits));
+    ASSERT_EQ(kernels.any(zeros.data(), nbits), true);
+    ASSERT_EQ(kernels.all(ones.data(), nbits),
+              scalar.all(ones.data(), nbits));
+    ASSERT_EQ(kernels.all(ones.data(), nbits), false);
+
+    const auto random = RandomBytes(rng, nbits);
+    ASSERT_EQ(kernels.any(random.data(), nbits),
+              scalar.any(random.data(), nbits));
+    ASSERT_EQ(kernels.all(random.data(), nbits),
+              scalar.all(random.data(), nbits));
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, PackMatchesScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(4);
+  std::uniform_int_distribution<int> dist(0, 3);
+
+  for (const auto nbits : Lengths()) {
+    // mostly 0/1 like NumPy bools, with some other non-zero bytes mixed in
+    std::vector<uint8_t> values(nbits);
+    for (auto &value : values) {
+      const auto draw = dist(rng);
+      value = draw == 3 ? 0x80 : static_cast<uint8_t>(draw & 1);
+    }
+    std::vector<uint8_t> expected((nbits + 7) / 8, 0xaa);
+    std::vector<uint8_t> result((nbits + 7) / 8, 0x55);
+
+    scalar.pack(values.data(), expected.data(), nbits);
+    kernels.pack(values.data(), result.data(), nbits);
+    ASSERT_EQ(expected, result);
+    for (int64_t i = 0; i < nbits; i++) {
+      ASSERT_EQ(BitGet(result, i), values[i] != 0);
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, UnpackMatchesScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(5);
+
+  for (const auto nbits : Lengths()) {
+    const auto bits = RandomBytes(rng, nbits);
+    std::vector<uint8_t> expected(nbits, 0xaa);
+    std::vector<uint8_t> result(nbits, 0x55);
+
+    scalar.unpack(bits.data(), expected.data(), nbits);
+    kernels.unpack(bits.data(), result.data(), nbits);
+    ASSERT_EQ(expected, result);
+    for (int64_t i = 0; i < nbits; i++) {
+      ASSERT_EQ(result[i], BitGet(bits, i));
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, NonzeroMatchesScalar) {
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(7);
+
+  for (const auto nbits : Lengths()) {
+    // sparse, mixed and dense masks so both the skip and compress paths run
+    for (const int density : {0, 1, 50, 95, 100}) {
+      std::bernoulli_distribution dist(density / 100.0);
+      std::vector<uint8_t> bits((nbits + 7) / 8, 0);
+      std::vector<int64_t> expected;
+      for (int64_t i = 0; i < nbits; i++) {
+        if (dist(rng)) {
+          bits[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+          expected.push_back(i + 5);
+        }
+      }
+      // padding bits must be ignored
+      if (nbits % 8 != 0) {
+        bits.back() |= static_cast<uint8_t>(0xff << (nbits % 8));
+      }
+
+      std::vector<int64_t> result(expected.size() + 1, -1);
+      const auto count = kernels.nonzero(bits.data(), nbits, 5, result.data());
+      ASSERT_EQ(count, static_cast<int64_t>(expected.size()));
+      result.pop_back();
+      ASSERT_EQ(result, expected);
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, MinMaxMatchesScalar) {
+  const auto &scalar = GetKernels(Isa::Scalar);
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(8);
+  std::uniform_int_distribution<int64_t> dist(INT64_MIN, INT64_MAX);
+
+  for (const auto n : Lengths()) {
+    if (n == 0) {
+      continue;
+    }
+    std::vector<int64_t> values(n);
+    for (auto &value : values) {
+      value = dist(rng);
+    }
+
+    int64_t expected_min, expected_max, min, max;
+    scalar.min_max(values.data(), n, &expected_min, &expected_max);
+    kernels.min_max(values.data(), n, &min, &max);
+    ASSERT_EQ(min, *std::min_element(values.begin(), values.end()));
+    ASSERT_EQ(max, *std::max_element(values.begin(), values.end()));
+    ASSERT_EQ(min, expected_min);
+    ASSERT_EQ(max, expected_max);
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, TakeMatchesScalar) {
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(9);
+
+  for (const auto n : Lengths()) {
+    // take from a buffer whose bits start at every alignment, including
+    // indices at both ends so gathered words reach its first and last bytes,
+    // and from one too short to gather a word from at all
+    for (const auto &[offset, nbits] :
+         {std::pair<int64_t, int64_t>{0, 100}, {3, 100}, {13, 100}, {3, 9}}) {
+      const auto bits = RandomBytes(rng, offset + nbits);
+      std::uniform_int_distribution<int64_t> dist(-1, nbits - 1);
+      std::vector<int64_t> indices(n);
+      for (auto &index : indices) {
+        index = dist(rng);
+      }
+      if (n >= 2) {
+        indices[0] = 0;
+        indices[n - 1] = nbits - 1;
+      }
+
+      std::vector<uint8_t> result((n + 7) / 8, 0xaa);
+      kernels.take(bits.data(), offset, nbits, indices.data(), n,
+                   result.data());
+      for (int64_t i = 0; i < n; i++) {
+        const bool expected =
+            indices[i] >= 0 && BitGet(bits, offset + indices[i]);
+        ASSERT_EQ(BitGet(result, i), expected) << i;
+      }
+      for (int64_t i = n; i < static_cast<int64_t>(result.size()) * 8; i++) {
+        ASSERT_FALSE(BitGet(result, i));
+      }
+    }
+  }
+}
+
+TEST_P(PandasMaskKernelsTest, FilterMatchesScalar) {
+  const auto &kernels = GetKernels(GetParam());
+  std::mt19937 rng(10);
+
+  for (const auto nbits : Lengths()) {
+    for (const int density : {0, 10, 50, 100}) {
+      for (const int64_t values_offset : {0, 5}) {
+        const int64_t selector_offset = 11;
+        const auto values = RandomBytes(rng, values_offset + nbits);
+        std::bernoulli_distribution dist(density / 100.0);
+        std::vector<uint8_t> selector((selector_offset + nbits + 7) / 8, 0xff);
+        std::vector<bool> expected;
+        for (int64_t i = 0; i < nbits; i++) {
+          const int64_t pos = selector_offset + i;
+          if (dist(rng)) {
+            expected.push_back(BitGet(values, values_offset + i));
+          } else {
+            selector[pos / 8] &= static_cast<uint8_t>(~(1 << (pos % 8)));
+          }
+        }
+
+        std::vector<uint8_t> result((expected.size() + 7) / 8, 0xaa);
+        const auto written =
+            kernels.filter(values.data(), values_offset, selector.data(),
+                           selector_offset, nbits, result.data());
+        ASSERT_EQ(written, static_cast<int64_t>(expected.size()));
+        for (size_t i = 0; i < expected.size(); i++) {
+          ASSERT_EQ(BitGet(result, i), expected[i]) << i;
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Isas, PandasMaskKernelsTest,
+                         testing::Values(Isa::Scalar, Isa::SSE2, Isa::AVX2,
+                                         Isa::AVX512),
+                         [](const testing::TestParamInfo<Isa> &info) {
+                           return std::string(IsaName(info.param));
+                         });
+
+TEST(PandasMaskKernelsDispatchTest, ActiveIsBestSupported) {
+  const auto &active = pandas_mask::kernels::ActiveKernels();
+  ASSERT_EQ(active.isa, pandas_mask::kernels::DetectIsa());
+  ASSERT_TRUE(IsaSupported(Isa::Scalar));
+}
+
+TEST(PandasMaskKernelsBitsTest, CopyBitsPreservesSurroundingBits) {
+  std::mt19937 rng(6);
+  const auto src = RandomBytes(rng, 700);
+
+  for (const int64_t src_offset : {0, 1, 5, 8, 63}) {
+    for (const int64_t dst_offset : {0, 3, 8, 17}) {
+      for (const int64_t nbits : {0, 1, 9, 64, 100, 600}) {
+        const auto original = RandomBytes(rng, 700);
+        auto dst = original;
+        pandas_mask::kernels::CopyBits(src.data(), src_offset, dst.data(),
+                                       dst_offset, nbits);
+        for (int64_t i = 0; i < 700; i++) {
+          const bool in_range = i >= dst_offset && i < dst_offset + nbits;
+          const bool expected = in_range
+                                    ? BitGet(src, src_offset + i - dst_offset)
+                                    : BitGet(original, i);
+          ASSERT_EQ(BitGet(dst, i), expected)
+              << src_offset << " " << dst_offset << " " << nbits << " " << i;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,207 @@
+/// Nullable boolean columns under Kleene's three-valued logic
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_kleene.h"
+#include "nanoarrow.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using pandas_mask::kernels::LowBits;
+
+namespace {
+
+// Words per block, as in the expression evaluator: the blocks of all four
+// inputs and both outputs stay in L1, and the loops over them vectorize
+constexpr int64_t kBlockWords = 64;
+constexpr int64_t kBlockBits = kBlockWords * 64;
+
+using Block = std::array<uint64_t, kBlockWords>;
+
+auto LoadBlock(const PandasMaskArrayImpl &mask, int64_t start, int64_t nbits,
+               Block &words) -> void {
+  pandas_mask::kernels::LoadWords(mask.Data(), mask.Offset() + start, nbits,
+                                  words.data());
+}
+
+auto AllocateBitmap(int64_t length) -> nanoarrow::UniqueBitmap {
+  nanoarrow::UniqueBitmap bitmap;
+  ArrowBitmapInit(bitmap.get());
+  NANOARROW_THROW_NOT_OK(ArrowBitmapReserve(bitmap.get(), length));
+  bitmap->size_bits = length;
+  bitmap->buffer.size_bytes = _ArrowBytesForBits(length);
+  return bitmap;
+}
+
+/// Builds the column op(lhs, rhs) a block at a time. op maps the value and
+/// validity words of each side to those of the result, which may hold
+/// anything in the value bits of missing elements
+template <typename F>
+auto Apply(const KleeneBooleanImpl &lhs, const KleeneBooleanImpl &rhs, F op)
+    -> KleeneBooleanImpl {
+  if (lhs.Length() != rhs.Length()) {
+    throw std::invalid_argument("Shape of other does not match bitmask shape");
+  }
+
+  const int64_t length = lhs.Length();
+  auto values = AllocateBitmap(length);
+  auto validity = AllocateBitmap(length);
+
+  Block a;
+  Block a_valid;
+  Block b;
+  Block b_valid;
+  Block value;
+  Block valid;
+  for (int64_t start = 0; start < length; start += kBlockBits) {
+    const int64_t nbits = std::min(kBlockBits, length - start);
+    const int64_t nwords = (nbits + 63) / 64;
+    LoadBlock(lhs.Values(), start, nbits, a);
+    LoadBlock(lhs.Validity(), start, nbits, a_valid);
+    LoadBlock(rhs.Values(), start, nbits, b);
+    LoadBlock(rhs.Validity(), start, nbits, b_valid);
+
+    // every input is zero past nbits, and each op only marks known what
+    // some input's validity does, so the result's padding stays zero
+    for (int64_t i = 0; i < nwords; i++) {
+      const auto [v, known] = op(a[i], a_valid[i], b[i], b_valid[i]);
+      value[i] = v & known;
+      valid[i] = known;
+    }
+
+    memcpy(&values->buffer.data[start / 8], value.data(),
+           _ArrowBytesForBits(nbits));
+    memcpy(&validity->buffer.data[start / 8], valid.data(),
+           _ArrowBytesForBits(nbits));
+  }
+
+  return KleeneBooleanImpl(PandasMaskArrayImpl(std::move(values)),
+                           PandasMaskArrayImpl(std::move(validity)));
+}
+
+} // namespace
+
+KleeneBooleanImpl::KleeneBooleanImpl(const PandasMaskArrayImpl &values,
+                                     const PandasMaskArrayImpl &validity)
+    : values_(values.Copy()), validity_(validity.Copy()) {
+  if (values_.Length() != validity_.Length()) {
+    throw std::invalid_argument(
+        "Shape of validity does not match values shape");
+  }
+}
+
+auto KleeneBooleanImpl::Length() const noexcept -> ssize_t {
+  return values_.Length();
+}
+
+auto KleeneBooleanImpl::Values() const noexcept
+    -> const PandasMaskArrayImpl & {
+  return values_;
+}
+
+auto KleeneBooleanImpl::Validity() const noexcept
+    -> const PandasMaskArrayImpl & {
+  return validity_;
+}
+
+auto KleeneBooleanImpl::GetItem(ssize_t index) const -> std::optional<bool> {
+  if (!validity_.GetItem(index)) {
+    return std::nullopt;
+  }
+  return values_.GetItem(index);
+}
+
+auto KleeneBooleanImpl::Invert() const -> KleeneBooleanImpl {
+  return Apply(*this, *this, [](uint64_t a, uint64_t a_valid, uint64_t,
+                                uint64_t) { return std::pair(~a, a_valid); });
+}
+
+// A side that is known false decides &, and one known true decides |;
+// otherwise a missing side makes the result missing
+
+auto KleeneBooleanImpl::And(const KleeneBooleanImpl &other) const
+    -> KleeneBooleanImpl {
+  return Apply(*this, other,
+               [](uint64_t a, uint64_t a_valid, uint64_t b, uint64_t b_valid) {
+                 const uint64_t a_false = a_valid & ~a;
+                 const uint64_t b_false = b_valid & ~b;
+                 return std::pair(a & b,
+                                  (a_valid & b_valid) | a_false | b_false);
+               });
+}
+
+auto KleeneBooleanImpl::Or(const KleeneBooleanImpl &other) const
+    -> KleeneBooleanImpl {
+  return Apply(*this, other,
+               [](uint64_t a, uint64_t a_valid, uint64_t b, uint64_t b_valid) {
+                 const uint64_t a_true = a_valid & a;
+                 const uint64_t b_true = b_valid & b;
+                 return std::pair(a_true | b_true,
+                                  (a_valid & b_valid) | a_true | b_true);
+               });
+}
+
+auto KleeneBooleanImpl::Xor(const KleeneBooleanImpl &other) const
+    -> KleeneBooleanImpl {
+  return Apply(*this, other,
+               [](uint64_t a, uint64_t a_valid, uint64_t b, uint64_t b_valid) {
+                 return std::pair(a ^ b, a_valid & b_valid);
+               });
+}
+
+template <typename F> auto KleeneBooleanImpl::ForEachBlock(F &&func) const
+    -> void {
+  Block values;
+  Block validity;
+  const int64_t length = Length();
+  for (int64_t start = 0; start < length; start += kBlockBits) {
+    const int64_t nbits = std::min(kBlockBits, length - start);
+    LoadBlock(values_, start, nbits, values);
+    LoadBlock(validity_, start, nbits, validity);
+    if (!func(values.data(), validity.data(), nbits)) {
+      return;
+    }
+  }
+}
+
+auto KleeneBooleanImpl::Any(bool skipna) const -> std::optional<bool> {
+  bool any = false;
+  bool missing = false;
+  ForEachBlock([&](const uint64_t *values, const uint64_t *validity,
+                   int64_t nbits) {
+    const int64_t nwords = (nbits + 63) / 64;
+    for (int64_t i = 0; i < nwords; i++) {
+      any |= (values[i] & validity[i]) != 0;
+      missing |= validity[i] != LowBits(nbits - i * 64);
+    }
+    return !any;
+  });
+
+  // no value is known true, so only a missing one could be
+  if (!any && missing && !skipna) {
+    return std::nullopt;
+  }
+  return any;
+}
+
+auto KleeneBooleanImpl::All(bool skipna) const -> std::optional<bool> {
+  bool all = true;
+  bool missing = false;
+  ForEachBlock([&](const uint64_t *values, const uint64_t *validity,
+                   int64_t nbits) {
+    const int64_t nwords = (nbits + 63) / 64;
+    for (int64_t i = 0; i < nwords; i++) {
+      all &= (~values[i] & validity[i]) == 0;
+      missing |= validity[i] != LowBits(nbits - i * 64);
+    }
+    return all;
+  });
+
+  // no value is known false, so only a missing one could be
+  if (all && missing && !skipna) {
+    return std::nullopt;
+  }
+  return all;
+}
@@ -0,0 +1,47 @@
+/// Nullable boolean columns under Kleene's three-valued logic
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "pandas_mask_impl.h"
+
+/// A nullable boolean column, as pandas' BooleanArray, held as two masks of
+/// the same length: values, and validity, which is set where the value is
+/// known rather than missing. Operators follow Kleene logic, in which a
+/// missing value is unknown, so False & NA is False but True & NA is NA.
+/// Each computes both masks of its result in one word-at-a-time pass over
+/// its inputs, and leaves the value bit of every missing element unset
+class KleeneBooleanImpl {
+public:
+  /// The buffers of values and validity are shared, not copied
+  KleeneBooleanImpl(const PandasMaskArrayImpl &values,
+                    const PandasMaskArrayImpl &validity);
+
+  auto Length() const noexcept -> ssize_t;
+  auto Values() const noexcept -> const PandasMaskArrayImpl &;
+  auto Validity() const noexcept -> const PandasMaskArrayImpl &;
+
+  /// Element index, or std::nullopt if it is missing
+  auto GetItem(ssize_t index) const -> std::optional<bool>;
+
+  auto Invert() const -> KleeneBooleanImpl;
+  auto And(const KleeneBooleanImpl &other) const -> KleeneBooleanImpl;
+  auto Or(const KleeneBooleanImpl &other) const -> KleeneBooleanImpl;
+  auto Xor(const KleeneBooleanImpl &other) const -> KleeneBooleanImpl;
+
+  /// With skipna, missing elements are ignored, so a column of only missing
+  /// values is not Any() but is All(). Otherwise the result is missing
+  /// whenever the known values leave it undecided, as in pandas
+  auto Any(bool skipna) const -> std::optional<bool>;
+  auto All(bool skipna) const -> std::optional<bool>;
+
+private:
+  /// Calls func(values, validity, nbits) with each block of words of both
+  /// masks in turn until it returns false
+  template <typename F> auto ForEachBlock(F &&func) const -> void;
+
+  PandasMaskArrayImpl values_;
+  PandasMaskArrayImpl validity_;
+};
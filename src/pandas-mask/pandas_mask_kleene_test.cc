@@ -0,0 +1,143 @@
+#include "pandas_mask_kleene.h"
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <random>
+#include <vector>
+
+using Kleene = std::optional<bool>;
+
+class PandasMaskKleeneTest : public testing::Test {
+protected:
+  /// Column from elements that are true, false or missing. Missing elements
+  /// get a set value bit, which every operation must ignore
+  static auto Make(const std::vector<Kleene> &elements) -> KleeneBooleanImpl {
+    std::vector<uint8_t> values;
+    std::vector<uint8_t> validity;
+    for (const auto &element : elements) {
+      values.push_back(element.value_or(true));
+      validity.push_back(element.has_value());
+    }
+    return KleeneBooleanImpl(
+        PandasMaskArrayImpl::Pack(values.data(), values.size()),
+        PandasMaskArrayImpl::Pack(validity.data(), validity.size()));
+  }
+
+  static auto Elements(const KleeneBooleanImpl &column) -> std::vector<Kleene> {
+    std::vector<Kleene> elements;
+    for (int64_t i = 0; i < column.Length(); i++) {
+      elements.push_back(column.GetItem(i));
+    }
+    return elements;
+  }
+
+  static auto And(Kleene a, Kleene b) -> Kleene {
+    if (a == false || b == false) {
+      return false;
+    }
+    return a && b ? Kleene(true) : std::nullopt;
+  }
+
+  static auto Or(Kleene a, Kleene b) -> Kleene {
+    if (a == true || b == true) {
+      return true;
+    }
+    return a && b ? Kleene(false) : std::nullopt;
+  }
+
+  static auto Xor(Kleene a, Kleene b) -> Kleene {
+    return a && b ? Kleene(*a != *b) : std::nullopt;
+  }
+};
+
+TEST_F(PandasMaskKleeneTest, TruthTables) {
+  const std::vector<Kleene> all{true, false, std::nullopt};
+  std::vector<Kleene> lhs;
+  std::vector<Kleene> rhs;
+  for (const auto a : all) {
+    for (const auto b : all) {
+      lhs.push_back(a);
+      rhs.push_back(b);
+    }
+  }
+
+  const auto left = Make(lhs);
+  const auto right = Make(rhs);
+  const auto anded = Elements(left.And(right));
+  const auto ored = Elements(left.Or(right));
+  const auto xored = Elements(left.Xor(right));
+  const auto inverted = Elements(left.Invert());
+  for (size_t i = 0; i < lhs.size(); i++) {
+    ASSERT_EQ(anded[i], And(lhs[i], rhs[i])) << i;
+    ASSERT_EQ(ored[i], Or(lhs[i], rhs[i])) << i;
+    ASSERT_EQ(xored[i], Xor(lhs[i], rhs[i])) << i;
+    ASSERT_EQ(inverted[i], lhs[i] ? Kleene(!*lhs[i]) : std::nullopt) << i;
+  }
+
+  // results never have the value bit of a missing element set
+  const auto result = left.Or(right);
+  ASSERT_FALSE(result.Values().BinaryAny(result.Validity(), BitAndNot()));
+}
+
+TEST_F(PandasMaskKleeneTest, MatchesElementwise) {
+  std::mt19937 rng(9);
+  std::uniform_int_distribution<int> dist(0, 2);
+  for (const int64_t length : {0, 1, 63, 64, 65, 1000}) {
+    std::vector<Kleene> lhs;
+    std::vector<Kleene> rhs;
+    for (int64_t i = 0; i < length + 3; i++) {
+      lhs.push_back(dist(rng) == 2 ? std::nullopt : Kleene(dist(rng) == 1));
+      rhs.push_back(dist(rng) == 2 ? std::nullopt : Kleene(dist(rng) == 1));
+    }
+
+    // slices starting mid-byte, and a compressed operand
+    const auto full = Make(lhs);
+    const KleeneBooleanImpl left(full.Values().Slice(3, length),
+                                 full.Validity().Slice(3, length));
+    const auto other = Make(rhs);
+    const KleeneBooleanImpl right(other.Values().Slice(0, length).Compress(),
+                                  other.Validity().Slice(0, length));
+
+    const auto anded = Elements(left.And(right));
+    const auto ored = Elements(left.Or(right));
+    const auto xored = Elements(left.Xor(right));
+    for (int64_t i = 0; i < length; i++) {
+      ASSERT_EQ(anded[i], And(lhs[i + 3], rhs[i])) << i;
+      ASSERT_EQ(ored[i], Or(lhs[i + 3], rhs[i])) << i;
+      ASSERT_EQ(xored[i], Xor(lhs[i + 3], rhs[i])) << i;
+    }
+  }
+
+  ASSERT_THROW(Make({true}).And(Make({true, false})), std::invalid_argument);
+  ASSERT_THROW(KleeneBooleanImpl(Make({true}).Values(),
+                                 Make({true, false}).Validity()),
+               std::invalid_argument);
+}
+
+TEST_F(PandasMaskKleeneTest, AnyAll) {
+  const std::optional<bool> na;
+  const auto mixed = Make({true, false, na});
+  ASSERT_EQ(mixed.Any(false), true);
+  ASSERT_EQ(mixed.All(false), false);
+
+  // undecided by the known values, so missing unless they are skipped
+  const auto trues = Make({true, na, true});
+  ASSERT_EQ(trues.Any(false), true);
+  ASSERT_EQ(trues.All(false), na);
+  ASSERT_EQ(trues.All(true), true);
+  const auto falses = Make({false, na});
+  ASSERT_EQ(falses.Any(false), na);
+  ASSERT_EQ(falses.Any(true), false);
+  ASSERT_EQ(falses.All(false), false);
+
+  const auto missing = Make({na, na});
+  ASSERT_EQ(missing.Any(true), false);
+  ASSERT_EQ(missing.All(true), true);
+  ASSERT_EQ(missing.Any(false), na);
+  ASSERT_EQ(missing.All(false), na);
+
+  const auto empty = Make({});
+  ASSERT_EQ(empty.Any(false), false);
+  ASSERT_EQ(empty.All(false), true);
+}
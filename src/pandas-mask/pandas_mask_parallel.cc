@@ -0,0 +1,223 @@
+/// Thread pool used to split the bitmap kernels over very large masks
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace pandas_mask::parallel {
+
+namespace {
+
+// Below 4 MiB the time to wake the pool is a noticeable fraction of the work
+constexpr int64_t kDefaultThreshold = int64_t{4} << 20;
+constexpr int kMaxThreads = 256;
+
+std::atomic<int64_t> threshold{kDefaultThreshold};
+std::atomic<int> num_threads{
+    std::clamp(static_cast<int>(std::thread::hardware_concurrency()), 1,
+               kMaxThreads)};
+
+using ChunkFn = std::function<void(int64_t, int64_t)>;
+
+/// Workers that sleep until handed a job, then claim its chunks alongside
+/// the thread that submitted it
+class ThreadPool {
+public:
+  explicit ThreadPool(int nthreads) {
+    try {
+      for (int i = 1; i < nthreads; i++) {
+        workers_.emplace_back([this] { Work(); });
+      }
+    } catch (...) {
+      Stop();
+      throw;
+    }
+  }
+
+  ~ThreadPool() { Stop(); }
+
+  ThreadPool(const ThreadPool &) = delete;
+  auto operator=(const ThreadPool &) -> ThreadPool & = delete;
+
+  auto Size() const noexcept -> int {
+    return static_cast<int>(workers_.size()) + 1;
+  }
+
+  /// Calls func(bounds[i], bounds[i + 1]) for every i < nchunks and waits for
+  /// them all. Returns false without calling func if another thread is
+  /// already running a job, in which case the caller should do the work
+  /// itself rather than queue behind it
+  auto TryRun(const ChunkFn &func, const int64_t *bounds, int64_t nchunks)
+      -> bool {
+    std::unique_lock run_lock(run_mutex_, std::try_to_lock);
+    if (!run_lock.owns_lock()) {
+      return false;
+    }
+
+    Job job{&func, bounds, nchunks};
+    {
+      std::lock_guard lock(mutex_);
+      job_ = &job;
+      generation_++;
+    }
+    wake_.notify_all();
+
+    const int64_t ran = RunChunks(job);
+
+    // job lives on this stack, so wait until every worker that picked it up
+    // has let go of it
+    std::unique_lock lock(mutex_);
+    job_ = nullptr;
+    job.finished += ran;
+    done_.wait(lock, [&] {
+      return job.finished == job.nchunks && job.workers == 0;
+    });
+    return true;
+  }
+
+private:
+  struct Job {
+    const ChunkFn *func;
+    const int64_t *bounds;
+    int64_t nchunks;
+    std::atomic<int64_t> next{0};
+    // guarded by mutex_
+    int64_t finished = 0;
+    int64_t workers = 0;
+  };
+
+  auto Stop() noexcept -> void {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &worker : workers_) {
+      worker.join();
+    }
+  }
+
+  static auto RunChunks(Job &job) noexcept -> int64_t {
+    int64_t ran = 0;
+    for (int64_t i = job.next.fetch_add(1); i < job.nchunks;
+         i = job.next.fetch_add(1)) {
+      (*job.func)(job.bounds[i], job.bounds[i + 1]);
+      ran++;
+    }
+    return ran;
+  }
+
+  auto Work() -> void {
+    uint64_t seen = 0;
+    std::unique_lock lock(mutex_);
+    while (true) {
+      wake_.wait(lock, [&] {
+        return stop_ || (job_ != nullptr && generation_ != seen);
+      });
+      if (stop_) {
+        return;
+      }
+
+      seen = generation_;
+      Job &job = *job_;
+      job.workers++;
+      lock.unlock();
+      const int64_t ran = RunChunks(job);
+      lock.lock();
+      job.finished += ran;
+      job.workers--;
+      done_.notify_all();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  // held for the duration of a job so jobs never interleave
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  Job *job_ = nullptr;
+  uint64_t generation_ = 0;
+  bool stop_ = false;
+};
+
+/// The shared pool, rebuilt if the thread count has changed. Callers hold a
+/// reference so a pool being replaced finishes its current job first
+auto GetPool(int nthreads) -> std::shared_ptr<ThreadPool> {
+  static std::mutex mutex;
+  static std::shared_ptr<ThreadPool> pool;
+
+  std::lock_guard lock(mutex);
+  if (pool == nullptr || pool->Size() != nthreads) {
+    pool.reset();
+    pool = std::make_shared<ThreadPool>(nthreads);
+  }
+  return pool;
+}
+
+} // namespace
+
+auto Threshold() noexcept -> int64_t { return threshold.load(); }
+
+auto SetThreshold(int64_t nbytes) -> void {
+  if (nbytes < 0) {
+    throw std::invalid_argument("parallel threshold must not be negative");
+  }
+  threshold.store(nbytes);
+}
+
+auto NumThreads() noexcept -> int { return num_threads.load(); }
+
+auto SetNumThreads(int nthreads) -> void {
+  if (nthreads < 1 || nthreads > kMaxThreads) {
+    throw std::invalid_argument("number of threads must be in [1, 256]");
+  }
+  num_threads.store(nthreads);
+}
+
+auto ForEachChunk(const void *base, int64_t nbytes,
+                  const ChunkFn &func) noexcept -> void {
+  const int nthreads = NumThreads();
+  if (nthreads < 2 || nbytes < std::max<int64_t>(Threshold(), 1)) {
+    return func(0, nbytes);
+  }
+
+  // split evenly, then push each boundary forward to a cache line
+  const auto address = reinterpret_cast<uintptr_t>(base);
+  std::array<int64_t, kMaxThreads + 1> bounds;
+  int64_t nchunks = 0;
+  bounds[0] = 0;
+  for (int i = 1; i < nthreads; i++) {
+    const auto target =
+        address + static_cast<uintptr_t>(nbytes * i / nthreads);
+    const auto aligned = static_cast<int64_t>(
+        (target + kCacheLineBytes - 1) / kCacheLineBytes * kCacheLineBytes -
+        address);
+    if (aligned > bounds[nchunks] && aligned < nbytes) {
+      bounds[++nchunks] = aligned;
+    }
+  }
+  bounds[++nchunks] = nbytes;
+
+  // if the threads cannot be started, the work can still be done here
+  std::shared_ptr<ThreadPool> pool;
+  try {
+    pool = GetPool(nthreads);
+  } catch (const std::exception &) {
+    return func(0, nbytes);
+  }
+  if (!pool->TryRun(func, bounds.data(), nchunks)) {
+    func(0, nbytes);
+  }
+}
+
+} // namespace pandas_mask::parallel
@@ -0,0 +1,31 @@
+/// Thread pool used to split the bitmap kernels over very large masks
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+namespace pandas_mask::parallel {
+
+/// Chunk boundaries fall on multiples of this many bytes of the buffer being
+/// written, so no two threads ever write to the same cache line
+constexpr int64_t kCacheLineBytes = 64;
+
+/// Buffers smaller than this many bytes are processed on the calling thread
+auto Threshold() noexcept -> int64_t;
+auto SetThreshold(int64_t nbytes) -> void;
+
+/// Threads used above the threshold, including the calling thread. Defaults
+/// to std::thread::hardware_concurrency()
+auto NumThreads() noexcept -> int;
+auto SetNumThreads(int nthreads) -> void;
+
+/// Calls func(begin, end) for contiguous byte ranges covering [0, nbytes) of
+/// the buffer at base, in parallel once nbytes reaches Threshold(), and
+/// returns once every call has finished. Every boundary other than 0 and
+/// nbytes is a cache line aligned address. func must not throw
+auto ForEachChunk(const void *base, int64_t nbytes,
+                  const std::function<void(int64_t, int64_t)> &func) noexcept
+    -> void;
+
+} // namespace pandas_mask::parallel
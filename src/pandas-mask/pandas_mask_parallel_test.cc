@@ -0,0 +1,126 @@
+#include "pandas_mask_impl.h"
+#include "pandas_mask_parallel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace parallel = pandas_mask::parallel;
+
+class PandasMaskParallelTest : public testing::Test {
+protected:
+  // force every operation through the pool, whatever the machine
+  void SetUp() override {
+    threshold_ = parallel::Threshold();
+    nthreads_ = parallel::NumThreads();
+    parallel::SetThreshold(0);
+    parallel::SetNumThreads(4);
+  }
+
+  void TearDown() override {
+    parallel::SetThreshold(threshold_);
+    parallel::SetNumThreads(nthreads_);
+  }
+
+  static auto RandomValues(int64_t length) -> std::vector<uint8_t> {
+    std::mt19937 rng(5);
+    std::bernoulli_distribution dist(0.5);
+    std::vector<uint8_t> values(length);
+    for (auto &value : values) {
+      value = dist(rng);
+    }
+    return values;
+  }
+
+  int64_t threshold_ = 0;
+  int nthreads_ = 1;
+};
+
+TEST_F(PandasMaskParallelTest, ChunksAreCacheLineAligned) {
+  std::vector<uint8_t> buffer(100000);
+  for (const int64_t start : {0, 1, 13}) {
+    for (const int64_t nbytes : {0, 1, 63, 64, 65, 1000, 99000}) {
+      std::mutex mutex;
+      std::vector<std::pair<int64_t, int64_t>> chunks;
+      parallel::ForEachChunk(&buffer[start], nbytes,
+                             [&](int64_t begin, int64_t end) {
+                               std::lock_guard lock(mutex);
+                               chunks.emplace_back(begin, end);
+                             });
+
+      std::sort(chunks.begin(), chunks.end());
+      ASSERT_FALSE(chunks.empty());
+      ASSERT_EQ(chunks.front().first, 0);
+      ASSERT_EQ(chunks.back().second, nbytes);
+      for (size_t i = 1; i < chunks.size(); i++) {
+        ASSERT_EQ(chunks[i].first, chunks[i - 1].second);
+        const auto address =
+            reinterpret_cast<uintptr_t>(&buffer[start + chunks[i].first]);
+        ASSERT_EQ(address % parallel::kCacheLineBytes, 0u);
+      }
+      ASSERT_LE(chunks.size(), 4u);
+    }
+  }
+}
+
+TEST_F(PandasMaskParallelTest, MatchesSingleThreaded) {
+  for (const int64_t length : {0, 1, 511, 4096, 100003}) {
+    const auto values = RandomValues(length + 16);
+    const auto other_values = RandomValues(length + 32);
+
+    for (const int64_t start : {0, 3, 8}) {
+      parallel::SetNumThreads(4);
+      const auto lhs =
+          PandasMaskArrayImpl::Pack(values.data(), values.size())
+              .Slice(start, length);
+      const auto rhs =
+          PandasMaskArrayImpl::Pack(other_values.data(), other_values.size())
+              .Slice(start, length);
+      const auto anded = lhs.BinaryOp(rhs, std::bit_and());
+      const auto inverted = lhs.Invert();
+      const auto sum = lhs.Sum();
+      std::vector<uint8_t> unpacked(length);
+      lhs.UnpackInto(unpacked.data(), 0, length);
+
+      parallel::SetNumThreads(1);
+      ASSERT_EQ(sum, lhs.Sum());
+      for (int64_t i = 0; i < length; i++) {
+        ASSERT_EQ(lhs.GetItem(i), values[start + i] != 0);
+        ASSERT_EQ(unpacked[i], values[start + i]);
+        ASSERT_EQ(anded.GetItem(i), lhs.GetItem(i) && rhs.GetItem(i));
+        ASSERT_EQ(inverted.GetItem(i), !lhs.GetItem(i));
+      }
+    }
+  }
+}
+
+TEST_F(PandasMaskParallelTest, ConcurrentCallers) {
+  // a second job arriving while the pool is busy runs on its own thread
+  const auto values = RandomValues(1 << 20);
+  const auto mask = PandasMaskArrayImpl::Pack(values.data(), values.size());
+  const auto expected = mask.Sum();
+
+  std::vector<std::thread> threads;
+  std::atomic<int> mismatches{0};
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 20; i++) {
+        mismatches += mask.Sum() != expected;
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(mismatches, 0);
+}
+
+TEST_F(PandasMaskParallelTest, InvalidSettingsRaise) {
+  ASSERT_THROW(parallel::SetThreshold(-1), std::invalid_argument);
+  ASSERT_THROW(parallel::SetNumThreads(0), std::invalid_argument);
+}
@@ -0,0 +1,223 @@
+/// Reductions over a column of numbers that skip the rows a mask marks as
+/// missing, reading the mask a word at a time rather than unpacking it
+/// Nothing in this mmodule may use the Python runtime
+#include "pandas_mask_reduce.h"
+
+#include <algorithm>
+#include <bit>
+#include <utility>
+
+using pandas_mask::kernels::LoadBits;
+using pandas_mask::kernels::LowBits;
+
+namespace pandas_mask::reduce {
+
+namespace {
+
+/// Calls func(i) for every position i whose element of mask is unset, in
+/// ascending order. A word with no missing values is visited without
+/// looking at its bits and a word of only missing values is skipped
+/// whole; a compressed mask is walked a gap between runs at a time
+template <typename F>
+auto ForEachPresent(const PandasMaskArrayImpl &mask, F &&func) -> void {
+  const int64_t length = mask.Length();
+
+  if (mask.IsCompressed()) {
+    for (int64_t start = mask.FindFirst(false); start >= 0;) {
+      int64_t end = mask.FindFirst(true, start);
+      end = end < 0 ? length : end;
+      for (int64_t i = start; i < end; i++) {
+        func(i);
+      }
+      start = end < length ? mask.FindFirst(false, end) : -1;
+    }
+    return;
+  }
+
+  const uint8_t *bits = mask.Data();
+  const int64_t offset = mask.Offset();
+  for (int64_t i = 0; i < length; i += 64) {
+    const int64_t nbits = std::min<int64_t>(64, length - i);
+    const uint64_t missing = LoadBits(bits, offset + i, nbits);
+    if (missing == 0) {
+      for (int64_t j = i; j < i + nbits; j++) {
+        func(j);
+      }
+    } else if (missing != LowBits(nbits)) {
+      for (uint64_t present = ~missing & LowBits(nbits); present != 0;
+           present &= present - 1) {
+        func(i + std::countr_zero(present));
+      }
+    }
+  }
+}
+
+/// Integer arithmetic that wraps on overflow, as NumPy's does, rather than
+/// being undefined for signed types
+template <typename A> auto Add(A a, A b) noexcept -> A {
+  if constexpr (std::is_integral_v<A>) {
+    return static_cast<A>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+  } else {
+    return a + b;
+  }
+}
+
+template <typename A> auto Multiply(A a, A b) noexcept -> A {
+  if constexpr (std::is_integral_v<A>) {
+    return static_cast<A>(static_cast<uint64_t>(a) * static_cast<uint64_t>(b));
+  } else {
+    return a * b;
+  }
+}
+
+/// Whether a reduction can go ahead: with skipna false any missing value
+/// makes the result missing
+auto Proceed(const PandasMaskArrayImpl &mask, bool skipna) -> bool {
+  return skipna || !mask.Any();
+}
+
+/// Sum of the present values as doubles, and how many there are
+template <typename T>
+auto SumCount(const T *values, const PandasMaskArrayImpl &mask)
+    -> std::pair<double, int64_t> {
+  double sum = 0;
+  int64_t count = 0;
+  ForEachPresent(mask, [&](int64_t i) {
+    sum += static_cast<double>(values[i]);
+    count++;
+  });
+  return {sum, count};
+}
+
+/// Whether value is NaN, which no integer is
+template <typename T> auto IsNan(T value) noexcept -> bool {
+  if constexpr (std::is_floating_point_v<T>) {
+    return value != value;
+  } else {
+    return false;
+  }
+}
+
+/// NaN never compares better, so a present one is taken explicitly, after
+/// which nothing compares better than it
+template <typename T, typename Better>
+auto Extreme(const T *values, const PandasMaskArrayImpl &mask, bool skipna,
+             Better better) -> std::optional<T> {
+  if (!Proceed(mask, skipna)) {
+    return std::nullopt;
+  }
+
+  std::optional<T> result;
+  ForEachPresent(mask, [&](int64_t i) {
+    if (!result || IsNan(values[i]) || better(values[i], *result)) {
+      result = values[i];
+    }
+  });
+  return result;
+}
+
+} // namespace
+
+template <typename T>
+auto Sum(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<Accumulator<T>> {
+  if (!Proceed(mask, skipna)) {
+    return std::nullopt;
+  }
+
+  Accumulator<T> sum = 0;
+  ForEachPresent(mask, [&](int64_t i) {
+    sum = Add(sum, static_cast<Accumulator<T>>(values[i]));
+  });
+  return sum;
+}
+
+template <typename T>
+auto Prod(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<Accumulator<T>> {
+  if (!Proceed(mask, skipna)) {
+    return std::nullopt;
+  }
+
+  Accumulator<T> prod = 1;
+  ForEachPresent(mask, [&](int64_t i) {
+    prod = Multiply(prod, static_cast<Accumulator<T>>(values[i]));
+  });
+  return prod;
+}
+
+template <typename T>
+auto Min(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<T> {
+  return Extreme(values, mask, skipna, [](T a, T b) { return a < b; });
+}
+
+template <typename T>
+auto Max(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<T> {
+  return Extreme(values, mask, skipna, [](T a, T b) { return a > b; });
+}
+
+template <typename T>
+auto Mean(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<double> {
+  if (!Proceed(mask, skipna)) {
+    return std::nullopt;
+  }
+
+  const auto [sum, count] = SumCount(values, mask);
+  if (count == 0) {
+    return std::nullopt;
+  }
+  return sum / static_cast<double>(count);
+}
+
+template <typename T>
+auto Var(const T *values, const PandasMaskArrayImpl &mask, bool skipna,
+         int64_t ddof) -> std::optional<double> {
+  if (!Proceed(mask, skipna)) {
+    return std::nullopt;
+  }
+
+  const auto [sum, count] = SumCount(values, mask);
+  if (count <= ddof) {
+    return std::nullopt;
+  }
+
+  // summing squared deviations from the mean avoids the cancellation of
+  // E[x^2] - E[x]^2
+  const double mean = sum / static_cast<double>(count);
+  double squares = 0;
+  ForEachPresent(mask, [&](int64_t i) {
+    const double deviation = static_cast<double>(values[i]) - mean;
+    squares += deviation * deviation;
+  });
+  return squares / static_cast<double>(count - ddof);
+}
+
+#define PANDAS_MASK_REDUCE_INSTANTIATE(T)                                      \
+  template auto Sum(const T *, const PandasMaskArrayImpl &, bool)              \
+      -> std::optional<Accumulator<T>>;                                        \
+  template auto Prod(const T *, const PandasMaskArrayImpl &, bool)             \
+      -> std::optional<Accumulator<T>>;                                        \
+  template auto Min(const T *, const PandasMaskArrayImpl &, bool)              \
+      -> std::optional<T>;                                                     \
+  template auto Max(const T *, const PandasMaskArrayImpl &, bool)              \
+      -> std::optional<T>;                                                     \
+  template auto Mean(const T *, const PandasMaskArrayImpl &, bool)             \
+      -> std::optional<double>;                                                \
+  template auto Var(const T *, const PandasMaskArrayImpl &, bool, int64_t)     \
+      -> std::optional<double>;
+
+PANDAS_MASK_REDUCE_INSTANTIATE(int8_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(int16_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(int32_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(int64_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(uint8_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(uint16_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(uint32_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(uint64_t)
+PANDAS_MASK_REDUCE_INSTANTIATE(float)
+PANDAS_MASK_REDUCE_INSTANTIATE(double)
+
+} // namespace pandas_mask::reduce
@@ -0,0 +1,83 @@
+/// Reductions over a column of numbers that skip the rows a mask marks as
+/// missing, reading the mask a word at a time rather than unpacking it
+/// Nothing in this mmodule may use the Python runtime
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+
+#include "pandas_mask_impl.h"
+
+namespace pandas_mask::reduce {
+
+/// Type that sums and products of T are accumulated in and returned as, as
+/// in NumPy: a 64-bit integer of the same signedness, or double
+template <typename T>
+using Accumulator =
+    std::conditional_t<std::is_floating_point_v<T>, double,
+                       std::conditional_t<std::is_signed_v<T>, int64_t,
+                                          uint64_t>>;
+
+// Each reduction reads mask.Length() values, skipping those whose element of
+// mask is set, as for the mask of a pandas masked array. With skipna false a
+// single missing value makes the result missing, i.e. std::nullopt. Integer
+// sums and products wrap around on overflow
+
+template <typename T>
+auto Sum(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<Accumulator<T>>;
+
+template <typename T>
+auto Prod(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<Accumulator<T>>;
+
+/// Missing as well when every value is. A present NaN makes the result NaN
+/// wherever it falls, as with numpy.min and numpy.max
+template <typename T>
+auto Min(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<T>;
+
+template <typename T>
+auto Max(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<T>;
+
+template <typename T>
+auto Mean(const T *values, const PandasMaskArrayImpl &mask, bool skipna)
+    -> std::optional<double>;
+
+/// Variance with ddof delta degrees of freedom, computed in two passes for
+/// accuracy. Missing unless more than ddof values are present
+template <typename T>
+auto Var(const T *values, const PandasMaskArrayImpl &mask, bool skipna,
+         int64_t ddof) -> std::optional<double>;
+
+// instantiated in pandas_mask_reduce.cc for every NumPy integer and float
+#define PANDAS_MASK_REDUCE_EXTERN(T)                                           \
+  extern template auto Sum(const T *, const PandasMaskArrayImpl &, bool)       \
+      -> std::optional<Accumulator<T>>;                                        \
+  extern template auto Prod(const T *, const PandasMaskArrayImpl &, bool)      \
+      -> std::optional<Accumulator<T>>;                                        \
+  extern template auto Min(const T *, const PandasMaskArrayImpl &, bool)       \
+      -> std::optional<T>;                                                     \
+  extern template auto Max(const T *, const PandasMaskArrayImpl &, bool)       \
+      -> std::optional<T>;                                                     \
+  extern template auto Mean(const T *, const PandasMaskArrayImpl &, bool)      \
+      -> std::optional<double>;                                                \
+  extern template auto Var(const T *, const PandasMaskArrayImpl &, bool,       \
+                           int64_t) -> std::optional<double>;
+
+PANDAS_MASK_REDUCE_EXTERN(int8_t)
+PANDAS_MASK_REDUCE_EXTERN(int16_t)
+PANDAS_MASK_REDUCE_EXTERN(int32_t)
+PANDAS_MASK_REDUCE_EXTERN(int64_t)
+PANDAS_MASK_REDUCE_EXTERN(uint8_t)
+PANDAS_MASK_REDUCE_EXTERN(uint16_t)
+PANDAS_MASK_REDUCE_EXTERN(uint32_t)
+PANDAS_MASK_REDUCE_EXTERN(uint64_t)
+PANDAS_MASK_REDUCE_EXTERN(float)
+PANDAS_MASK_REDUCE_EXTERN(double)
+
+#undef PANDAS_MASK_REDUCE_EXTERN
+
+} // namespace pandas_mask::reduce
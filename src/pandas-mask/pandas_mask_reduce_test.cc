@@ -0,0 +1,137 @@
+#include "pandas_mask_reduce.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace reduce = pandas_mask::reduce;
+
+template <typename T> class PandasMaskReduceTest : public testing::Test {
+protected:
+  // lengths covering partial words, masks that are dense, sparse, all
+  // missing and none missing, and a slice starting mid-byte
+  static auto Masks(int64_t length) -> std::vector<PandasMaskArrayImpl> {
+    std::mt19937 rng(3);
+    std::vector<PandasMaskArrayImpl> masks;
+    for (const double density : {0.0, 0.01, 0.5, 1.0}) {
+      std::bernoulli_distribution dist(density);
+      std::vector<uint8_t> missing(length + 3);
+      for (auto &value : missing) {
+        value = dist(rng);
+      }
+      const auto mask =
+          PandasMaskArrayImpl::Pack(missing.data(), missing.size());
+      masks.push_back(mask.Slice(3, length));
+      masks.push_back(mask.Slice(3, length).Compress());
+    }
+    return masks;
+  }
+
+  static auto Values(int64_t length) -> std::vector<T> {
+    std::mt19937 rng(4);
+    std::uniform_int_distribution<int> dist(0, 20);
+    std::vector<T> values(length);
+    for (auto &value : values) {
+      value = static_cast<T>(dist(rng));
+    }
+    return values;
+  }
+};
+
+using ValueTypes =
+    testing::Types<int8_t, int16_t, int32_t, int64_t, uint8_t, uint16_t,
+                   uint32_t, uint64_t, float, double>;
+TYPED_TEST_SUITE(PandasMaskReduceTest, ValueTypes);
+
+TYPED_TEST(PandasMaskReduceTest, MatchesUnpacked) {
+  for (const int64_t length : {0, 1, 63, 64, 200, 1003}) {
+    const auto values = this->Values(length);
+    for (const auto &mask : this->Masks(length)) {
+      std::vector<double> present;
+      for (int64_t i = 0; i < length; i++) {
+        if (!mask.GetItem(i)) {
+          present.push_back(static_cast<double>(values[i]));
+        }
+      }
+
+      double sum = 0;
+      double prod = 1;
+      for (const double value : present) {
+        sum += value;
+        prod *= value;
+      }
+      ASSERT_DOUBLE_EQ(*reduce::Sum(values.data(), mask, true), sum);
+      if (present.size() < 8) {
+        ASSERT_DOUBLE_EQ(*reduce::Prod(values.data(), mask, true), prod);
+      }
+
+      const auto min = reduce::Min(values.data(), mask, true);
+      const auto max = reduce::Max(values.data(), mask, true);
+      const auto mean = reduce::Mean(values.data(), mask, true);
+      const auto var = reduce::Var(values.data(), mask, true, 1);
+      if (present.empty()) {
+        ASSERT_FALSE(min);
+        ASSERT_FALSE(max);
+        ASSERT_FALSE(mean);
+      } else {
+        ASSERT_EQ(static_cast<double>(*min),
+                  *std::min_element(present.begin(), present.end()));
+        ASSERT_EQ(static_cast<double>(*max),
+                  *std::max_element(present.begin(), present.end()));
+        ASSERT_NEAR(*mean, sum / present.size(), 1e-9);
+      }
+      if (present.size() < 2) {
+        ASSERT_FALSE(var);
+      } else {
+        double squares = 0;
+        for (const double value : present) {
+          squares += std::pow(value - sum / present.size(), 2);
+        }
+        ASSERT_NEAR(*var, squares / (present.size() - 1), 1e-6);
+      }
+
+      // without skipna one missing value is enough to make each missing
+      const bool any_missing = present.size() < static_cast<size_t>(length);
+      ASSERT_EQ(reduce::Sum(values.data(), mask, false).has_value(),
+                !any_missing);
+      ASSERT_EQ(reduce::Max(values.data(), mask, false).has_value(),
+                !any_missing && length > 0);
+      ASSERT_EQ(reduce::Var(values.data(), mask, false, 0).has_value(),
+                !any_missing && length > 0);
+    }
+  }
+}
+
+TEST(PandasMaskReduceTest, IntegersWrap) {
+  const std::vector<int64_t> values{INT64_MAX, 1, 5};
+  const std::vector<uint8_t> missing{0, 0, 1};
+  const auto mask = PandasMaskArrayImpl::Pack(missing.data(), missing.size());
+
+  ASSERT_EQ(*reduce::Sum(values.data(), mask, true), INT64_MIN);
+  ASSERT_EQ(*reduce::Prod(values.data(), mask, true), INT64_MAX);
+
+  const std::vector<uint8_t> small{200, 100, 7};
+  ASSERT_EQ(*reduce::Sum(small.data(), mask, true), 300u);
+}
+
+TEST(PandasMaskReduceTest, NaNPropagates) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const std::vector<uint8_t> missing{0, 0, 0, 1};
+  const auto mask = PandasMaskArrayImpl::Pack(missing.data(), missing.size());
+
+  // leading, trailing and in the middle, but not where it is missing
+  for (const std::vector<double> &values :
+       {std::vector<double>{nan, 1.0, 2.0, 0.0},
+        std::vector<double>{1.0, 2.0, nan, 0.0},
+        std::vector<double>{2.0, nan, 1.0, 0.0}}) {
+    ASSERT_TRUE(std::isnan(*reduce::Min(values.data(), mask, true)));
+    ASSERT_TRUE(std::isnan(*reduce::Max(values.data(), mask, true)));
+  }
+
+  const std::vector<double> masked_nan{1.0, 2.0, 3.0, nan};
+  ASSERT_EQ(*reduce::Min(masked_nan.data(), mask, true), 1.0);
+  ASSERT_EQ(*reduce::Max(masked_nan.data(), mask, true), 3.0);
+}
@@ -7,6 +7,10 @@ import numpy as np
 import numpy.testing as npt
 import pytest
 
+import pandas_mask
+def test_simd_isa():
+    assert pandas_mask.simd_isa in ("scalar", "sse2", "avx2", "avx512")
+
 def test_constructor():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -98,6 +102,47 @@ def test_getitem_slice():
     assert result[1]
     assert result[2]
 
+@pytest.mark.parametrize("start", [0, 1, 3, 8, 13])
+def test_getitem_slice_offsets(start):
+    arr = np.random.default_rng(start).random(200) > 0.5
+    other = np.random.default_rng(start + 100).random(200 - start) > 0.5
+    bma = PandasMaskArray(arr)
+
+    result = bma[start:]
+    expected = arr[start:]
+    assert len(result) == len(expected)
+    npt.assert_array_equal(np.array(result), expected)
+    npt.assert_array_equal(np.array(~result), ~expected)
+    npt.assert_array_equal(np.array(result & other), expected & other)
+    npt.assert_array_equal(
+        np.array(result | bma[: len(expected)]), expected | arr[: len(expected)]
+    )
+    assert result.sum() == expected.sum()
+    assert result.any() == expected.any()
+    assert result.all() == expected.all()
+    assert result.argmax() == expected.argmax()
+    assert result.argmin() == expected.argmin()
+    assert result.bytes == np.packbits(expected, bitorder="little").tobytes()
+
+def test_getitem_slice_setitem_does_not_propagate():
+    arr = np.array([True, False, True, True, False])
+    bma = PandasMaskArray(arr)
+
+    result = bma[1:4]
+    result[0] = True
+    assert result[0]
+    assert not bma[1]
+
+    bma[2] = False
+    assert result[1]
+
+def test_getitem_slice_step():
+    arr = np.array([True, False, True, True, False, True])
+    bma = PandasMaskArray(arr)
+
+    npt.assert_array_equal(np.array(bma[::2]), arr[::2])
+    npt.assert_array_equal(np.array(bma[::-1]), arr[::-1])
+
 @pytest.mark.parametrize("first_index,second_index", ([1, 2], [-3, -2]))
 def test_settiem_basic(first_index, second_index):
     arr = np.array([True, False, True, True])
@@ -181,6 +226,35 @@ def test_setitem_bool_ndarray():
     assert not bma[2]
     assert bma[3]
 
+def test_setitem_bool_ndarray_true():
+    arr = np.array([True, False, True, False] * 5)
+    bma = PandasMaskArray(arr)
+
+    indexer = np.array([False, True, False, False] * 5)
+    bma[indexer] = True
+    npt.assert_array_equal(np.array(bma), arr | indexer)
+
+@pytest.mark.parametrize("value", [False, True])
+def test_setitem_sliced_mask(value):
+    arr = np.random.default_rng(3).random(1002) > 0.5
+    sel = np.random.default_rng(4).random(1005) > 0.7
+    for compress in (False, True):
+        bma = PandasMaskArray(arr, compress=compress)[2:]
+        selector = PandasMaskArray(sel, compress=compress)[5:]
+        bma[selector] = value
+        expected = arr[2:].copy()
+        expected[sel[5:]] = value
+        npt.assert_array_equal(np.array(bma), expected)
+
+@pytest.mark.parametrize("length", [0, 5, 16, 33, 1000])
+def test_constructor_pack_lengths(length):
+    arr = np.random.default_rng(length).random(length) > 0.5
+    bma = PandasMaskArray(arr)
+
+    assert len(bma) == length
+    assert bma.sum() == arr.sum()
+    npt.assert_array_equal(np.array(bma), arr)
+
 def test_length():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -276,6 +350,68 @@ def test_binop_raises(op):
     with pytest.raises(TypeError):
         result = op(bma, "foo")
 
+@pytest.mark.parametrize(
+    "op,iop",
+    [
+        (operator.and_, operator.iand),
+        (operator.or_, operator.ior),
+        (operator.xor, operator.ixor),
+    ],
+)
+@pytest.mark.parametrize("as_mask", [True, False])
+def test_inplace_binop(op, iop, as_mask):
+    arr = np.array([True, False, True, False, False, True, True, False, True])
+    other = np.array([True, True, False, True, False, False, True, True, False])
+    bma = PandasMaskArray(arr)
+    copied = bma.copy()
+
+    result = iop(bma, PandasMaskArray(other) if as_mask else other)
+    assert result is bma
+    npt.assert_array_equal(np.array(bma), op(arr, other))
+    npt.assert_array_equal(np.array(copied), arr)
+
+def test_inplace_binop_raises():
+    bma = PandasMaskArray(np.array([True, False, True]))
+
+    with pytest.raises(TypeError):
+        bma &= "foo"
+    with pytest.raises(ValueError):
+        bma |= PandasMaskArray(np.array([True, False]))
+
+@pytest.mark.parametrize(
+    "method,op",
+    [
+        ("bitwise_and", operator.and_),
+        ("bitwise_or", operator.or_),
+        ("bitwise_xor", operator.xor),
+    ],
+)
+def test_binop_out(method, op):
+    arr = np.array([True, False, True, False, False, True, True, False, True])
+    other = np.array([True, True, False, True, False, False, True, True, False])
+    bma = PandasMaskArray(arr)
+    out = PandasMaskArray(np.zeros(len(arr), dtype=bool))
+
+    result = getattr(bma, method)(other, out=out)
+    assert result is out
+    npt.assert_array_equal(np.array(out), op(arr, other))
+    npt.assert_array_equal(np.array(getattr(bma, method)(other)), op(arr, other))
+
+    with pytest.raises(ValueError):
+        getattr(bma, method)(other, out=PandasMaskArray(np.array([True])))
+
+def test_invert_out():
+    arr = np.array([True, False, True, False, False])
+    bma = PandasMaskArray(arr)
+    out = PandasMaskArray(np.zeros(len(arr), dtype=bool))
+
+    assert bma.invert(out=out) is out
+    npt.assert_array_equal(np.array(out), ~arr)
+    npt.assert_array_equal(np.array(bma.invert()), ~arr)
+
+    assert bma.invert(out=bma) is bma
+    npt.assert_array_equal(np.array(bma), ~arr)
+
 def test_size():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -288,6 +424,42 @@ def test_nbytes():
 
     assert bma.nbytes == 2
 
+def test_compressed():
+    arr = np.zeros(100_000, dtype=bool)
+    arr[1000:1010] = True
+    bma = PandasMaskArray(arr)
+
+    # a clean mask is compressed automatically, unless asked not to be
+    assert bma.is_compressed
+    assert bma.nbytes == 16
+    assert not PandasMaskArray(arr, compress=False).is_compressed
+    assert PandasMaskArray(arr[:10], compress=True).is_compressed
+
+    assert bma.sum() == 10
+    assert bma.any()
+    assert not bma.all()
+    assert bma[1005]
+    assert bma.find_first() == 1000
+    npt.assert_array_equal(np.array(bma[990:1020]), arr[990:1020])
+    npt.assert_array_equal(np.array(~bma), ~arr)
+
+    other = PandasMaskArray(arr[::-1].copy())
+    assert (bma | other).is_compressed
+    npt.assert_array_equal(np.array(bma | other), arr | arr[::-1])
+    npt.assert_array_equal(np.array(bma & arr[::-1]), arr & arr[::-1])
+
+    dense = bma.decompress()
+    assert not dense.is_compressed
+    assert dense.nbytes == 12_500
+    assert dense.compress().nbytes == 16
+    # the decoded bitmap is cached with the runs until bma is written
+    assert bma.nbytes == 16 + 12_500
+
+    # writing decompresses
+    bma[0] = True
+    assert not bma.is_compressed
+    assert bma.sum() == 11
+
 @pytest.mark.parametrize(
     "arr,expected",
     [
@@ -326,6 +498,36 @@ def test_sum():
 
     assert bma.sum() == 6
 
+def test_rank_select():
+    arr = np.random.default_rng(7).random(5000) > 0.7
+    bma = PandasMaskArray(arr)
+    positions = np.flatnonzero(arr)
+
+    for indexed in (False, True):
+        if indexed:
+            bma.build_rank_index()
+        assert bma.rank(0) == 0
+        assert bma.rank(1234) == arr[:1234].sum()
+        assert bma.rank(len(arr)) == arr.sum()
+        assert bma.select(0) == positions[0]
+        assert bma.select(100) == positions[100]
+        # windowed counts are a difference of ranks
+        assert bma.rank(3000) - bma.rank(1000) == arr[1000:3000].sum()
+
+    with pytest.raises(IndexError):
+        bma.rank(len(arr) + 1)
+    with pytest.raises(IndexError):
+        bma.select(len(positions))
+
+    # writes keep sum() current
+    assert bma.sum() == arr.sum()
+    bma[positions[0]] = False
+    bma[:10] = True
+    arr[positions[0]] = False
+    arr[:10] = True
+    assert bma.sum() == arr.sum()
+    assert bma.select(0) == 0
+
 def test_copy():
     arr = np.array([True, False, True, False, False, True, True, True, True])
     bma = PandasMaskArray(arr)
@@ -335,6 +537,36 @@ def test_copy():
     for i in range(len(arr)):
         assert bma[i] == copied[i]
 
+def test_copy_on_write():
+    arr = np.array([True, False, True, False, False, True, True, True, True])
+    bma = PandasMaskArray(arr)
+    copied = bma.copy()
+    constructed = PandasMaskArray(bma)
+
+    assert copied.shares_memory(bma)
+    assert constructed.shares_memory(bma)
+    assert copied.nbytes == bma.nbytes
+
+    copied[0] = False
+    assert not copied.shares_memory(bma)
+    assert bma[0]
+    assert constructed[0]
+    assert copied.nbytes == bma.nbytes
+
+    bma[1] = True
+    assert not constructed[1]
+
+def test_setitem_empty_slice_with_bitmask_value_copy_on_write():
+    bma = PandasMaskArray(np.array([True, False, True, True]))
+    other = PandasMaskArray(np.array([False, False, True, False]))
+
+    bma[:] = other
+    assert bma.shares_memory(other)
+
+    other[0] = True
+    assert not bma[0]
+    npt.assert_array_equal(np.array(bma), [False, False, True, False])
+
 def test_numpy_implicit_conversion():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -363,6 +595,49 @@ def test_pickle_roundtrip():
     for i in range(len(arr)):
         assert bma[i] == bma2[i]
 
+@pytest.mark.parametrize("protocol", range(2, pickle.HIGHEST_PROTOCOL + 1))
+@pytest.mark.parametrize("start", [0, 3])
+def test_pickle_packed(protocol, start):
+    arr = np.random.default_rng(3).random(1000) > 0.5
+    bma = PandasMaskArray(arr)[start:]
+
+    data = pickle.dumps(bma, protocol=protocol)
+    # the state is the packed bits, not a bool per element
+    assert len(data) < 200 + len(arr) // 8
+    npt.assert_array_equal(np.array(pickle.loads(data)), arr[start:])
+
+def test_pickle_out_of_band():
+    arr = np.random.default_rng(4).random(1000) > 0.5
+    bma = PandasMaskArray(arr)
+
+    buffers = []
+    data = pickle.dumps(bma, protocol=5, buffer_callback=buffers.append)
+    assert len(buffers) == 1
+    assert buffers[0].raw().nbytes == 125
+    result = pickle.loads(data, buffers=buffers)
+    npt.assert_array_equal(np.array(result), arr)
+
+def test_buffer_protocol():
+    arr = np.array([True, False, True, True, False, False, False, True, True])
+    bma = PandasMaskArray(arr)
+
+    view = memoryview(bma)
+    assert view.readonly
+    assert view.tobytes() == bma.bytes
+    npt.assert_array_equal(np.frombuffer(bma, dtype=np.uint8),
+                           np.packbits(arr, bitorder="little"))
+
+    # the view keeps the bytes it was given
+    bma[0] = False
+    assert view[0] & 1
+    with pytest.raises(TypeError):
+        view[0] = 0
+
+    # a slice starting mid-byte is repacked
+    npt.assert_array_equal(np.frombuffer(bma[3:], dtype=np.uint8),
+                           np.packbits(arr[3:], bitorder="little"))
+    assert memoryview(PandasMaskArray(np.array([], dtype=bool))).nbytes == 0
+
 def test_iter():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -377,6 +652,19 @@ def test_iter():
     with pytest.raises(StopIteration):
         next(itr)
 
+def test_iter_snapshot():
+    # iterators read the mask as it was when they were created
+    arr = np.array([True, False] * 50)
+    bma = PandasMaskArray(arr)
+    values = iter(bma)
+    positions = bma.iter_set()
+    assert next(values) and next(positions) == 0
+
+    bma[:] = False
+    bma |= PandasMaskArray(~arr)
+    assert list(values) == arr[1:].tolist()
+    assert list(positions) == np.flatnonzero(arr)[1:].tolist()
+
 def test_shape():
     arr = np.array([True, False, True, False, False])
     bma = PandasMaskArray(arr)
@@ -391,6 +679,18 @@ def test_view():
     result = bma.view("uint8")
     expected = np.array([1, 0, 1, 0, 0], dtype="uint8")
     npt.assert_array_equal(result, expected)
+    assert result.dtype == np.uint8
+
+
+@pytest.mark.parametrize("length", [0, 1, 15, 16, 17, 100, 1025])
+def test_numpy_conversion_lengths(length):
+    arr = np.random.default_rng(length).random(length) > 0.5
+    bma = PandasMaskArray(arr)
+
+    result = np.asarray(bma)
+    assert result.dtype == np.bool_
+    npt.assert_array_equal(result, arr)
+    npt.assert_array_equal(bma.view("uint8"), arr.astype("uint8"))
 
 
 def test_argmin():
@@ -404,3 +704,611 @@ def test_argmax():
     bma = PandasMaskArray(arr)
 
     assert bma.argmax() == 1
+
+@pytest.mark.parametrize("length", [0, 1, 7, 8, 9, 63, 64, 65, 1000, 4099])
+def test_bitwise_ops_ragged_lengths(length):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.5
+    other = rng.random(length) > 0.5
+    bma = PandasMaskArray(arr)
+    bma_other = PandasMaskArray(other)
+
+    npt.assert_array_equal(np.array(bma & bma_other), arr & other)
+    npt.assert_array_equal(np.array(bma | bma_other), arr | other)
+    npt.assert_array_equal(np.array(bma ^ bma_other), arr ^ other)
+    npt.assert_array_equal(np.array(~bma), ~arr)
+    assert bma.any() == arr.any()
+    assert bma.all() == arr.all()
+    assert (~bma).any() == (~arr).any()
+    assert (~bma).all() == (~arr).all()
+
+@pytest.mark.parametrize("length", [0, 1, 65, 4096, 10001])
+def test_lazy_expression(length):
+    rng = np.random.default_rng(length)
+    a, b, c, d = (rng.random(length) > 0.5 for _ in range(4))
+    bma, bmb, bmc, bmd = (PandasMaskArray(x) for x in (a, b, c, d))
+
+    expr = (bma.lazy() & bmb) | ~bmc.lazy() ^ d
+    expected = (a & b) | ~c ^ d
+
+    assert isinstance(expr, pandas_mask.PandasMaskExpr)
+    assert len(expr) == length
+    assert expr.shape == (length,)
+    assert expr.sum() == expected.sum()
+    assert expr.any() == expected.any()
+    assert expr.all() == expected.all()
+    npt.assert_array_equal(np.array(expr), expected)
+
+    result = expr.evaluate()
+    assert isinstance(result, PandasMaskArray)
+    npt.assert_array_equal(np.array(result), expected)
+
+def test_lazy_mixed_with_mask():
+    a = np.array([True, False, True, True, False])
+    b = np.array([True, True, False, True, False])
+    bma = PandasMaskArray(a)
+    bmb = PandasMaskArray(b)
+
+    expr = bma & bmb.lazy()
+    assert isinstance(expr, pandas_mask.PandasMaskExpr)
+    assert expr.sum() == (a & b).sum()
+
+    # the expression captured the masks as they were when it was built
+    bma[:] = False
+    assert expr.sum() == (a & b).sum()
+
+def test_lazy_length_mismatch_raises():
+    bma = PandasMaskArray(np.array([True, False, True]))
+    other = PandasMaskArray(np.array([True, False]))
+
+    with pytest.raises(ValueError):
+        bma.lazy() & other
+
+@pytest.mark.parametrize("length", [0, 1, 63, 64, 65, 1000])
+@pytest.mark.parametrize("as_mask", [True, False])
+def test_fused_binary_reductions(length, as_mask):
+    rng = np.random.default_rng(length)
+    a = rng.random(length) > 0.5
+    b = rng.random(length) > 0.5
+    bma = PandasMaskArray(a)
+    other = PandasMaskArray(b) if as_mask else b
+
+    assert bma.count_and(other) == (a & b).sum()
+    assert bma.count_and_not(other) == (a & ~b).sum()
+    assert bma.count_or(other) == (a | b).sum()
+    assert bma.count_xor(other) == (a ^ b).sum()
+    assert bma.any_and(other) == (a & b).any()
+    assert bma.any_and_not(other) == (a & ~b).any()
+    assert bma.any_xor(other) == (a ^ b).any()
+    assert bma.all_or(other) == (a | b).all()
+    assert bma.all_xor(other) == (a ^ b).all()
+
+def test_fused_binary_reductions_raise():
+    bma = PandasMaskArray(np.array([True, False, True]))
+
+    with pytest.raises(ValueError):
+        bma.count_and(PandasMaskArray(np.array([True, False])))
+    with pytest.raises(TypeError):
+        bma.any_and("foo")
+
+@pytest.mark.parametrize("length", [1, 63, 64, 65, 1000])
+def test_find_first_find_last(length):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.9
+    bma = PandasMaskArray(arr)
+
+    for value in (True, False):
+        positions = np.flatnonzero(arr == value)
+        for start in (0, length // 2, length):
+            after = positions[positions >= start]
+            before = positions[positions < start]
+            assert bma.find_first(value, start) == (after[0] if len(after) else -1)
+            assert bma.find_last(value, start) == (before[-1] if len(before) else -1)
+        assert bma.find_last(value) == (positions[-1] if len(positions) else -1)
+
+    assert bma.find_first() == bma.find_first(True, 0)
+
+def test_find_first_raises():
+    bma = PandasMaskArray(np.array([True, False, True]))
+
+    with pytest.raises(IndexError):
+        bma.find_first(True, 4)
+    with pytest.raises(IndexError):
+        bma.find_last(True, -1)
+
+@pytest.mark.parametrize("length", [0, 1, 7, 65, 1000, 5000])
+@pytest.mark.parametrize("density", [0.0, 0.01, 0.5, 1.0])
+def test_nonzero(length, density):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) < density
+    bma = PandasMaskArray(arr)
+
+    result = bma.flatnonzero()
+    assert result.dtype == np.int64
+    npt.assert_array_equal(result, np.flatnonzero(arr))
+
+    (nonzero,) = bma.nonzero()
+    npt.assert_array_equal(nonzero, np.flatnonzero(arr))
+
+def test_nonzero_slice():
+    arr = np.array([True, False, True, True, False, False, True, True, False, True])
+    bma = PandasMaskArray(arr)
+
+    npt.assert_array_equal(bma[3:].flatnonzero(), np.flatnonzero(arr[3:]))
+
+@pytest.mark.parametrize("length", [0, 1, 63, 64, 65, 1000])
+def test_iter_lengths(length):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.5
+    bma = PandasMaskArray(arr)
+
+    assert list(bma) == arr.tolist()
+    assert list(bma[1:]) == arr[1:].tolist()
+
+@pytest.mark.parametrize("length", [0, 1, 63, 64, 65, 1000])
+def test_iter_set(length):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.9
+    bma = PandasMaskArray(arr)
+
+    assert list(bma.iter_set()) == np.flatnonzero(arr).tolist()
+    assert list(bma[3:].iter_set()) == np.flatnonzero(arr[3:]).tolist()
+
+@pytest.mark.parametrize("length", [1, 9, 64, 1000])
+def test_getitem_ndarray_ints_lengths(length):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.5
+    bma = PandasMaskArray(arr)
+    idxer = rng.integers(-length, length, 257)
+
+    npt.assert_array_equal(np.array(bma[idxer]), arr[idxer])
+    npt.assert_array_equal(np.array(bma[idxer[::3]]), arr[idxer[::3]])
+    npt.assert_array_equal(np.array(bma[idxer.tolist()]), arr[idxer])
+    npt.assert_array_equal(np.array(bma[2:].take(idxer[idxer < length - 2])),
+                           arr[2:][idxer[idxer < length - 2]])
+
+    with pytest.raises(IndexError):
+        bma[np.array([0, length])]
+
+def test_take_allow_fill():
+    arr = np.array([True, False, True, True])
+    bma = PandasMaskArray(arr)
+    idxer = np.array([3, -1, 1, -1, 0])
+
+    result = bma.take_1d(idxer, allow_fill=True)
+    npt.assert_array_equal(np.array(result), [True, False, False, False, True])
+    result = bma.take(idxer.tolist(), allow_fill=True, fill_value=True)
+    npt.assert_array_equal(np.array(result), [True, True, False, True, True])
+    # without allow_fill -1 is the last element
+    npt.assert_array_equal(np.array(bma.take(idxer)), arr[idxer])
+
+    with pytest.raises(ValueError):
+        bma.take(np.array([0, -2]), allow_fill=True)
+    with pytest.raises(TypeError):
+        bma.take("foo")
+
+@pytest.mark.parametrize("length", [0, 1, 63, 64, 65, 1000])
+@pytest.mark.parametrize("as_mask", [True, False])
+def test_getitem_boolean_filter(length, as_mask):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.5
+    selector = rng.random(length) > 0.3
+    bma = PandasMaskArray(arr)
+
+    result = bma[PandasMaskArray(selector) if as_mask else selector]
+    assert isinstance(result, PandasMaskArray)
+    npt.assert_array_equal(np.array(result), arr[selector])
+
+def test_getitem_boolean_filter_raises():
+    bma = PandasMaskArray(np.array([True, False, True, True]))
+
+    with pytest.raises(ValueError, match="must be same size"):
+        bma[PandasMaskArray(np.array([True, False]))]
+
+@pytest.mark.parametrize("key", [
+    slice(3, 70), slice(None, None, 3), slice(64, None, 2),
+    slice(None, None, -1), slice(90, 5, -7), slice(10, 10),
+])
+@pytest.mark.parametrize("as_mask", [True, False])
+def test_setitem_slice_values(key, as_mask):
+    rng = np.random.default_rng(0)
+    arr = rng.random(100) > 0.5
+    bma = PandasMaskArray(arr)
+    expected = arr.copy()
+
+    values = rng.random(len(expected[key])) > 0.5
+    bma[key] = PandasMaskArray(values) if as_mask else values
+    expected[key] = values
+    npt.assert_array_equal(np.array(bma), expected)
+
+    bma[key] = True
+    expected[key] = True
+    npt.assert_array_equal(np.array(bma), expected)
+
+def test_setitem_slice_from_own_slice():
+    arr = np.array([True, False, False, True, True, False, True] * 3)
+    bma = PandasMaskArray(arr)
+
+    bma[1:11] = bma[0:10]
+    arr[1:11] = arr[0:10].copy()
+    npt.assert_array_equal(np.array(bma), arr)
+
+def test_setitem_slice_values_length_raises():
+    bma = PandasMaskArray(np.array([True, False, True, True]))
+
+    with pytest.raises(ValueError, match="could not assign"):
+        bma[1:] = np.array([True, False])
+
+@pytest.mark.parametrize("length", [0, 1, 63, 64, 65, 1000])
+@pytest.mark.parametrize("as_mask", [True, False])
+def test_setitem_mask_under_mask(length, as_mask):
+    rng = np.random.default_rng(length)
+    arr = rng.random(length) > 0.5
+    selector = rng.random(length) > 0.3
+    full = rng.random(length) > 0.5
+    indexer = PandasMaskArray(selector) if as_mask else selector
+
+    bma = PandasMaskArray(arr)
+    bma[indexer] = PandasMaskArray(full) if as_mask else full
+    expected = arr.copy()
+    expected[selector] = full[selector]
+    npt.assert_array_equal(np.array(bma), expected)
+
+    bma = PandasMaskArray(arr)
+    packed = full[:selector.sum()]
+    bma[indexer] = PandasMaskArray(packed) if as_mask else packed
+    expected = arr.copy()
+    expected[selector] = packed
+    npt.assert_array_equal(np.array(bma), expected)
+
+def test_setitem_mask_under_mask_raises():
+    bma = PandasMaskArray(np.array([True, False, True, True]))
+    selector = np.array([True, False, True, False])
+
+    with pytest.raises(ValueError, match="as many values"):
+        bma[selector] = np.array([True, False, True])
+    with pytest.raises(ValueError, match="same length"):
+        bma[PandasMaskArray(np.array([True]))] = True
+
+def test_concatenate():
+    rng = np.random.default_rng(1)
+    arrays = [rng.random(n) > 0.5 for n in (0, 1, 7, 64, 65, 300, 3)]
+    whole = PandasMaskArray(np.concatenate(arrays))
+    # slices of a mask start part way through a byte
+    inputs = [whole[3:10], arrays[4]] + [PandasMaskArray(a) for a in arrays]
+    expected = np.concatenate([np.array(whole)[3:10], arrays[4]] + arrays)
+
+    result = pandas_mask.concatenate(inputs)
+    assert isinstance(result, PandasMaskArray)
+    npt.assert_array_equal(np.array(result), expected)
+    assert len(pandas_mask.concatenate([])) == 0
+
+def test_inplace_aliases():
+    arr = np.array([True, False, True, False, False, True, True, False, True])
+    other = np.array([True, True, False, True, False, False, True, True, False])
+
+    bma = PandasMaskArray(arr)
+    bma ^= bma
+    assert not bma.any()
+
+    bma = PandasMaskArray(arr)
+    assert bma.bitwise_or(other, out=bma) is bma
+    npt.assert_array_equal(np.array(bma), arr | other)
+
+    bma = PandasMaskArray(arr)
+    rhs = PandasMaskArray(other)
+    assert bma.bitwise_and(rhs, out=rhs) is rhs
+    npt.assert_array_equal(np.array(rhs), arr & other)
+    npt.assert_array_equal(np.array(bma), arr)
+
+    # compressed operands merge their runs and stay compressed
+    bma = PandasMaskArray(arr, compress=True)
+    bma |= PandasMaskArray(other, compress=True)
+    assert bma.is_compressed
+    npt.assert_array_equal(np.array(bma), arr | other)
+
+def test_concatenate_raises():
+    with pytest.raises(TypeError):
+        pandas_mask.concatenate([PandasMaskArray(np.array([True])), [True]])
+
+def test_parallel_matches_serial():
+    threshold = pandas_mask.get_parallel_threshold()
+    nthreads = pandas_mask.get_num_threads()
+    rng = np.random.default_rng(2)
+    arr = rng.random(100_003) > 0.5
+    other = rng.random(100_003) > 0.5
+    try:
+        # split even the smallest mask across four threads
+        pandas_mask.set_parallel_threshold(0)
+        pandas_mask.set_num_threads(4)
+        bma = PandasMaskArray(arr)[3:]
+        npt.assert_array_equal(np.array(bma), arr[3:])
+        npt.assert_array_equal(np.array(~bma), ~arr[3:])
+        npt.assert_array_equal(np.array(bma & other[3:]), arr[3:] & other[3:])
+        assert bma.sum() == arr[3:].sum()
+    finally:
+        pandas_mask.set_parallel_threshold(threshold)
+        pandas_mask.set_num_threads(nthreads)
+
+def test_parallel_settings_raise():
+    with pytest.raises(ValueError):
+        pandas_mask.set_num_threads(0)
+    with pytest.raises(ValueError):
+        pandas_mask.set_parallel_threshold(-1)
+
+def test_arrow_roundtrip():
+    arr = np.array([True, False, True, True, False, False, True, False] * 9)
+    bma = PandasMaskArray(arr)
+
+    for start in (0, 3, 8):
+        result = PandasMaskArray.from_arrow(bma[start:])
+        npt.assert_array_equal(np.array(result), arr[start:])
+
+    # the imported buffer is never written through
+    result = PandasMaskArray.from_arrow(bma)
+    result[0] = False
+    assert bma[0]
+
+def test_arrow_pyarrow_interop():
+    pa = pytest.importorskip("pyarrow")
+    arr = np.array([True, False, True, True, False] * 20)
+    bma = PandasMaskArray(arr)
+
+    exported = pa.array(bma[3:])
+    assert exported.type == pa.bool_()
+    assert exported.to_pylist() == arr[3:].tolist()
+
+    imported = PandasMaskArray.from_arrow(pa.array(arr.tolist())[5:])
+    npt.assert_array_equal(np.array(imported), arr[5:])
+
+    column = pa.array([1, None, 3, None, 5, 6, None, 8, 9])[1:]
+    validity = PandasMaskArray.from_arrow(column, validity=True)
+    npt.assert_array_equal(np.array(validity), column.is_valid().to_numpy())
+    no_nulls = PandasMaskArray.from_arrow(pa.array([1, 2, 3]), validity=True)
+    assert no_nulls.all()
+
+    # the validity bitmap is set where values are present, so it skips them
+    # in the masked reductions until inverted into a mask of missing values
+    values = np.array([100, 3, 100, 5, 6, 100, 8, 9])
+    assert validity.masked_sum(values) == 300
+    assert (~validity).masked_sum(values) == 31
+
+    # a slice past the nulls of its parent, whose null count a producer may
+    # leave uncounted, and an empty array with no buffers at all
+    sliced = pa.array([None, True, False, True])[1:]
+    npt.assert_array_equal(np.array(PandasMaskArray.from_arrow(sliced)),
+                           [True, False, True])
+    assert len(PandasMaskArray.from_arrow(pa.array([], pa.bool_()))) == 0
+
+    with pytest.raises(TypeError, match="boolean"):
+        PandasMaskArray.from_arrow(pa.array([1, 2, 3]))
+    with pytest.raises(ValueError, match="nulls"):
+        PandasMaskArray.from_arrow(pa.array([True, None]))
+    with pytest.raises(TypeError):
+        PandasMaskArray.from_arrow(arr)
+
+@pytest.mark.parametrize("mode", ["r", "c"])
+def test_file_roundtrip(tmp_path, mode):
+    arr = np.random.default_rng(5).random(1001) > 0.5
+    path = tmp_path / "mask.bin"
+    PandasMaskArray(arr)[3:].to_file(path)
+
+    bma = PandasMaskArray.from_file(path, mode=mode)
+    npt.assert_array_equal(np.array(bma), arr[3:])
+    npt.assert_array_equal(np.array(bma & ~bma), np.zeros(998, dtype=bool))
+
+    # writes stay in memory
+    bma[:] = True
+    assert bma.all()
+    npt.assert_array_equal(np.array(PandasMaskArray.from_file(str(path))),
+                           arr[3:])
+
+def test_file_errors(tmp_path):
+    with pytest.raises(FileNotFoundError):
+        PandasMaskArray.from_file(tmp_path / "missing.bin")
+
+    path = tmp_path / "not_a_mask.bin"
+    path.write_bytes(b"x" * 100)
+    with pytest.raises(ValueError, match="not a pandas_mask file"):
+        PandasMaskArray.from_file(path)
+    with pytest.raises(ValueError, match="mode"):
+        PandasMaskArray.from_file(path, mode="w")
+
+@pytest.mark.parametrize("dtype", ["int8", "uint16", "int64", "float32",
+                                   "float64"])
+def test_masked_reductions(dtype):
+    values = np.arange(1, 11, dtype=dtype)
+    missing = np.array([True, False] * 5)
+    bma = PandasMaskArray(missing)
+    present = values[~missing].astype("float64")
+
+    assert bma.masked_sum(values) == present.sum()
+    assert bma.masked_prod(values) == present.prod()
+    assert bma.masked_min(values) == present.min()
+    assert bma.masked_max(values) == present.max()
+    assert bma.masked_mean(values) == pytest.approx(present.mean())
+    assert bma.masked_var(values) == pytest.approx(present.var(ddof=1))
+    assert bma.masked_var(values, ddof=0) == pytest.approx(present.var())
+
+    # any missing value makes the result missing unless skipped
+    assert bma.masked_sum(values, skipna=False) is None
+    assert PandasMaskArray(np.ones(10, dtype=bool)).masked_max(values) is None
+
+def test_masked_min_max_nan():
+    missing = PandasMaskArray(np.array([False, False, False, True]))
+    for values in ([np.nan, 1.0, 2.0, 0.0], [1.0, 2.0, np.nan, 0.0]):
+        assert np.isnan(missing.masked_min(np.array(values)))
+        assert np.isnan(missing.masked_max(np.array(values)))
+    assert missing.masked_min(np.array([1.0, 2.0, 3.0, np.nan])) == 1.0
+
+def test_masked_reductions_raise():
+    bma = PandasMaskArray(np.array([True, False, False]))
+    with pytest.raises(ValueError):
+        bma.masked_sum(np.arange(4))
+    with pytest.raises(TypeError):
+        bma.masked_sum(np.array([True, False, True]))
+
+@pytest.mark.parametrize("dtype", ["int8", "uint32", "int64", "float32",
+                                   "float64"])
+def test_from_compare(dtype):
+    values = (np.arange(1000) % 10).astype(dtype)
+    for op, func in [("<", operator.lt), ("le", operator.le),
+                     ("==", operator.eq), ("ne", operator.ne),
+                     ("gt", operator.gt), (">=", operator.ge)]:
+        result = PandasMaskArray.from_compare(values, op, 5)
+        npt.assert_array_equal(np.array(result), func(values, 5))
+
+    npt.assert_array_equal(np.array(PandasMaskArray.isin_range(values, 3, 7)),
+                           (values >= 3) & (values <= 7))
+    assert not PandasMaskArray.isnan(values).any()
+
+def test_from_compare_floats():
+    values = np.array([1.0, np.nan, 3.0, np.nan, -0.0])
+    npt.assert_array_equal(np.array(PandasMaskArray.isnan(values)),
+                           np.isnan(values))
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.from_compare(values, "<", 10)), values < 10)
+
+    with pytest.raises(ValueError, match="op"):
+        PandasMaskArray.from_compare(values, "~", 1)
+    with pytest.raises(TypeError):
+        PandasMaskArray.from_compare(values, "<", "a")
+    with pytest.raises(TypeError):
+        PandasMaskArray.isnan(np.array(["a", "b"]))
+
+def test_from_compare_other_scalar_types():
+    # compared by value, however the scalar relates to the dtype of values
+    small = np.arange(5, dtype="int8")
+    for op, scalar, expected in [
+            ("<", 1000, [True] * 5), (">", 300, [False] * 5),
+            ("!=", -1000, [True] * 5), ("<", 2.5, small < 2.5),
+            (">=", 2.5, small >= 2.5), ("==", 2.0, small == 2),
+            ("==", 2.5, [False] * 5), ("<", float("nan"), [False] * 5),
+            ("<", float("inf"), [True] * 5)]:
+        result = PandasMaskArray.from_compare(small, op, scalar)
+        npt.assert_array_equal(np.array(result), expected)
+
+    unsigned = np.array([0, 2**64 - 1], dtype="uint64")
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.from_compare(unsigned, "==", 2**64 - 1)),
+        [False, True])
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.from_compare(unsigned, ">", -1)), [True, True])
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.from_compare(unsigned, "<", 2**70)),
+        [True, True])
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.from_compare(small, ">", np.int64(2))),
+        small > 2)
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.isin_range(small, -1000, 2.5)),
+        [True, True, True, False, False])
+    npt.assert_array_equal(
+        np.array(PandasMaskArray.isin_range(small, 1.5, 1000)),
+        [False, False, True, True, True])
+
+@pytest.mark.parametrize("dtype", ["int8", "uint32", "int64", "float32",
+                                   "float64"])
+def test_where_putmask(dtype):
+    rng = np.random.default_rng(8)
+    arr = rng.random(1003) > 0.5
+    arr[100:400] = True
+    arr[500:800] = False
+    bma = PandasMaskArray(arr)
+    values = np.arange(1003).astype(dtype)
+    other = values[::-1].copy()
+
+    npt.assert_array_equal(bma.where(values, other),
+                           np.where(arr, values, other))
+    npt.assert_array_equal(bma.where(values, 7), np.where(arr, values, 7))
+
+    out = np.empty_like(values)
+    assert bma.where(values, other, out=out) is out
+    npt.assert_array_equal(out, np.where(arr, values, other))
+
+    filled = bma.putmask(values, 0, out=np.empty_like(values))
+    expected = values.copy()
+    np.putmask(expected, arr, 0)
+    npt.assert_array_equal(filled, expected)
+
+    # in place by default, as numpy.putmask
+    assert bma.putmask(values, 0) is values
+    npt.assert_array_equal(values, expected)
+
+    # a strided other is read through a contiguous copy
+    strided = np.arange(2006).astype(dtype)[::2]
+    npt.assert_array_equal(bma.where(values, strided),
+                           np.where(arr, values, strided))
+
+def test_where_putmask_raises():
+    bma = PandasMaskArray(np.array([True, False, True]))
+    values = np.arange(3, dtype="int8")
+    with pytest.raises(ValueError):
+        bma.where(np.arange(4), 0)
+    with pytest.raises(ValueError):
+        bma.where(values, np.arange(4, dtype="int8"))
+    with pytest.raises(TypeError):
+        bma.putmask(values, 1000)
+    with pytest.raises(TypeError):
+        bma.where(values, 0, out=np.empty(3, dtype="int16"))
+    with pytest.raises(TypeError, match="dtype"):
+        bma.where(values, np.arange(3, dtype="float64"))
+
+    # out may be an input itself, but must not partly overlap one
+    buf = np.arange(4, dtype="int8")
+    with pytest.raises(ValueError, match="overlap"):
+        bma.putmask(buf[:-1], 0, out=buf[1:])
+    with pytest.raises(ValueError, match="overlap"):
+        bma.where(values, buf[:-1], out=buf[1:])
+    other = np.zeros(3, dtype="int8")
+    assert bma.where(values, other, out=other) is other
+    npt.assert_array_equal(other, [0, 0, 2])
+
+    readonly = values.copy()
+    readonly.flags.writeable = False
+    with pytest.raises(TypeError):
+        bma.putmask(readonly, 0)
+
+def test_kleene_boolean():
+    elements = [True, False, None]
+    lhs = [a for a in elements for _ in elements]
+    rhs = elements * 3
+
+    def column(items):
+        values = np.array([bool(x) for x in items])
+        validity = np.array([x is not None for x in items])
+        return pandas_mask.KleeneBoolean(values, PandasMaskArray(validity))
+
+    def kleene_and(a, b):
+        if a is False or b is False:
+            return False
+        return None if a is None or b is None else True
+
+    def kleene_or(a, b):
+        if a is True or b is True:
+            return True
+        return None if a is None or b is None else False
+
+    def kleene_xor(a, b):
+        return None if a is None or b is None else a != b
+
+    left, right = column(lhs), column(rhs)
+    for result, expected in [
+        (left & right, map(kleene_and, lhs, rhs)),
+        (left | right, map(kleene_or, lhs, rhs)),
+        (left ^ right, map(kleene_xor, lhs, rhs)),
+        (~left, [None if a is None else not a for a in lhs]),
+    ]:
+        assert [result[i] for i in range(len(result))] == list(expected)
+
+    assert left.any() and not left.all()
+    trues = column([True, None])
+    assert trues.all() is True
+    assert trues.all(skipna=False) is None
+    assert column([None, None]).any(skipna=False) is None
+    npt.assert_array_equal(np.array(trues.validity), [True, False])
+
+    with pytest.raises(ValueError):
+        left & column([True])
+    with pytest.raises(IndexError):
+        left[9]